@@ -1,6 +1,6 @@
 from __future__ import annotations
 import numpy
-__all__ = ['MinMaxStatsList', 'Roots', 'SearchResults', 'batch_backpropagate', 'batch_expand', 'batch_traverse', 'init_module']
+__all__ = ['MinMaxStatsList', 'Roots', 'SearchResults', 'batch_backpropagate', 'batch_expand', 'batch_traverse', 'benchmark_kernels', 'init_module', 'kernel_isa', 'set_kernel_isa']
 class MinMaxStatsList:
     def __init__(self, arg0: int) -> None:
         ...
@@ -29,5 +29,11 @@ def batch_expand(arg0: int, arg1: numpy.ndarray[bool], arg2: numpy.ndarray[numpy
     ...
 def batch_traverse(arg0: Roots, arg1: int, arg2: float, arg3: float, arg4: MinMaxStatsList, arg5: SearchResults) -> tuple:
     ...
+def benchmark_kernels(n_children: int = 32, iters: int = 100000) -> dict:
+    ...
 def init_module(seed: int) -> None:
     ...
+def kernel_isa() -> str:
+    ...
+def set_kernel_isa(name: str) -> bool:
+    ...
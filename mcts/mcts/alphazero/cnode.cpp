@@ -1,8 +1,9 @@
 #include <algorithm>
-#include <map>
 #include <cassert>
+#include <stdexcept>
 
 #include "mcts/alphazero/cnode.h"
+#include "mcts/alphazero/kernels.h"
 
 
 namespace tree
@@ -26,7 +27,7 @@ namespace tree
             x[i] = x[i] / sum;
         }
         return x;
-    }    
+    }
 
     SearchResults::SearchResults()
     {
@@ -35,6 +36,7 @@ namespace tree
             Initialization of SearchResults, the default result number is set to 0.
         */
         this->num = 0;
+        this->pool = nullptr;
     }
 
     SearchResults::SearchResults(int num)
@@ -44,9 +46,10 @@ namespace tree
             Initialization of SearchResults with result number.
         */
         this->num = num;
+        this->pool = nullptr;
         for (int i = 0; i < num; ++i)
         {
-            this->search_paths.push_back(std::vector<Node *>());
+            this->search_paths.push_back(std::vector<int>());
         }
     }
 
@@ -54,130 +57,146 @@ namespace tree
 
     //*********************************************************
 
-    Node::Node()
+    NodePool::NodePool()
     {
         /*
         Overview:
-            Initialization of Node.
+            Initialization of an empty NodePool.
         */
-        this->prior = 0;
-        this->visit_count = 0;
-        this->value_sum = 0;
-        this->best_action = -1;
-        this->reward = 0.0;
+        this->size = 0;
     }
 
-    Node::Node(float prior)
+    NodePool::~NodePool() {}
+
+    int NodePool::allocate(int n)
     {
         /*
         Overview:
-            Initialization of Node with prior value and legal actions.
+            Allocate a block of n new nodes with zero statistics.
         Arguments:
-            - prior: the prior value of this node.
-            - legal_actions: a vector of legal actions of this node.
+            - n: the number of nodes.
+        Outputs:
+            - index: the index of the first node of the block.
         */
-        this->prior = prior;
-        this->visit_count = 0;
-        this->value_sum = 0;
-        this->best_action = -1;
-        this->reward = 0.0;
-
-        this->state_index = -1;
-        this->batch_index = -1;
+        int first = this->size;
+        int capacity = this->visit_count.size();
+        if (first + n > capacity)
+        {
+            // the arrays only grow, so clear never frees them
+            capacity = std::max(capacity * 2, first + n);
+            this->action.resize(capacity);
+            this->visit_count.resize(capacity);
+            this->state_index.resize(capacity);
+            this->batch_index.resize(capacity);
+            this->best_action.resize(capacity);
+            this->first_child.resize(capacity);
+            this->n_children.resize(capacity);
+            this->reward.resize(capacity);
+            this->prior.resize(capacity);
+            this->value_sum.resize(capacity);
+        }
+        std::fill_n(&this->action[first], n, -1);
+        std::fill_n(&this->visit_count[first], n, 0);
+        std::fill_n(&this->state_index[first], n, -1);
+        std::fill_n(&this->batch_index[first], n, -1);
+        std::fill_n(&this->best_action[first], n, -1);
+        std::fill_n(&this->first_child[first], n, -1);
+        std::fill_n(&this->n_children[first], n, 0);
+        std::fill_n(&this->reward[first], n, 0.0f);
+        std::fill_n(&this->prior[first], n, 0.0f);
+        std::fill_n(&this->value_sum[first], n, 0.0f);
+        this->size = first + n;
+        return first;
     }
 
-    Node::~Node() {}
+    void NodePool::clear()
+    {
+        /*
+        Overview:
+            Free all nodes, the memory is kept for reuse.
+        */
+        this->size = 0;
+    }
 
-    void Node::expand(
-        int state_index, int batch_index, float reward, const Array &logits, const Array &legal_actions)
+    void NodePool::expand(
+        int index, int state_index, int batch_index, float reward, const Array &logits, const Array &legal_actions)
     {
         /*
         Overview:
-            Expand the child nodes of the current node.
+            Expand the child nodes of a node.
+            Duplicate legal actions give a single child. Its prior is the softmax over the distinct
+            actions. The map based nodes also gave one child per action, but counted a duplicate twice
+            in the softmax sum, so their priors did not sum to one.
         Arguments:
+            - index: the node to expand.
             - state_index: The index of state of the leaf node in the search path of the current node.
             - batch_index: The index of state of the leaf node in the search path of the current node.
             - reward: the reward of the current node.
             - logits: the logit of the child nodes.
         */
-        this->state_index = state_index;
-        this->batch_index = batch_index;
-        this->reward = reward;
+        this->state_index[index] = state_index;
+        this->batch_index[index] = batch_index;
+        this->reward[index] = reward;
 
-        float temp_policy;
-        float policy_sum = 0.0;
-
-        int n_actions = logits.Shape(0);
+        // children are ordered by action
         int n_legal_actions = legal_actions.Shape(0);
-        // Softmax over logits of legal actions
-        float policy[n_actions];
-
-        float policy_max = FLOAT_MIN;
+        std::vector<Action> actions(n_legal_actions);
         for (int i = 0; i < n_legal_actions; ++i)
         {
-            int a = legal_actions[i];
-            float logit = logits[a];
-            if (policy_max < logit)
-            {
-                policy_max = logit;
-            }
+            actions[i] = legal_actions[i];
         }
+        std::sort(actions.begin(), actions.end());
+        actions.erase(std::unique(actions.begin(), actions.end()), actions.end());
+        int n = actions.size();
 
-        for (int i = 0; i < n_legal_actions; ++i)
-        {
-            int a = legal_actions[i];
-            float logit = logits[a];
-            temp_policy = exp(logit - policy_max);
-            policy_sum += temp_policy;
-            policy[a] = temp_policy;
-        }
+        int first = this->allocate(n);
+        this->first_child[index] = first;
+        this->n_children[index] = n;
 
-        float prior;
-        for (int i = 0; i < n_legal_actions; ++i)
-        {
-            int a = legal_actions[i];
-            prior = policy[a] / policy_sum;
-            this->children[a] = Node(prior);
-        }
+        // Softmax over logits of legal actions
+        kernels().softmax(static_cast<const float *>(logits.Data()), actions.data(), n, this->prior.data() + first);
+        std::copy(actions.begin(), actions.end(), this->action.data() + first);
     }
 
-    void Node::add_exploration_noise(float exploration_fraction, float dirichlet_alpha)
+    void NodePool::add_exploration_noise(int index, float exploration_fraction, float dirichlet_alpha)
     {
         /*
         Overview:
             Add a noise to the prior of the child nodes.
         Arguments:
+            - index: the node whose children get the noise.
             - exploration_fraction: the fraction to add noise.
-            - noises: the vector of noises added to each child node.
+            - dirichlet_alpha: the dirichlet alpha.
         */
-        std::vector<float> noises = random_dirichlet(dirichlet_alpha, this->children.size());
-        float noise, prior;
-        int i = 0;
-        for (auto &[a, child] : this->children)
+        int first = this->first_child[index];
+        std::vector<float> noises = random_dirichlet(dirichlet_alpha, this->n_children[index]);
+        for (int i = 0; i < this->n_children[index]; ++i)
         {
-            noise = noises[i++];
-            prior = child.prior;
-            child.prior = prior * (1 - exploration_fraction) + noise * exploration_fraction;
+            float prior = this->prior[first + i];
+            this->prior[first + i] = prior * (1 - exploration_fraction) + noises[i] * exploration_fraction;
         }
     }
 
-    float Node::compute_mean_q(int isRoot, float parent_q, float discount_factor)
+    float NodePool::compute_mean_q(int index, int isRoot, float parent_q, float discount_factor) const
     {
         /*
         Overview:
-            Compute the mean q value of the current node.
+            Compute the mean q value of a node.
         Arguments:
+            - index: the node.
             - isRoot: whether the current node is a root node.
             - parent_q: the q value of the parent node.
             - discount_factor: the discount_factor of reward.
         */
+        int first = this->first_child[index];
+        int n = this->n_children[index];
         float total_unsigned_q = 0.0;
         int total_visits = 0;
-        for (const auto &[a, child] : this->children)
+        for (int c = first; c < first + n; ++c)
         {
-            if (child.visit_count > 0)
+            if (this->visit_count[c] > 0)
             {
-                float qsa = child.reward + discount_factor * child.value();
+                float qsa = this->reward[c] + discount_factor * this->value(c);
                 total_unsigned_q += qsa;
                 total_visits += 1;
             }
@@ -195,56 +214,50 @@ namespace tree
         return mean_q;
     }
 
-    int Node::expanded() const
+    int NodePool::expanded(int index) const
     {
         /*
         Overview:
-            Return whether the current node is expanded.
+            Return whether a node is expanded.
         */
-        return this->children.size() > 0;
+        return this->n_children[index] > 0;
     }
 
-    float Node::value() const
+    float NodePool::value(int index) const
     {
         /*
         Overview:
-            Return the real value of the current tree.
+            Return the real value of a node.
         */
-        float true_value = 0.0;
-        if (this->visit_count == 0)
+        if (this->visit_count[index] == 0)
         {
-            return true_value;
-        }
-        else
-        {
-            true_value = this->value_sum / this->visit_count;
-            return true_value;
+            return 0.0;
         }
+        return this->value_sum[index] / this->visit_count[index];
     }
 
-    std::vector<int> Node::get_trajectory()
+    std::vector<int> NodePool::get_trajectory(int index) const
     {
         /*
         Overview:
-            Find the current best trajectory starts from the current node.
+            Find the current best trajectory starts from a node.
         Outputs:
             - traj: a vector of node index, which is the current best trajectory from this node.
         */
         std::vector<int> traj;
 
-        Node *node = this;
-        int best_action = node->best_action;
+        int best_action = this->best_action[index];
         while (best_action >= 0)
         {
             traj.push_back(best_action);
 
-            node = node->get_child(best_action);
-            best_action = node->best_action;
+            index = this->get_child(index, best_action);
+            best_action = this->best_action[index];
         }
         return traj;
     }
 
-    std::vector<int> Node::get_children_distribution()
+    std::vector<int> NodePool::get_children_distribution(int index) const
     {
         /*
         Overview:
@@ -252,30 +265,26 @@ namespace tree
         Outputs:
             - distribution: a vector of distribution of child nodes in the format of visit count (i.e. [1,3,0,2,5]).
         */
-        std::vector<int> distribution;
-        if (this->expanded())
-        {
-            for (const auto &[a, child] : this->children)
-            {
-                distribution.push_back(child.visit_count);
-            }
-        }
-        return distribution;
+        int first = this->first_child[index];
+        int n = this->n_children[index];
+        return std::vector<int>(this->visit_count.begin() + first, this->visit_count.begin() + first + n);
     }
 
-    Node *Node::get_child(int action)
+    int NodePool::get_child(int index, int action) const
     {
         /*
         Overview:
             Get the child node corresponding to the input action.
         Arguments:
+            - index: the parent node.
             - action: the action to get child.
         */
-        auto it = this->children.find(action);
-        if (it != this->children.end())
+        auto begin = this->action.begin() + this->first_child[index];
+        auto end = begin + this->n_children[index];
+        auto it = std::lower_bound(begin, end, action);
+        if (it != end && *it == action)
         {
-            // The action exists in the map, return a pointer to the corresponding Node.
-            return &(it->second);
+            return it - this->action.begin();
         }
         else
         {
@@ -304,11 +313,8 @@ namespace tree
         */
         this->root_num = root_num;
 
-        for (int i = 0; i < root_num; ++i)
-        {
-            // root node has no prior
-            this->roots.push_back(Node(0));
-        }
+        // root node has no prior
+        this->nodes.allocate(root_num);
     }
 
     Roots::~Roots() {}
@@ -328,21 +334,20 @@ namespace tree
             - exploration_fraction: the fraction to add noise, 0 means no noise.
             - dirichlet_alpha: the dirichlet alpha.
         Note:
-            Do not include terminal states because they have no legal actions and cannot be expanded. 
+            Do not include terminal states because they have no legal actions and cannot be expanded.
         */
         int batch_size = this->root_num;
         int offset = 0;
-        int n_actions = logits.Shape(1);
         for (int i = 0; i < batch_size; ++i)
         {
             int n_legal_action = n_legal_actions[i];
             const Array &legal_actions = all_legal_actions.Slice(offset, offset + n_legal_action);
-            this->roots[i].expand(
-                0, i, rewards[i], logits[i], legal_actions);
+            this->nodes.expand(
+                i, 0, i, rewards[i], logits[i], legal_actions);
             if (exploration_fraction > 0) {
-                this->roots[i].add_exploration_noise(exploration_fraction, dirichlet_alpha);
+                this->nodes.add_exploration_noise(i, exploration_fraction, dirichlet_alpha);
             }
-            this->roots[i].visit_count += 1;
+            this->nodes.visit_count[i] += 1;
             offset += n_legal_action;
         }
     }
@@ -351,9 +356,10 @@ namespace tree
     {
         /*
         Overview:
-            Clear the roots vector.
+            Free the roots and all their nodes in O(1).
         */
-        this->roots.clear();
+        this->nodes.clear();
+        this->root_num = 0;
     }
 
     std::vector<std::vector<int> > Roots::get_trajectories()
@@ -369,7 +375,7 @@ namespace tree
 
         for (int i = 0; i < this->root_num; ++i)
         {
-            trajs.push_back(this->roots[i].get_trajectory());
+            trajs.push_back(this->nodes.get_trajectory(i));
         }
         return trajs;
     }
@@ -387,7 +393,7 @@ namespace tree
 
         for (int i = 0; i < this->root_num; ++i)
         {
-            distributions.push_back(this->roots[i].get_children_distribution());
+            distributions.push_back(this->nodes.get_children_distribution(i));
         }
         return distributions;
     }
@@ -401,54 +407,56 @@ namespace tree
         std::vector<float> values;
         for (int i = 0; i < this->root_num; ++i)
         {
-            values.push_back(roots[i].value());
+            values.push_back(this->nodes.value(i));
         }
         return values;
     }
 
     //*********************************************************
     //
-    void update_tree_q(Node *root, MinMaxStats &min_max_stats, float discount_factor)
+    void update_tree_q(NodePool &nodes, int root, MinMaxStats &min_max_stats, float discount_factor)
     {
         /*
         Overview:
             Update the q value of the root and its child nodes.
         Arguments:
+            - nodes: the nodes of the tree.
             - root: the root that update q value from.
             - min_max_stats: a tool used to min-max normalize the q value.
             - discount_factor: the discount factor of reward.
         */
-        std::stack<Node *> node_stack;
+        std::stack<int> node_stack;
         node_stack.push(root);
         while (node_stack.size() > 0)
         {
-            Node *node = node_stack.top();
+            int node = node_stack.top();
             node_stack.pop();
 
             if (node != root)
             {
-                float true_reward = node->reward;
+                float true_reward = nodes.reward[node];
                 float qsa;
-                qsa = true_reward + discount_factor * node->value();
+                qsa = true_reward + discount_factor * nodes.value(node);
 
                 min_max_stats.update(qsa);
             }
 
-            for (auto it = node->children.begin(); it != node->children.end(); ++it) {
-                Node *child = &(it->second);
-                if (child->expanded()) {
+            int first = nodes.first_child[node];
+            for (int child = first; child < first + nodes.n_children[node]; ++child) {
+                if (nodes.expanded(child)) {
                     node_stack.push(child);
                 }
             }
         }
     }
 
-    void backpropagate(std::vector<Node *> &search_path, MinMaxStats &min_max_stats, float value, float discount_factor)
+    void backpropagate(NodePool &nodes, std::vector<int> &search_path, MinMaxStats &min_max_stats, float value, float discount_factor)
     {
         /*
         Overview:
             Update the value sum and visit count of nodes along the search path.
         Arguments:
+            - nodes: the nodes of the tree.
             - search_path: a vector of nodes on the search path.
             - min_max_stats: a tool used to min-max normalize the q value.
             - value: the value to propagate along the search path.
@@ -458,13 +466,13 @@ namespace tree
         int path_len = search_path.size();
         for (int i = path_len - 1; i >= 0; --i)
         {
-            Node *node = search_path[i];
-            node->value_sum += bootstrap_value;
-            node->visit_count += 1;
+            int node = search_path[i];
+            nodes.value_sum[node] += bootstrap_value;
+            nodes.visit_count[node] += 1;
 
-            float true_reward = node->reward;
+            float true_reward = nodes.reward[node];
 
-            min_max_stats.update(true_reward + discount_factor * node->value());
+            min_max_stats.update(true_reward + discount_factor * nodes.value(node));
 
             bootstrap_value = true_reward + discount_factor * bootstrap_value;
         }
@@ -474,22 +482,22 @@ namespace tree
         int state_index, const Array &game_over, const Array &rewards, const Array &logits /* 2D array */,
         const Array &all_legal_actions, const Array &n_legal_actions, SearchResults &results)
     {
+        NodePool &nodes = *results.pool;
         int batch_size = results.num;
         int offset = 0;
-        int n_actions = logits.Shape(1);
         for (int i = 0; i < batch_size; ++i)
         {
-            Node *node = results.nodes[i];
+            int node = results.nodes[i];
             int n_legal_action = n_legal_actions[i];
             if (game_over[i]) {
-                node->state_index = state_index;
-                node->batch_index = i;
-                node->reward = rewards[i];
+                nodes.state_index[node] = state_index;
+                nodes.batch_index[node] = i;
+                nodes.reward[node] = rewards[i];
             }
             else {
                 const Array &legal_actions = all_legal_actions.Slice(offset, offset + n_legal_action);
-                node->expand(
-                    state_index, i, rewards[i], logits[i], legal_actions);
+                nodes.expand(
+                    node, state_index, i, rewards[i], logits[i], legal_actions);
             }
             offset += n_legal_action;
         }
@@ -509,92 +517,66 @@ namespace tree
         */
         for (int i = 0; i < results.num; ++i)
         {
-            backpropagate(results.search_paths[i], min_max_stats_lst.stats_lst[i], values[i], discount_factor);
+            backpropagate(*results.pool, results.search_paths[i], min_max_stats_lst.stats_lst[i], values[i], discount_factor);
         }
     }
 
-    int select_child(Node *root, const MinMaxStats &min_max_stats, int pb_c_base, float pb_c_init, float discount_factor, float mean_q)
+    int select_child(const NodePool &nodes, int index, const MinMaxStats &min_max_stats, int pb_c_base, float pb_c_init, float discount_factor, float mean_q)
     {
         /*
         Overview:
-            Select the child node of the roots according to ucb scores.
+            Select the child node of a node according to ucb scores.
         Arguments:
-            - root: the roots to select the child node.
+            - nodes: the nodes of the tree.
+            - index: the node to select the child node of.
             - min_max_stats: a tool used to min-max normalize the score.
             - pb_c_base: constants c2 in muzero.
             - pb_c_init: constants c1 in muzero.
             - disount_factor: the discount factor of reward.
             - mean_q: the mean q value of the parent node.
         Outputs:
-            - action: the action to select.
+            - child: the index of the selected child node.
         */
-        float max_score = FLOAT_MIN;
-        const float epsilon = 0.000001;
-        std::vector<Action> max_index_lst;
-        int action = 0;
-        for (const auto &[a, child] : root->children)
+        const int first = nodes.first_child[index];
+        const int n = nodes.n_children[index];
+
+        UcbParams params;
+        float total_children_visit_counts = nodes.visit_count[index];
+        params.pb_c = log((total_children_visit_counts + pb_c_base + 1) / pb_c_base) + pb_c_init;
+        params.sqrt_visits = sqrt(total_children_visit_counts);
+        params.mean_q = mean_q;
+        params.discount_factor = discount_factor;
+
+        // min-max normalization, see MinMaxStats::normalize
+        params.q_min = 0.0;
+        params.q_delta = 1.0;
+        float delta = min_max_stats.maximum - min_max_stats.minimum;
+        if (delta > 0)
         {
-            action = a;
+            params.q_min = min_max_stats.minimum;
+            params.q_delta = delta < min_max_stats.value_delta_max ? min_max_stats.value_delta_max : delta;
+        }
 
-            float temp_score = ucb_score(child, min_max_stats, mean_q, root->visit_count, pb_c_base, pb_c_init, discount_factor);
-            if (max_score < temp_score)
-            {
-                max_score = temp_score;
+        thread_local std::vector<float> scores;
+        thread_local std::vector<int> max_index_lst;
+        scores.resize((n + kScorePadding - 1) / kScorePadding * kScorePadding);
+        max_index_lst.resize(n);
 
-                max_index_lst.clear();
-                max_index_lst.push_back(a);
-            }
-            else if (temp_score >= max_score - epsilon)
-            {
-                max_index_lst.push_back(a);
-            }
-        }
+        const Kernels &k = kernels();
+        k.ucb(
+            params, &nodes.visit_count[first], &nodes.prior[first], &nodes.value_sum[first],
+            &nodes.reward[first], n, scores.data());
+        const float epsilon = 0.000001;
+        int n_max = k.argmax(scores.data(), n, epsilon, max_index_lst.data());
 
-        if (max_index_lst.size() > 0)
+        int child = n - 1;
+        if (n_max > 0)
         {
-            std::uniform_int_distribution<int> dist(0, max_index_lst.size() - 1);
+            std::uniform_int_distribution<int> dist(0, n_max - 1);
             int rand_index = dist(rng_);
-            action = max_index_lst[rand_index];
+            child = max_index_lst[rand_index];
         }
-        return action;
-    }
-
-    float ucb_score(const Node &child, const MinMaxStats &min_max_stats, float parent_mean_q, float total_children_visit_counts, float pb_c_base, float pb_c_init, float discount_factor)
-    {
-        /*
-        Overview:
-            Compute the ucb score of the child.
-        Arguments:
-            - child: the child node to compute ucb score.
-            - min_max_stats: a tool used to min-max normalize the score.
-            - mean_q: the mean q value of the parent node.
-            - total_children_visit_counts: the total visit counts of the child nodes of the parent node.
-            - pb_c_base: constants c2 in muzero.
-            - pb_c_init: constants c1 in muzero.
-            - disount_factor: the discount factor of reward.
-        Outputs:
-            - ucb_value: the ucb score of the child.
-        */
-        float pb_c = 0.0, prior_score = 0.0, value_score = 0.0;
-        pb_c = log((total_children_visit_counts + pb_c_base + 1) / pb_c_base) + pb_c_init;
-        pb_c *= (sqrt(total_children_visit_counts) / (child.visit_count + 1));
-
-        prior_score = pb_c * child.prior;
-        if (child.visit_count == 0) {
-            value_score = parent_mean_q;
-        }
-        else {
-            value_score = child.reward + discount_factor * child.value();
-        }
-
-        value_score = min_max_stats.normalize(value_score);
-
-        if (value_score < 0)
-            value_score = 0;
-        if (value_score > 1)
-            value_score = 1;
-        float ucb_value = prior_score + value_score;
-        return ucb_value;
+        return first + child;
     }
 
     void batch_traverse(Roots &roots, int pb_c_base, float pb_c_init, float discount_factor, MinMaxStatsList &min_max_stats_lst, SearchResults &results)
@@ -610,37 +592,40 @@ namespace tree
             - min_max_stats: a tool used to min-max normalize the score.
             - results: the search results.
         */
+        NodePool &nodes = roots.nodes;
         int last_action = -1;
         float parent_q = 0.0;
         results.search_lens = std::vector<int>();
+        results.pool = &nodes;
 
         for (int i = 0; i < results.num; ++i)
         {
-            Node *node = &(roots.roots[i]);
+            int node = i;
             int is_root = 1;
             int search_len = 0;
             results.search_paths[i].push_back(node);
 
-            while (node->expanded())
+            while (nodes.expanded(node))
             {
-                float mean_q = node->compute_mean_q(is_root, parent_q, discount_factor);
+                float mean_q = nodes.compute_mean_q(node, is_root, parent_q, discount_factor);
                 is_root = 0;
                 parent_q = mean_q;
 
-                int action = select_child(node, min_max_stats_lst.stats_lst[i], pb_c_base, pb_c_init, discount_factor, mean_q);
+                int child = select_child(nodes, node, min_max_stats_lst.stats_lst[i], pb_c_base, pb_c_init, discount_factor, mean_q);
+                int action = nodes.action[child];
 
-                node->best_action = action;
+                nodes.best_action[node] = action;
                 // next
-                node = node->get_child(action);
+                node = child;
                 last_action = action;
                 results.search_paths[i].push_back(node);
                 search_len += 1;
             }
 
-            Node *parent = results.search_paths[i][results.search_paths[i].size() - 2];
+            int parent = results.search_paths[i][results.search_paths[i].size() - 2];
 
-            results.state_index_in_search_path.push_back(parent->state_index);
-            results.state_index_in_batch.push_back(parent->batch_index);
+            results.state_index_in_search_path.push_back(nodes.state_index[parent]);
+            results.state_index_in_batch.push_back(nodes.batch_index[parent]);
 
             results.last_actions.push_back(last_action);
             results.search_lens.push_back(search_len);
@@ -648,4 +633,4 @@ namespace tree
         }
     }
 
-}
\ No newline at end of file
+}
@@ -10,7 +10,6 @@
 #include <random>
 #include <sys/timeb.h>
 #include <ctime>
-#include <map>
 
 #include "mcts/core/minimax.h"
 #include "mcts/core/array.h"
@@ -23,32 +22,39 @@ namespace tree {
 
     using Action = int;
 
-    class Node {
+    // Struct-of-arrays storage of the nodes of a search, addressed by index.
+    // The children of a node are a contiguous block ordered by action, so the
+    // statistics of all children are adjacent in each array.
+    class NodePool {
         public:
-            int visit_count, state_index, batch_index, best_action;
-            float reward, prior, value_sum;
-            std::map<Action, Node> children;
+            int size;
+            std::vector<Action> action;
+            std::vector<int> visit_count, state_index, batch_index, best_action, first_child, n_children;
+            std::vector<float> reward, prior, value_sum;
 
-            Node();
-            Node(float prior);
-            ~Node();
+            NodePool();
+            ~NodePool();
+
+            int allocate(int n);
+            void clear();
 
             void expand(
-                int state_index, int batch_index, float reward, const Array &logits, const Array &legal_actions);
-            void add_exploration_noise(float exploration_fraction, float dirichlet_alpha);
-            float compute_mean_q(int isRoot, float parent_q, float discount_factor);
-
-            int expanded() const;
-            float value() const;
-            std::vector<int> get_trajectory();
-            std::vector<int> get_children_distribution();
-            Node* get_child(int action);
+                int index, int state_index, int batch_index, float reward, const Array &logits, const Array &legal_actions);
+            void add_exploration_noise(int index, float exploration_fraction, float dirichlet_alpha);
+            float compute_mean_q(int index, int isRoot, float parent_q, float discount_factor) const;
+
+            int expanded(int index) const;
+            float value(int index) const;
+            std::vector<int> get_trajectory(int index) const;
+            std::vector<int> get_children_distribution(int index) const;
+            int get_child(int index, int action) const;
     };
 
     class Roots{
         public:
             int root_num;
-            std::vector<Node> roots;
+            // the roots are the first root_num nodes
+            NodePool nodes;
 
             Roots();
             Roots(int root_num);
@@ -69,8 +75,10 @@ namespace tree {
         public:
             int num;
             std::vector<int> state_index_in_search_path, state_index_in_batch, last_actions, search_lens;
-            std::vector<Node*> nodes;
-            std::vector<std::vector<Node*> > search_paths;
+            std::vector<int> nodes;
+            std::vector<std::vector<int> > search_paths;
+            // the nodes of the roots traversed by batch_traverse
+            NodePool *pool;
 
             SearchResults();
             SearchResults(int num);
@@ -79,15 +87,14 @@ namespace tree {
     };
 
 
-    void update_tree_q(Node* root, MinMaxStats &min_max_stats, float discount_factor);
-    void backpropagate(std::vector<Node*> &search_path, MinMaxStats &min_max_stats, float value, float discount_factor);
+    void update_tree_q(NodePool &nodes, int root, MinMaxStats &min_max_stats, float discount_factor);
+    void backpropagate(NodePool &nodes, std::vector<int> &search_path, MinMaxStats &min_max_stats, float value, float discount_factor);
     void batch_expand(
         int state_index, const Array &game_over, const Array &rewards, const Array &logits /* 2D array */,
         const Array &all_legal_actions, const Array &n_legal_actions, SearchResults &results);
     void batch_backpropagate(float discount_factor, const Array &values, MinMaxStatsList &min_max_stats_lst, SearchResults &results);
-    int select_child(Node* root, const MinMaxStats &min_max_stats, int pb_c_base, float pb_c_init, float discount_factor, float mean_q);
-    float ucb_score(const Node &child, const MinMaxStats &min_max_stats, float parent_mean_q, float total_children_visit_counts, float pb_c_base, float pb_c_init, float discount_factor);
+    int select_child(const NodePool &nodes, int index, const MinMaxStats &min_max_stats, int pb_c_base, float pb_c_init, float discount_factor, float mean_q);
     void batch_traverse(Roots &roots, int pb_c_base, float pb_c_init, float discount_factor, MinMaxStatsList &min_max_stats_lst, SearchResults &results);
 }
 
-#endif  // AZ_CNODE_H
\ No newline at end of file
+#endif  // AZ_CNODE_H
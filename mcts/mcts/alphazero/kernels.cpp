@@ -0,0 +1,555 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <random>
+
+#include "mcts/core/minimax.h"
+#include "mcts/alphazero/kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define AZ_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+
+namespace tree
+{
+
+    //*********************************************************
+    // scalar
+
+    static void softmax_scalar(const float *logits, const int *actions, int n, float *out)
+    {
+        float policy_max = FLOAT_MIN;
+        for (int i = 0; i < n; ++i)
+        {
+            float logit = logits[actions[i]];
+            if (policy_max < logit)
+            {
+                policy_max = logit;
+            }
+        }
+
+        float policy_sum = 0.0;
+        for (int i = 0; i < n; ++i)
+        {
+            out[i] = std::exp(logits[actions[i]] - policy_max);
+            policy_sum += out[i];
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            out[i] /= policy_sum;
+        }
+    }
+
+    static void ucb_scalar(
+        const UcbParams &params, const int *visit_count, const float *prior,
+        const float *value_sum, const float *reward, int n, float *out)
+    {
+        for (int c = 0; c < n; ++c)
+        {
+            float visits = visit_count[c];
+            float q = reward[c] + params.discount_factor * (value_sum[c] / std::max(visits, 1.0f));
+            q = visit_count[c] == 0 ? params.mean_q : q;
+            q = (q - params.q_min) / params.q_delta;
+            q = std::min(std::max(q, 0.0f), 1.0f);
+            out[c] = params.pb_c * (params.sqrt_visits / (visits + 1)) * prior[c] + q;
+        }
+    }
+
+    static int argmax_scalar(const float *scores, int n, float epsilon, int *ties)
+    {
+        float max_score = FLOAT_MIN;
+        int n_ties = 0;
+        for (int c = 0; c < n; ++c)
+        {
+            if (max_score < scores[c])
+            {
+                max_score = scores[c];
+                ties[0] = c;
+                n_ties = 1;
+            }
+            else if (scores[c] >= max_score - epsilon)
+            {
+                ties[n_ties++] = c;
+            }
+        }
+        return n_ties;
+    }
+
+#ifdef AZ_KERNELS_X86
+
+    //*********************************************************
+    // AVX2, 8 lanes
+
+    // exp by range reduction to [-ln2/2, ln2/2] and the polynomial of cephes expf
+    __attribute__((target("avx2"))) static inline __m256 exp_avx2(__m256 x)
+    {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+        __m256 n = _mm256_round_ps(
+            _mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(n, _mm256_set1_ps(0.693359375f)));
+        r = _mm256_sub_ps(r, _mm256_mul_ps(n, _mm256_set1_ps(-2.12194440e-4f)));
+        __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.3981999507e-3f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(8.3334519073e-3f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(4.1665795894e-2f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(1.6666665459e-1f));
+        p = _mm256_add_ps(_mm256_mul_ps(p, r), _mm256_set1_ps(5.0000001201e-1f));
+        p = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(p, r), r), r), _mm256_set1_ps(1.0f));
+        __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+        return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+    }
+
+    __attribute__((target("avx2"))) static inline float hmax_avx2(__m256 v)
+    {
+        __m128 x = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        x = _mm_max_ps(x, _mm_movehl_ps(x, x));
+        x = _mm_max_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+
+    __attribute__((target("avx2"))) static inline float hsum_avx2(__m256 v)
+    {
+        __m128 x = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+        x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+        return _mm_cvtss_f32(x);
+    }
+
+    // lanes i < remaining
+    __attribute__((target("avx2"))) static inline __m256i tail_mask_avx2(int remaining)
+    {
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(remaining), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    // Full vectors are loaded unmasked, a masked load stalls on any recent
+    // store to its whole width
+    __attribute__((target("avx2"))) static inline __m256 load_avx2(const float *p, int remaining, __m256i mask)
+    {
+        return remaining >= 8 ? _mm256_loadu_ps(p) : _mm256_maskload_ps(p, mask);
+    }
+
+    __attribute__((target("avx2"))) static inline __m256i load_epi32_avx2(const int *p, int remaining, __m256i mask)
+    {
+        return remaining >= 8 ? _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)) : _mm256_maskload_epi32(p, mask);
+    }
+
+    // The full vectors go through out, the tail stays in a register.
+    __attribute__((target("avx2"))) static void softmax_avx2(const float *logits, const int *actions, int n, float *out)
+    {
+        const __m256 lowest = _mm256_set1_ps(FLOAT_MIN);
+        const int full = n & ~7;
+        const __m256i mask = tail_mask_avx2(n - full);
+
+        __m256 vmax = lowest;
+        for (int i = 0; i < full; i += 8)
+        {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(actions + i));
+            __m256 x = _mm256_i32gather_ps(logits, idx, 4);
+            vmax = _mm256_max_ps(x, vmax);
+            _mm256_storeu_ps(out + i, x);
+        }
+        __m256 tail = lowest;
+        if (full < n)
+        {
+            __m256i idx = _mm256_maskload_epi32(actions + full, mask);
+            tail = _mm256_mask_i32gather_ps(lowest, logits, idx, _mm256_castsi256_ps(mask), 4);
+            vmax = _mm256_max_ps(tail, vmax);
+        }
+        __m256 policy_max = _mm256_set1_ps(hmax_avx2(vmax));
+
+        __m256 vsum = _mm256_setzero_ps();
+        for (int i = 0; i < full; i += 8)
+        {
+            __m256 e = exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(out + i), policy_max));
+            vsum = _mm256_add_ps(vsum, e);
+            _mm256_storeu_ps(out + i, e);
+        }
+        tail = _mm256_and_ps(exp_avx2(_mm256_sub_ps(tail, policy_max)), _mm256_castsi256_ps(mask));
+        vsum = _mm256_add_ps(vsum, tail);
+        __m256 policy_sum = _mm256_set1_ps(hsum_avx2(vsum));
+
+        for (int i = 0; i < full; i += 8)
+        {
+            _mm256_storeu_ps(out + i, _mm256_div_ps(_mm256_loadu_ps(out + i), policy_sum));
+        }
+        if (full < n)
+        {
+            _mm256_maskstore_ps(out + full, mask, _mm256_div_ps(tail, policy_sum));
+        }
+    }
+
+    __attribute__((target("avx2"))) static void ucb_avx2(
+        const UcbParams &params, const int *visit_count, const float *prior,
+        const float *value_sum, const float *reward, int n, float *out)
+    {
+        const __m256 lowest = _mm256_set1_ps(FLOAT_MIN);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 pb_c = _mm256_set1_ps(params.pb_c);
+        const __m256 sqrt_visits = _mm256_set1_ps(params.sqrt_visits);
+        const __m256 mean_q = _mm256_set1_ps(params.mean_q);
+        const __m256 discount_factor = _mm256_set1_ps(params.discount_factor);
+        const __m256 q_min = _mm256_set1_ps(params.q_min);
+        const __m256 q_delta = _mm256_set1_ps(params.q_delta);
+        for (int i = 0; i < n; i += 8)
+        {
+            __m256i mask = tail_mask_avx2(n - i);
+            __m256 visits = _mm256_cvtepi32_ps(load_epi32_avx2(visit_count + i, n - i, mask));
+            __m256 q = _mm256_add_ps(
+                load_avx2(reward + i, n - i, mask),
+                _mm256_mul_ps(discount_factor, _mm256_div_ps(load_avx2(value_sum + i, n - i, mask), _mm256_max_ps(visits, one))));
+            q = _mm256_blendv_ps(q, mean_q, _mm256_cmp_ps(visits, zero, _CMP_EQ_OQ));
+            q = _mm256_div_ps(_mm256_sub_ps(q, q_min), q_delta);
+            q = _mm256_min_ps(_mm256_max_ps(q, zero), one);
+            __m256 prior_score = _mm256_mul_ps(
+                _mm256_mul_ps(pb_c, _mm256_div_ps(sqrt_visits, _mm256_add_ps(visits, one))),
+                load_avx2(prior + i, n - i, mask));
+            __m256 score = _mm256_blendv_ps(lowest, _mm256_add_ps(prior_score, q), _mm256_castsi256_ps(mask));
+            _mm256_storeu_ps(out + i, score);
+        }
+    }
+
+    // The running argmax resets at the first occurrence of the maximum, so
+    // the ties are that index and the later ones within epsilon of it.
+    __attribute__((target("avx2"))) static int argmax_avx2(const float *scores, int n, float epsilon, int *ties)
+    {
+        const __m256 lowest = _mm256_set1_ps(FLOAT_MIN);
+        __m256 vmax = lowest;
+        for (int i = 0; i < n; i += 8)
+        {
+            __m256i mask = tail_mask_avx2(n - i);
+            __m256 x = _mm256_blendv_ps(lowest, _mm256_loadu_ps(scores + i), _mm256_castsi256_ps(mask));
+            // NaN scores are skipped
+            vmax = _mm256_max_ps(x, vmax);
+        }
+        float max_score = hmax_avx2(vmax);
+        if (!(max_score > FLOAT_MIN))
+        {
+            return 0;
+        }
+
+        const __m256 best = _mm256_set1_ps(max_score);
+        const __m256 threshold = _mm256_set1_ps(max_score - epsilon);
+        int n_ties = 0;
+        bool found = false;
+        for (int i = 0; i < n; i += 8)
+        {
+            int lanes = n - i >= 8 ? 0xff : (1 << (n - i)) - 1;
+            __m256 x = _mm256_loadu_ps(scores + i);
+            int near = _mm256_movemask_ps(_mm256_cmp_ps(x, threshold, _CMP_GE_OQ)) & lanes;
+            if (!found)
+            {
+                int equal = _mm256_movemask_ps(_mm256_cmp_ps(x, best, _CMP_EQ_OQ)) & lanes;
+                if (equal == 0)
+                {
+                    continue;
+                }
+                found = true;
+                near &= ~((1 << __builtin_ctz(equal)) - 1);
+            }
+            while (near != 0)
+            {
+                ties[n_ties++] = i + __builtin_ctz(near);
+                near &= near - 1;
+            }
+        }
+        return n_ties;
+    }
+
+    //*********************************************************
+    // AVX-512, 16 lanes
+
+    __attribute__((target("avx512f"))) static inline __m512 exp_avx512(__m512 x)
+    {
+        x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.3f)), _mm512_set1_ps(88.3f));
+        __m512 n = _mm512_roundscale_ps(
+            _mm512_mul_ps(x, _mm512_set1_ps(1.44269504088896341f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_sub_ps(x, _mm512_mul_ps(n, _mm512_set1_ps(0.693359375f)));
+        r = _mm512_sub_ps(r, _mm512_mul_ps(n, _mm512_set1_ps(-2.12194440e-4f)));
+        __m512 p = _mm512_set1_ps(1.9875691500e-4f);
+        p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(1.3981999507e-3f));
+        p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(8.3334519073e-3f));
+        p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(4.1665795894e-2f));
+        p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(1.6666665459e-1f));
+        p = _mm512_add_ps(_mm512_mul_ps(p, r), _mm512_set1_ps(5.0000001201e-1f));
+        p = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_mul_ps(p, r), r), r), _mm512_set1_ps(1.0f));
+        return _mm512_scalef_ps(p, n);
+    }
+
+    __attribute__((target("avx512f"))) static inline __mmask16 tail_mask_avx512(int remaining)
+    {
+        return remaining >= 16 ? __mmask16(0xffff) : __mmask16((1u << remaining) - 1);
+    }
+
+    __attribute__((target("avx512f"))) static inline __m512 load_avx512(const float *p, int remaining, __mmask16 mask)
+    {
+        return remaining >= 16 ? _mm512_loadu_ps(p) : _mm512_maskz_loadu_ps(mask, p);
+    }
+
+    __attribute__((target("avx512f"))) static inline __m512i load_epi32_avx512(const int *p, int remaining, __mmask16 mask)
+    {
+        return remaining >= 16 ? _mm512_loadu_si512(p) : _mm512_maskz_loadu_epi32(mask, p);
+    }
+
+    __attribute__((target("avx512f"))) static void softmax_avx512(const float *logits, const int *actions, int n, float *out)
+    {
+        const __m512 lowest = _mm512_set1_ps(FLOAT_MIN);
+        const int full = n & ~15;
+        const __mmask16 mask = tail_mask_avx512(n - full);
+
+        __m512 vmax = lowest;
+        for (int i = 0; i < full; i += 16)
+        {
+            __m512 x = _mm512_i32gather_ps(_mm512_loadu_si512(actions + i), logits, 4);
+            vmax = _mm512_max_ps(x, vmax);
+            _mm512_storeu_ps(out + i, x);
+        }
+        __m512 tail = lowest;
+        if (full < n)
+        {
+            __m512i idx = _mm512_maskz_loadu_epi32(mask, actions + full);
+            tail = _mm512_mask_i32gather_ps(lowest, mask, idx, logits, 4);
+            vmax = _mm512_max_ps(tail, vmax);
+        }
+        __m512 policy_max = _mm512_set1_ps(_mm512_reduce_max_ps(vmax));
+
+        __m512 vsum = _mm512_setzero_ps();
+        for (int i = 0; i < full; i += 16)
+        {
+            __m512 e = exp_avx512(_mm512_sub_ps(_mm512_loadu_ps(out + i), policy_max));
+            vsum = _mm512_add_ps(vsum, e);
+            _mm512_storeu_ps(out + i, e);
+        }
+        tail = _mm512_maskz_mov_ps(mask, exp_avx512(_mm512_sub_ps(tail, policy_max)));
+        vsum = _mm512_add_ps(vsum, tail);
+        __m512 policy_sum = _mm512_set1_ps(_mm512_reduce_add_ps(vsum));
+
+        for (int i = 0; i < full; i += 16)
+        {
+            _mm512_storeu_ps(out + i, _mm512_div_ps(_mm512_loadu_ps(out + i), policy_sum));
+        }
+        if (full < n)
+        {
+            _mm512_mask_storeu_ps(out + full, mask, _mm512_div_ps(tail, policy_sum));
+        }
+    }
+
+    __attribute__((target("avx512f"))) static void ucb_avx512(
+        const UcbParams &params, const int *visit_count, const float *prior,
+        const float *value_sum, const float *reward, int n, float *out)
+    {
+        const __m512 lowest = _mm512_set1_ps(FLOAT_MIN);
+        const __m512 zero = _mm512_setzero_ps();
+        const __m512 one = _mm512_set1_ps(1.0f);
+        const __m512 pb_c = _mm512_set1_ps(params.pb_c);
+        const __m512 sqrt_visits = _mm512_set1_ps(params.sqrt_visits);
+        const __m512 mean_q = _mm512_set1_ps(params.mean_q);
+        const __m512 discount_factor = _mm512_set1_ps(params.discount_factor);
+        const __m512 q_min = _mm512_set1_ps(params.q_min);
+        const __m512 q_delta = _mm512_set1_ps(params.q_delta);
+        for (int i = 0; i < n; i += 16)
+        {
+            __mmask16 mask = tail_mask_avx512(n - i);
+            __m512 visits = _mm512_cvtepi32_ps(load_epi32_avx512(visit_count + i, n - i, mask));
+            __m512 q = _mm512_add_ps(
+                load_avx512(reward + i, n - i, mask),
+                _mm512_mul_ps(discount_factor, _mm512_div_ps(load_avx512(value_sum + i, n - i, mask), _mm512_max_ps(visits, one))));
+            q = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(visits, zero, _CMP_EQ_OQ), q, mean_q);
+            q = _mm512_div_ps(_mm512_sub_ps(q, q_min), q_delta);
+            q = _mm512_min_ps(_mm512_max_ps(q, zero), one);
+            __m512 prior_score = _mm512_mul_ps(
+                _mm512_mul_ps(pb_c, _mm512_div_ps(sqrt_visits, _mm512_add_ps(visits, one))),
+                load_avx512(prior + i, n - i, mask));
+            _mm512_storeu_ps(out + i, _mm512_mask_blend_ps(mask, lowest, _mm512_add_ps(prior_score, q)));
+        }
+    }
+
+    __attribute__((target("avx512f"))) static int argmax_avx512(const float *scores, int n, float epsilon, int *ties)
+    {
+        const __m512 lowest = _mm512_set1_ps(FLOAT_MIN);
+        __m512 vmax = lowest;
+        for (int i = 0; i < n; i += 16)
+        {
+            __mmask16 mask = tail_mask_avx512(n - i);
+            vmax = _mm512_max_ps(_mm512_mask_mov_ps(lowest, mask, _mm512_loadu_ps(scores + i)), vmax);
+        }
+        float max_score = _mm512_reduce_max_ps(vmax);
+        if (!(max_score > FLOAT_MIN))
+        {
+            return 0;
+        }
+
+        const __m512 best = _mm512_set1_ps(max_score);
+        const __m512 threshold = _mm512_set1_ps(max_score - epsilon);
+        int n_ties = 0;
+        bool found = false;
+        for (int i = 0; i < n; i += 16)
+        {
+            __mmask16 mask = tail_mask_avx512(n - i);
+            __m512 x = _mm512_loadu_ps(scores + i);
+            unsigned near = _mm512_mask_cmp_ps_mask(mask, x, threshold, _CMP_GE_OQ);
+            if (!found)
+            {
+                unsigned equal = _mm512_mask_cmp_ps_mask(mask, x, best, _CMP_EQ_OQ);
+                if (equal == 0)
+                {
+                    continue;
+                }
+                found = true;
+                near &= ~((1u << __builtin_ctz(equal)) - 1);
+            }
+            while (near != 0)
+            {
+                ties[n_ties++] = i + __builtin_ctz(near);
+                near &= near - 1;
+            }
+        }
+        return n_ties;
+    }
+
+#endif  // AZ_KERNELS_X86
+
+    //*********************************************************
+
+    static const Kernels scalar_kernels = {"scalar", softmax_scalar, ucb_scalar, argmax_scalar};
+#ifdef AZ_KERNELS_X86
+    static const Kernels avx2_kernels = {"avx2", softmax_avx2, ucb_avx2, argmax_avx2};
+    static const Kernels avx512_kernels = {"avx512", softmax_avx512, ucb_avx512, argmax_avx512};
+#endif
+
+    std::vector<const Kernels *> supported_kernels()
+    {
+        /*
+        Overview:
+            Return the kernels supported by the cpu, from the narrowest to the widest.
+        */
+        std::vector<const Kernels *> ret = {&scalar_kernels};
+#ifdef AZ_KERNELS_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            ret.push_back(&avx2_kernels);
+        }
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            ret.push_back(&avx512_kernels);
+        }
+#endif
+        return ret;
+    }
+
+    // set_kernels may be called while searches on other threads read it
+    static std::atomic<const Kernels *> current_kernels{supported_kernels().back()};
+
+    const Kernels &kernels()
+    {
+        return *current_kernels.load(std::memory_order_acquire);
+    }
+
+    bool set_kernels(const std::string &name)
+    {
+        /*
+        Overview:
+            Use the kernels of an instruction set, e.g. to compare the search results of them.
+        Arguments:
+            - name: "scalar", "avx2" or "avx512".
+        Outputs:
+            - supported: whether the kernels are supported by the cpu, the current ones are kept if not.
+        */
+        for (const Kernels *k : supported_kernels())
+        {
+            if (name == k->name)
+            {
+                current_kernels.store(k, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<KernelTiming> benchmark_kernels(int n_children, int iters)
+    {
+        /*
+        Overview:
+            Time each supported kernel on random children.
+        Arguments:
+            - n_children: the number of children of the node.
+            - iters: the number of calls of each kernel.
+        Outputs:
+            - timings: the average nanoseconds per call of each kernel, by instruction set.
+        */
+        std::mt19937 gen(0);
+        std::uniform_real_distribution<float> uniform(-1, 1);
+        int n_actions = n_children * 2;
+        std::vector<float> logits(n_actions);
+        for (auto &x : logits)
+        {
+            x = uniform(gen);
+        }
+        std::vector<int> actions(n_actions);
+        for (int i = 0; i < n_actions; ++i)
+        {
+            actions[i] = i;
+        }
+        std::shuffle(actions.begin(), actions.end(), gen);
+        actions.resize(n_children);
+        std::sort(actions.begin(), actions.end());
+
+        // the children are in the middle of the node arrays like in the tree,
+        // a masked load stalls on recent stores after the children
+        int padded = (n_children + kScorePadding - 1) / kScorePadding * kScorePadding;
+        std::vector<int> visit_count(padded);
+        std::vector<float> prior(padded), value_sum(padded), reward(padded);
+        for (int c = 0; c < n_children; ++c)
+        {
+            visit_count[c] = gen() % 4;
+            value_sum[c] = uniform(gen) * visit_count[c];
+            reward[c] = 0;
+        }
+        softmax_scalar(logits.data(), actions.data(), n_children, prior.data());
+        UcbParams params = {1.25f, 8.0f, 0.1f, 0.99f, -1.0f, 2.0f};
+
+        std::vector<float> out(padded);
+        std::vector<int> ties(n_children);
+        volatile float sink = 0;
+        // nanoseconds per call, after warming up e.g. the clock of wide vectors
+        auto time = [iters](auto &&call) {
+            for (int i = 0; i < iters / 10; ++i)
+            {
+                call(i);
+            }
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iters; ++i)
+            {
+                call(i);
+            }
+            return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iters;
+        };
+
+        std::vector<KernelTiming> timings;
+        for (const Kernels *k : supported_kernels())
+        {
+            KernelTiming timing;
+            timing.name = k->name;
+            timing.softmax_ns = time([&](int i) {
+                k->softmax(logits.data(), actions.data(), n_children, out.data());
+                sink = sink + out[i % n_children];
+            });
+            timing.ucb_ns = time([&](int i) {
+                params.mean_q = i * 1e-6f;
+                k->ucb(params, visit_count.data(), prior.data(), value_sum.data(), reward.data(), n_children, out.data());
+                sink = sink + out[i % n_children];
+            });
+            timing.argmax_ns = time([&](int) {
+                sink = sink + k->argmax(out.data(), n_children, 0.000001, ties.data());
+            });
+            timings.push_back(timing);
+        }
+        return timings;
+    }
+
+}
@@ -0,0 +1,61 @@
+#ifndef AZ_KERNELS_H
+#define AZ_KERNELS_H
+
+#include <string>
+#include <vector>
+
+namespace tree {
+
+    // Parameters of the ucb scores of the children of one node.
+    struct UcbParams {
+        // the prior of a child is weighted by pb_c * sqrt_visits / (child visits + 1)
+        float pb_c, sqrt_visits;
+        float mean_q;
+        float discount_factor;
+        // min-max normalization as (q - q_min) / q_delta
+        float q_min, q_delta;
+    };
+
+    // Arrays of scores are read and written in whole vectors, so they are
+    // padded to a multiple of this many floats.
+    const int kScorePadding = 16;
+
+    // The vectorized inner loops of the tree over the contiguous child
+    // arrays of a node. Implementations for wider instruction sets may differ
+    // from the scalar ones in the last bits of the results.
+    struct Kernels {
+        const char *name;
+
+        // softmax of logits[actions[i]] for i < n into out
+        void (*softmax)(const float *logits, const int *actions, int n, float *out);
+
+        // ucb scores of n children into the padded out
+        void (*ucb)(
+            const UcbParams &params, const int *visit_count, const float *prior,
+            const float *value_sum, const float *reward, int n, float *out);
+
+        // Indices of the highest of n padded scores and of the following ones within
+        // epsilon of it into ties, like a running argmax that keeps near ties
+        // with the current maximum. Returns the number of ties.
+        int (*argmax)(const float *scores, int n, float epsilon, int *ties);
+    };
+
+    // The kernels used by the tree, the widest supported by the cpu unless set_kernels was called.
+    const Kernels &kernels();
+
+    // Use the kernels of an instruction set ("scalar", "avx2" or "avx512"), returns false if it is not supported.
+    bool set_kernels(const std::string &name);
+
+    // All kernels supported by the cpu, scalar first.
+    std::vector<const Kernels *> supported_kernels();
+
+    struct KernelTiming {
+        std::string name;
+        double softmax_ns, ucb_ns, argmax_ns;
+    };
+
+    // Average time of each kernel over iters calls on n_children children.
+    std::vector<KernelTiming> benchmark_kernels(int n_children, int iters);
+}
+
+#endif  // AZ_KERNELS_H
@@ -8,6 +8,7 @@
 #include "mcts/core/array.h"
 
 #include "mcts/alphazero/cnode.h"
+#include "mcts/alphazero/kernels.h"
 
 namespace py = pybind11;
 
@@ -67,4 +68,15 @@ PYBIND11_MODULE(alphazero_mcts, m) {
     });
 
     m.def("init_module", &tree::init_module, "", "seed"_a);
+
+    m.def("kernel_isa", []() { return std::string(tree::kernels().name); });
+    m.def("set_kernel_isa", &tree::set_kernels, "", "name"_a);
+    m.def("benchmark_kernels", [](int n_children, int iters) {
+        py::dict ret;
+        for (const auto &t : tree::benchmark_kernels(n_children, iters)) {
+            ret[py::str(t.name)] = py::dict(
+                "softmax_ns"_a = t.softmax_ns, "ucb_ns"_a = t.ucb_ns, "argmax_ns"_a = t.argmax_ns);
+        }
+        return ret;
+    }, "", "n_children"_a = 32, "iters"_a = 100000);
 }
\ No newline at end of file
@@ -0,0 +1,126 @@
+import time
+from dataclasses import dataclass
+
+import numpy as np
+import tyro
+
+import ygoenv
+from ygoai.utils import init_ygopro
+
+
+@dataclass
+class Args:
+    seed: int = 1
+    """the random seed"""
+
+    env_id: str = "YGOPro-v1"
+    """the id of the environment"""
+    deck: str = "../assets/deck"
+    """the deck file to use"""
+    code_list_file: str = "code_list.txt"
+    """the code list file for card embeddings"""
+    lang: str = "english"
+    """the language to use"""
+    max_options: int = 24
+    """the maximum number of options"""
+
+    num_envs: int = 128
+    """the number of parallel game environments"""
+    batch_size: int = 64
+    """the batch size of `recv`, smaller than `num_envs` for async stepping"""
+    num_threads: int = 16
+    """the number of threads to use for envpool"""
+    thread_affinity_offset: int = 0
+    """the first cpu to pin the envpool threads to, -1 for no pinning"""
+    modes: str = "shared,affinity"
+    """the modes to compare: `shared` or `affinity` scheduling, or `xla` for a jitted `lax.scan` rollout"""
+
+    warmup_steps: int = 1000
+    """the number of batches to run before timing"""
+    num_steps: int = 10000
+    """the number of batches to time"""
+
+
+def make_envs(args, deck, env_affinity):
+    return ygoenv.make(
+        task_id=args.env_id,
+        env_type="gymnasium",
+        num_envs=args.num_envs,
+        batch_size=args.batch_size,
+        num_threads=args.num_threads,
+        thread_affinity_offset=args.thread_affinity_offset,
+        env_affinity=env_affinity,
+        seed=args.seed,
+        deck1=deck,
+        deck2=deck,
+        player=-1,
+        max_options=args.max_options,
+        play_mode='self',
+        async_reset=True,
+    )
+
+
+def run(args, deck, env_affinity):
+    envs = make_envs(args, deck, env_affinity)
+    rng = np.random.default_rng(args.seed)
+    envs.async_reset()
+    n_steps = 0
+    for i in range(args.warmup_steps + args.num_steps):
+        if i == args.warmup_steps:
+            start = time.time()
+            n_steps = 0
+        obs, rewards, dones, truncs, info = envs.recv()
+        env_id = info['env_id']
+        actions = rng.integers(0, np.maximum(info['num_options'], 1))
+        envs.send(actions, env_id)
+        n_steps += len(env_id)
+    elapsed = time.time() - start
+    del envs
+    return n_steps / elapsed
+
+
+def run_xla(args, deck):
+    import jax
+    import jax.numpy as jnp
+
+    envs = make_envs(args, deck, env_affinity=False)
+    handle, recv, send, step = envs.xla()
+
+    def body(carry, _):
+        handle, key = carry
+        handle, (obs, rewards, dones, truncs, info) = recv(handle)
+        key, subkey = jax.random.split(key)
+        actions = jax.random.randint(
+            subkey, info['num_options'].shape, 0, jnp.maximum(info['num_options'], 1))
+        handle = send(handle, actions, info['env_id'])
+        return (handle, key), None
+
+    def rollout(handle, key, length):
+        return jax.lax.scan(body, (handle, key), None, length=length)[0]
+
+    rollout = jax.jit(rollout, static_argnums=2)
+    envs.async_reset()
+    carry = (handle, jax.random.PRNGKey(args.seed))
+    carry = rollout(*carry, args.warmup_steps)
+    jax.block_until_ready(carry)
+    start = time.time()
+    carry = rollout(*carry, args.num_steps)
+    jax.block_until_ready(carry)
+    elapsed = time.time() - start
+    del envs
+    return args.num_steps * args.batch_size / elapsed
+
+
+if __name__ == "__main__":
+    args = tyro.cli(Args)
+
+    deck = init_ygopro(args.env_id, args.lang, args.deck, args.code_list_file)
+
+    for mode in args.modes.split(","):
+        if mode == "xla":
+            sps = run_xla(args, deck)
+        elif mode in ("shared", "affinity"):
+            sps = run(args, deck, env_affinity=mode == "affinity")
+        else:
+            raise ValueError(f"Unknown mode: {mode}")
+        print(f"{mode}: {sps:.0f} steps/s")
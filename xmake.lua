@@ -61,6 +61,19 @@ target("edopro_ygoenv")
     end)
 
 
+target("dummy_bench_envpool")
+    set_kind("binary")
+    set_default(false)
+    add_files("ygoenv/ygoenv/dummy/bench_envpool.cpp")
+    add_packages("glog", "concurrentqueue")
+    add_syslinks("pthread")
+    set_languages("c++17")
+    if is_mode("release") then
+        add_cxxflags("-march=native")
+    end
+    add_includedirs("ygoenv")
+
+
 target("alphazero_mcts")
     add_rules("python.library")
     add_files("mcts/mcts/alphazero/*.cpp")
@@ -8,7 +8,7 @@ import jax.numpy as jnp
 import flax.linen as nn
 
 from ygoai.rl.jax.transformer import EncoderLayer, PositionalEncoding, LlamaEncoderLayer
-from ygoai.rl.jax.modules import MLP, GLUMlp, BatchRenorm, make_bin_params, bytes_to_bin, decode_id
+from ygoai.rl.jax.modules import MLP, GLUMlp, BatchRenorm, make_bin_params, bytes_to_bin, decode_id, unpack_obs
 from ygoai.rl.jax.rwkv import Rwkv6SelfAttention
 
 
@@ -199,6 +199,7 @@ class Encoder(nn.Module):
         action_encoder = ActionEncoderCls(
             channels=c, dtype=jnp.float32, param_dtype=self.param_dtype)
         
+        x = unpack_obs(x)
         x_cards = x['cards_']
         x_global = x['global_']
         x_actions = x['actions_']
@@ -12,6 +12,42 @@ def decode_id(x):
     return x
 
 
+# row widths of `cards_` and `mask_` with `packed_obs`, see ygopro.h
+PACKED_CARD_FEATURE_DIM = 18
+PACKED_MASK_FEATURE_DIM = 2
+
+
+def _unpack_bits(x, n_bits):
+    bits = x[..., 0].astype(jnp.uint32)
+    for i in range(1, x.shape[-1]):
+        bits = bits | (x[..., i].astype(jnp.uint32) << (8 * i))
+    shifts = jnp.arange(n_bits, dtype=jnp.uint32)
+    return ((bits[..., None] >> shifts) & 1).astype(jnp.uint8)
+
+
+def unpack_cards(x):
+    # 14 byte columns, then a uint32 with the 25 type flags, overlay and disabled
+    dense = x[..., :14]
+    bits = _unpack_bits(x[..., 14:18], 27)
+    return jnp.concatenate([
+        dense[..., :6], bits[..., 25:26], dense[..., 6:10], bits[..., 26:27],
+        dense[..., 10:14], bits[..., :25]], axis=-1)
+
+
+def unpack_mask(x):
+    return _unpack_bits(x, 14)
+
+
+def unpack_obs(x):
+    # unpack `cards_` and `mask_` of an env with `packed_obs` on device
+    x = dict(x)
+    if x['cards_'].shape[-1] == PACKED_CARD_FEATURE_DIM:
+        x['cards_'] = unpack_cards(x['cards_'])
+    if 'mask_' in x and x['mask_'].shape[-1] == PACKED_MASK_FEATURE_DIM:
+        x['mask_'] = unpack_mask(x['mask_'])
+    return x
+
+
 def bytes_to_bin(x, points, intervals):
     points = points.astype(x.dtype)
     intervals = intervals.astype(x.dtype)
@@ -8,7 +8,7 @@ import jax.numpy as jnp
 from flax import nnx
 
 from ygoai.rl.jax.nnx.transformer import EncoderLayer, PositionalEncoding
-from ygoai.rl.jax.nnx.modules import MLP, GLUMlp, BatchRenorm, make_bin_params, bytes_to_bin, decode_id
+from ygoai.rl.jax.nnx.modules import MLP, GLUMlp, BatchRenorm, make_bin_params, bytes_to_bin, decode_id, unpack_obs
 from ygoai.rl.jax.nnx.rnn import GRUCell, OptimizedLSTMCell
 
 
@@ -333,6 +333,7 @@ class Encoder(nnx.Module):
         return x, mask
     
     def __call__(self, x):
+        x = unpack_obs(x)
         x_cards = x['cards_']
         x_global = x['global_']
         x_actions = x['actions_']
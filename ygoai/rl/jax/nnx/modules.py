@@ -6,7 +6,7 @@ import jax.numpy as jnp
 from flax import nnx
 
 from flax.nnx.nnx.nn.normalization import _compute_stats, _normalize, _canonicalize_axes
-from ygoai.rl.jax.modules import make_bin_params, bytes_to_bin, decode_id
+from ygoai.rl.jax.modules import make_bin_params, bytes_to_bin, decode_id, unpack_obs
 
 default_kernel_init = nnx.initializers.lecun_normal()
 default_bias_init = nnx.initializers.zeros
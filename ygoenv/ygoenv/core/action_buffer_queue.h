@@ -23,6 +23,10 @@
 
 #include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <utility>
 #include <vector>
 
@@ -30,7 +34,19 @@
 #include "concurrentqueue/moodycamel/lightweightsemaphore.h"
 
 /**
- * Lock-free action buffer queue.
+ * Lock-free work-stealing action buffer queue.
+ *
+ * Actions are spread over one bounded ring per worker thread. Each ring is a
+ * multi-producer multi-consumer array queue with a sequence number per slot,
+ * so EnqueueBulk reserves slots with a CAS on the ring's tail and never takes
+ * a lock. Every worker has its own semaphore, signaled once per action pushed
+ * to its ring. A worker takes an action from its own ring, else steals one
+ * from the other rings, and only sleeps on its semaphore when all rings are
+ * empty. A steal leaves the victim's semaphore count behind, the victim then
+ * wakes, finds nothing and goes back to sleep.
+ *
+ * With env_affinity an env's actions always go to the ring of worker
+ * env_id % num_workers, otherwise the rings are filled round-robin.
  */
 class ActionBufferQueue {
  public:
@@ -38,49 +54,138 @@ class ActionBufferQueue {
     int env_id;
     int order;
     bool force_reset;
+    // steady clock time of EnqueueBulk, for the queue wait stats
+    int64_t enqueue_ns{0};
   };
 
  protected:
-  std::atomic<uint64_t> alloc_ptr_, done_ptr_;
-  std::size_t queue_size_;
-  std::vector<ActionSlice> queue_;
-  moodycamel::LightweightSemaphore sem_, sem_enqueue_, sem_dequeue_;
+  // A slot is free for the push at position p when seq == p, and holds the
+  // action of that push when seq == p + 1.
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    ActionSlice action;
+  };
+
+  struct alignas(64) Ring {
+    std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    alignas(64) moodycamel::LightweightSemaphore sem{0};
+    std::unique_ptr<Slot[]> buffer;
+  };
+
+  std::size_t num_workers_;
+  bool env_affinity_;
+  // power of two, larger than the number of actions that can be pending
+  std::size_t ring_size_;
+  std::unique_ptr<Ring[]> rings_;
+  std::atomic<std::size_t> next_ring_{0};
+
+  bool Push(Ring* r, const ActionSlice& action) {
+    uint64_t pos = r->tail.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = r->buffer[pos & (ring_size_ - 1)];
+      uint64_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == pos) {
+        if (r->tail.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+          slot.action = action;
+          slot.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos) {
+        // full, cannot happen while each env has one pending action
+        return false;
+      } else {
+        pos = r->tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  bool Pop(Ring* r, ActionSlice* action) {
+    uint64_t pos = r->head.load(std::memory_order_relaxed);
+    for (;;) {
+      Slot& slot = r->buffer[pos & (ring_size_ - 1)];
+      uint64_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq == pos + 1) {
+        if (r->head.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+          *action = slot.action;
+          slot.seq.store(pos + ring_size_, std::memory_order_release);
+          return true;
+        }
+      } else if (seq < pos + 1) {
+        return false;
+      } else {
+        pos = r->head.load(std::memory_order_relaxed);
+      }
+    }
+  }
 
  public:
-  explicit ActionBufferQueue(std::size_t num_envs)
-      : alloc_ptr_(0),
-        done_ptr_(0),
-        queue_size_(num_envs * 2),
-        queue_(queue_size_),
-        sem_(0),
-        sem_enqueue_(1),
-        sem_dequeue_(1) {}
+  ActionBufferQueue(std::size_t num_envs, std::size_t num_workers,
+                    bool env_affinity = false)
+      : num_workers_(num_workers),
+        env_affinity_(env_affinity),
+        ring_size_(1),
+        rings_(new Ring[num_workers]) {
+    // an env has at most one pending action, plus one stop signal per worker
+    while (ring_size_ < num_envs + num_workers) {
+      ring_size_ <<= 1;
+    }
+    for (std::size_t i = 0; i < num_workers_; ++i) {
+      rings_[i].buffer.reset(new Slot[ring_size_]);
+      for (std::size_t j = 0; j < ring_size_; ++j) {
+        rings_[i].buffer[j].seq.store(j, std::memory_order_relaxed);
+      }
+    }
+  }
 
   void EnqueueBulk(const std::vector<ActionSlice>& action) {
-    // ensure only one enqueue_bulk happens at any time
-    while (!sem_enqueue_.wait()) {
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count();
+    std::size_t first = env_affinity_
+                            ? 0
+                            : next_ring_.fetch_add(action.size(),
+                                                   std::memory_order_relaxed);
+    std::vector<std::ptrdiff_t> pushed(num_workers_, 0);
+    for (std::size_t k = 0; k < action.size(); ++k) {
+      std::size_t i = env_affinity_ ? action[k].env_id % num_workers_
+                                    : (first + k) % num_workers_;
+      ActionSlice a = action[k];
+      a.enqueue_ns = now;
+      bool ok = Push(&rings_[i], a);
+      assert(ok);
+      (void)ok;
+      ++pushed[i];
     }
-    uint64_t pos = alloc_ptr_.fetch_add(action.size());
-    for (std::size_t i = 0; i < action.size(); ++i) {
-      queue_[(pos + i) % queue_size_] = action[i];
+    for (std::size_t i = 0; i < num_workers_; ++i) {
+      if (pushed[i] > 0) {
+        rings_[i].sem.signal(pushed[i]);
+      }
     }
-    sem_.signal(action.size());
-    sem_enqueue_.signal(1);
   }
 
-  ActionSlice Dequeue() {
-    while (!sem_.wait()) {
+  ActionSlice Dequeue(std::size_t worker_id) {
+    ActionSlice action;
+    for (;;) {
+      // Every push to this ring signals its semaphore after the push, so an
+      // action that arrives after the scan below is never slept through.
+      for (std::size_t i = 0; i < num_workers_; ++i) {
+        if (Pop(&rings_[(worker_id + i) % num_workers_], &action)) {
+          return action;
+        }
+      }
+      rings_[worker_id].sem.wait();
     }
-    while (!sem_dequeue_.wait()) {
-    }
-    auto ptr = done_ptr_.fetch_add(1);
-    auto ret = queue_[ptr % queue_size_];
-    sem_dequeue_.signal(1);
-    return ret;
   }
 
   std::size_t SizeApprox() {
-    return static_cast<std::size_t>(alloc_ptr_ - done_ptr_);
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < num_workers_; ++i) {
+      size += rings_[i].tail - rings_[i].head;
+    }
+    return size;
   }
 };
 
@@ -70,6 +70,13 @@ class Array {
   Array(const ShapeSpec& spec, char* data)
       : Array(data, spec.Shape(), spec.element_size, [](char* /*unused*/) {}) {}
 
+  /**
+   * Constructor an `Array` of shape defined by `spec` over memory owned by
+   * `ptr`, which may alias into a larger shared allocation.
+   */
+  Array(const ShapeSpec& spec, std::shared_ptr<char> ptr)
+      : Array(std::move(ptr), spec.Shape(), spec.element_size) {}
+
   /**
    * Constructor an `Array` of shape defined by `spec`. This constructor
    * allocates and owns the memory.
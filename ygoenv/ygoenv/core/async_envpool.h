@@ -19,7 +19,9 @@
 
 #include <algorithm>
 #include <atomic>
+#include <map>
 #include <memory>
+#include <string>
 #include <thread>
 #include <utility>
 #include <vector>
@@ -27,7 +29,9 @@
 #include "ThreadPool.h"
 #include "ygoenv/core/action_buffer_queue.h"
 #include "ygoenv/core/array.h"
+#include "ygoenv/core/env.h"
 #include "ygoenv/core/envpool.h"
+#include "ygoenv/core/latency_stats.h"
 #include "ygoenv/core/state_buffer_queue.h"
 /**
  * Async EnvPool
@@ -45,6 +49,7 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
   std::size_t max_num_players_;
   std::size_t num_threads_;
   bool is_sync_;
+  bool env_affinity_;
   std::atomic<int> stop_;
   std::atomic<std::size_t> stepping_env_num_;
   std::vector<std::thread> workers_;
@@ -53,6 +58,20 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
   std::vector<std::unique_ptr<Env>> envs_;
   std::vector<std::atomic<int>> stepping_env_;
   std::chrono::duration<double> dur_send_, dur_recv_, dur_send_all_;
+  // one recorder per worker, the last one for the thread calling Recv
+  std::unique_ptr<LatencyStats> latency_stats_;
+  const std::size_t queue_wait_key_{LatencyKeys::Get("queue_wait")};
+  const std::size_t env_step_key_{LatencyKeys::Get("env_step")};
+  const std::size_t state_wait_key_{LatencyKeys::Get("state_wait")};
+
+  void RecordRecv(std::chrono::system_clock::time_point start) {
+    auto elapsed = std::chrono::system_clock::now() - start;
+    dur_recv_ += elapsed;
+    latency_stats_->Recorder(num_threads_)
+        ->Add(state_wait_key_,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                  .count());
+  }
 
   template <typename V>
   void SendImpl(V&& action) {
@@ -93,9 +112,9 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
         max_num_players_(spec.config["max_num_players"_]),
         num_threads_(spec.config["num_threads"_]),
         is_sync_(batch_ == num_envs_ && max_num_players_ == 1),
+        env_affinity_(spec.config["env_affinity"_]),
         stop_(0),
         stepping_env_num_(0),
-        action_buffer_queue_(new ActionBufferQueue(num_envs_)),
         state_buffer_queue_(new StateBufferQueue(
             batch_, num_envs_, max_num_players_,
             spec.state_spec.template AllValues<ShapeSpec>())),
@@ -113,17 +132,32 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
     if (num_threads_ == 0) {
       num_threads_ = std::min(batch_, processor_count);
     }
+    action_buffer_queue_.reset(
+        new ActionBufferQueue(num_envs_, num_threads_, env_affinity_));
+    latency_stats_.reset(new LatencyStats(num_threads_ + 1));
     for (std::size_t i = 0; i < num_threads_; ++i) {
-      workers_.emplace_back([this] {
+      workers_.emplace_back([this, i] {
+        LatencyRecorder::SetCurrent(latency_stats_->Recorder(i));
         for (;;) {
-          ActionSlice raw_action = action_buffer_queue_->Dequeue();
+          ActionSlice raw_action = action_buffer_queue_->Dequeue(i);
           if (stop_ == 1) {
             break;
           }
+          LatencyRecorder::Record(
+              queue_wait_key_,
+              std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now().time_since_epoch())
+                      .count() -
+                  raw_action.enqueue_ns);
           int env_id = raw_action.env_id;
           int order = raw_action.order;
           bool reset = raw_action.force_reset || envs_[env_id]->IsDone();
-          envs_[env_id]->EnvStep(state_buffer_queue_.get(), order, reset);
+          LatencyTimer timer(env_step_key_);
+          try {
+            envs_[env_id]->EnvStep(state_buffer_queue_.get(), order, reset);
+          } catch (const EnvStepAbandoned&) {
+            // the env's result was written by its watchdog, move on
+          }
         }
       });
     }
@@ -147,6 +181,10 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
     // LOG(INFO) << "envpool recv: " << dur_recv_.count();
     // send n actions to clear threadpool
     std::vector<ActionSlice> empty_actions(workers_.size());
+    for (std::size_t i = 0; i < empty_actions.size(); ++i) {
+      // one for each worker's home queue
+      empty_actions[i].env_id = static_cast<int>(i);
+    }
     action_buffer_queue_->EnqueueBulk(empty_actions);
     for (auto& worker : workers_) {
       worker.join();
@@ -166,13 +204,27 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
     }
     auto start = std::chrono::system_clock::now();
     auto ret = state_buffer_queue_->Wait(additional_wait);
-    dur_recv_ += std::chrono::system_clock::now() - start;
+    RecordRecv(start);
     if (is_sync_) {
       stepping_env_num_ -= ret[0].Shape(0);
     }
     return ret;
   }
 
+  std::vector<Array> Recv(double timeout, int min_batch) override {
+    if (is_sync_) {
+      throw std::invalid_argument(
+          "Recv with a timeout needs async mode, batch_size < num_envs");
+    }
+    auto start = std::chrono::system_clock::now();
+    auto ret = state_buffer_queue_->Wait(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::duration<double>(timeout)),
+        std::max(min_batch, 1));
+    RecordRecv(start);
+    return ret;
+  }
+
   void Reset(const Array& env_ids) override {
     TArray<int> tenv_ids(env_ids);
     int shared_offset = tenv_ids.Shape(0);
@@ -187,6 +239,22 @@ class AsyncEnvPool : public EnvPool<typename Env::Spec> {
     }
     action_buffer_queue_->EnqueueBulk(actions);
   }
+
+  void RegisterRecvBuffers(std::vector<std::vector<Array>>&& buffers) override {
+    state_buffer_queue_->RegisterBuffers(std::move(buffers));
+  }
+
+  bool CanRecvInto(const std::vector<Array>& buffers) override {
+    return state_buffer_queue_->CanWaitInto(buffers);
+  }
+
+  std::pair<std::vector<std::size_t>, std::size_t> RecvLayout() override {
+    return state_buffer_queue_->Layout();
+  }
+
+  std::map<std::string, LatencySnapshot> Stats() override {
+    return latency_stats_->Take();
+  }
 };
 
 #endif  // YGOENV_CORE_ASYNC_ENVPOOL_H_
@@ -17,6 +17,7 @@
 #ifndef YGOENV_CORE_ENV_H_
 #define YGOENV_CORE_ENV_H_
 
+#include <exception>
 #include <memory>
 #include <random>
 #include <tuple>
@@ -27,6 +28,17 @@
 #include "ygoenv/core/env_spec.h"
 #include "ygoenv/core/state_buffer_queue.h"
 
+/**
+ * Thrown out of Reset/Step by a worker that finds its result has already
+ * been written on its behalf, e.g. by a Watchdog that gave up on a hung step.
+ * The env may be in use by another worker by then, so the caller must skip
+ * PostProcess and not touch the env again.
+ */
+class EnvStepAbandoned : public std::exception {
+ public:
+  const char* what() const noexcept override { return "env step abandoned"; }
+};
+
 template <typename Dtype>
 struct InitializeHelper {
   static void Init(Array* arr) {}
@@ -189,7 +201,10 @@ class Env {
   }
 
   void PostProcess() {
-    slice_.done_write();
+    // The env may be stepped again as soon as the write is done, which
+    // reassigns slice_, so invoke a copy of the callback.
+    auto done_write = slice_.done_write;
+    done_write();
     // action_batch_.reset();
   }
 
@@ -25,6 +25,7 @@
 auto common_config =
     MakeDict("num_envs"_.Bind(1), "batch_size"_.Bind(0), "num_threads"_.Bind(0),
              "max_num_players"_.Bind(1), "thread_affinity_offset"_.Bind(-1),
+             "env_affinity"_.Bind(false),
              "base_path"_.Bind(std::string("ygoenv")), "seed"_.Bind(42),
              "gym_reset_return_info"_.Bind(false),
              "max_episode_steps"_.Bind(std::numeric_limits<int>::max()));
@@ -17,10 +17,13 @@
 #ifndef YGOENV_CORE_ENVPOOL_H_
 #define YGOENV_CORE_ENVPOOL_H_
 
+#include <map>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "ygoenv/core/env_spec.h"
+#include "ygoenv/core/latency_stats.h"
 
 /**
  * Templated subclass of EnvPool, to be overrided by the real EnvPool.
@@ -45,9 +48,24 @@ class EnvPool {
   virtual std::vector<Array> Recv() {
     throw std::runtime_error("recv not implemented");
   }
+  virtual std::vector<Array> Recv(double timeout, int min_batch) {
+    throw std::runtime_error("recv with timeout not implemented");
+  }
   virtual void Reset(const Array& env_ids) {
     throw std::runtime_error("reset not implemented");
   }
+  virtual void RegisterRecvBuffers(std::vector<std::vector<Array>>&& buffers) {
+    throw std::runtime_error("register_recv_buffers not implemented");
+  }
+  virtual bool CanRecvInto(const std::vector<Array>& buffers) {
+    throw std::runtime_error("recv_into not implemented");
+  }
+  virtual std::pair<std::vector<std::size_t>, std::size_t> RecvLayout() {
+    throw std::runtime_error("recv_layout not implemented");
+  }
+  virtual std::map<std::string, LatencySnapshot> Stats() {
+    throw std::runtime_error("stats not implemented");
+  }
 };
 
 #endif  // YGOENV_CORE_ENVPOOL_H_
@@ -0,0 +1,292 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YGOENV_CORE_LATENCY_STATS_H_
+#define YGOENV_CORE_LATENCY_STATS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Snapshot of a LatencyHistogram, counts are indexed by bucket.
+ */
+struct LatencySnapshot {
+  uint64_t count{0};
+  uint64_t sum_ns{0};
+  uint64_t max_ns{0};
+  std::vector<uint64_t> counts;
+
+  void Merge(const LatencySnapshot& other) {
+    count += other.count;
+    sum_ns += other.sum_ns;
+    max_ns = std::max(max_ns, other.max_ns);
+    counts.resize(std::max(counts.size(), other.counts.size()), 0);
+    for (std::size_t i = 0; i < other.counts.size(); ++i) {
+      counts[i] += other.counts[i];
+    }
+  }
+};
+
+/**
+ * Log-linear latency histogram in nanoseconds, in the style of HDR
+ * histograms. Values below 8 ns have a bucket each, above that every power of
+ * two is split into 8 buckets, so a bucket is within 12.5% of its values.
+ *
+ * Record is meant for a single writer thread, Take snapshots and clears the
+ * counts from any other thread. All accesses are relaxed atomics, values
+ * recorded during a Take may land in either snapshot.
+ */
+class LatencyHistogram {
+ public:
+  static constexpr int kSubBits = 3;
+  static constexpr int kSub = 1 << kSubBits;
+  // larger values are clamped, 2^41 ns is about 36 minutes
+  static constexpr int kMaxExp = 40;
+  static constexpr int kBuckets = (kMaxExp - kSubBits + 2) * kSub;
+
+  static int Bucket(uint64_t ns) {
+    if (ns < kSub) {
+      return static_cast<int>(ns);
+    }
+    ns = std::min(ns, (uint64_t(1) << (kMaxExp + 1)) - 1);
+    int e = 63 - __builtin_clzll(ns);
+    int sub = static_cast<int>(ns >> (e - kSubBits)) & (kSub - 1);
+    return (e - kSubBits + 1) * kSub + sub;
+  }
+
+  /**
+   * Smallest value of a bucket.
+   */
+  static uint64_t BucketLow(int bucket) {
+    if (bucket < kSub) {
+      return bucket;
+    }
+    int e = bucket / kSub + kSubBits - 1;
+    return static_cast<uint64_t>(kSub + bucket % kSub) << (e - kSubBits);
+  }
+
+  void Record(uint64_t ns) {
+    counts_[Bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(ns, std::memory_order_relaxed);
+    if (ns > max_ns_.load(std::memory_order_relaxed)) {
+      max_ns_.store(ns, std::memory_order_relaxed);
+    }
+  }
+
+  LatencySnapshot Take() {
+    LatencySnapshot s;
+    s.sum_ns = sum_ns_.exchange(0, std::memory_order_relaxed);
+    s.max_ns = max_ns_.exchange(0, std::memory_order_relaxed);
+    s.counts.resize(kBuckets);
+    for (int i = 0; i < kBuckets; ++i) {
+      s.counts[i] = counts_[i].exchange(0, std::memory_order_relaxed);
+      s.count += s.counts[i];
+    }
+    return s;
+  }
+
+ protected:
+  std::array<std::atomic<uint64_t>, kBuckets> counts_{};
+  std::atomic<uint64_t> sum_ns_{0};
+  std::atomic<uint64_t> max_ns_{0};
+};
+
+/**
+ * Process-wide names of latency stats. A key is looked up once, e.g. when a
+ * module is initialized, and the returned index is used to record.
+ */
+class LatencyKeys {
+ public:
+  static std::size_t Get(const std::string& name) {
+    auto& keys = Instance();
+    std::lock_guard<std::mutex> lock(keys.mutex_);
+    auto it = keys.index_.find(name);
+    if (it != keys.index_.end()) {
+      return it->second;
+    }
+    keys.names_.push_back(name);
+    keys.index_.emplace(name, keys.names_.size() - 1);
+    return keys.names_.size() - 1;
+  }
+
+  static std::string Name(std::size_t key) {
+    auto& keys = Instance();
+    std::lock_guard<std::mutex> lock(keys.mutex_);
+    return keys.names_[key];
+  }
+
+ protected:
+  std::mutex mutex_;
+  std::vector<std::string> names_;
+  std::unordered_map<std::string, std::size_t> index_;
+
+  static LatencyKeys& Instance() {
+    static LatencyKeys keys;
+    return keys;
+  }
+};
+
+/**
+ * The latency histograms written by one thread, by key. The histogram of a
+ * key is created on its first record and published with a release store, so
+ * Take never locks against the writer.
+ *
+ * A thread installs its recorder with SetCurrent, code running on it records
+ * into it with the static Record without knowing which pool it belongs to.
+ * Threads without a recorder record nothing.
+ */
+class LatencyRecorder {
+ public:
+  static constexpr std::size_t kMaxKeys = 4096;
+
+  LatencyRecorder() : hists_(new std::atomic<LatencyHistogram*>[kMaxKeys]) {
+    for (std::size_t i = 0; i < kMaxKeys; ++i) {
+      hists_[i].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  ~LatencyRecorder() {
+    for (std::size_t i = 0; i < kMaxKeys; ++i) {
+      delete hists_[i].load(std::memory_order_relaxed);
+    }
+  }
+
+  LatencyRecorder(const LatencyRecorder&) = delete;
+  LatencyRecorder& operator=(const LatencyRecorder&) = delete;
+
+  void Add(std::size_t key, uint64_t ns) {
+    if (key >= kMaxKeys) {
+      return;
+    }
+    auto* h = hists_[key].load(std::memory_order_acquire);
+    if (h == nullptr) {
+      h = new LatencyHistogram();
+      hists_[key].store(h, std::memory_order_release);
+    }
+    h->Record(ns);
+  }
+
+  /**
+   * Snapshot and clear all histograms, merged into out by key.
+   */
+  void Take(std::map<std::size_t, LatencySnapshot>* out) {
+    for (std::size_t i = 0; i < kMaxKeys; ++i) {
+      auto* h = hists_[i].load(std::memory_order_acquire);
+      if (h != nullptr) {
+        (*out)[i].Merge(h->Take());
+      }
+    }
+  }
+
+  static LatencyRecorder*& Current() {
+    thread_local LatencyRecorder* recorder = nullptr;
+    return recorder;
+  }
+
+  static void SetCurrent(LatencyRecorder* recorder) { Current() = recorder; }
+
+  static bool Enabled() { return Current() != nullptr; }
+
+  static void Record(std::size_t key, uint64_t ns) {
+    if (auto* recorder = Current()) {
+      recorder->Add(key, ns);
+    }
+  }
+
+ protected:
+  std::unique_ptr<std::atomic<LatencyHistogram*>[]> hists_;
+};
+
+/**
+ * Records the time from construction to destruction under a key on the
+ * current thread's recorder.
+ */
+class LatencyTimer {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit LatencyTimer(std::size_t key)
+      : key_(key), start_(Clock::now()) {}
+
+  ~LatencyTimer() {
+    if (LatencyRecorder::Enabled()) {
+      LatencyRecorder::Record(key_, Elapsed());
+    }
+  }
+
+  LatencyTimer(const LatencyTimer&) = delete;
+  LatencyTimer& operator=(const LatencyTimer&) = delete;
+
+  /**
+   * Record under another key instead, e.g. one only known at the end.
+   */
+  void SetKey(std::size_t key) { key_ = key; }
+
+  [[nodiscard]] uint64_t Elapsed() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() -
+                                                                start_)
+        .count();
+  }
+
+ protected:
+  std::size_t key_;
+  Clock::time_point start_;
+};
+
+/**
+ * Latency stats of an env pool, one recorder per worker thread plus one for
+ * the thread that calls Recv.
+ */
+class LatencyStats {
+ public:
+  explicit LatencyStats(std::size_t num_recorders) {
+    for (std::size_t i = 0; i < num_recorders; ++i) {
+      recorders_.emplace_back(new LatencyRecorder());
+    }
+  }
+
+  LatencyRecorder* Recorder(std::size_t i) { return recorders_[i].get(); }
+
+  /**
+   * Snapshot and reset all histograms, merged over the threads, by name.
+   */
+  std::map<std::string, LatencySnapshot> Take() {
+    std::map<std::size_t, LatencySnapshot> by_key;
+    for (auto& r : recorders_) {
+      r->Take(&by_key);
+    }
+    std::map<std::string, LatencySnapshot> ret;
+    for (auto& [key, s] : by_key) {
+      if (s.count > 0) {
+        ret.emplace(LatencyKeys::Name(key), std::move(s));
+      }
+    }
+    return ret;
+  }
+
+ protected:
+  std::vector<std::unique_ptr<LatencyRecorder>> recorders_;
+};
+
+#endif  // YGOENV_CORE_LATENCY_STATS_H_
@@ -22,14 +22,18 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 
+#include <cstring>
 #include <exception>
+#include <map>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <tuple>
 #include <utility>
 #include <vector>
 
 #include "ygoenv/core/envpool.h"
+#include "ygoenv/core/xla.h"
 
 namespace py = pybind11;
 
@@ -99,6 +103,29 @@ Array NumpyToArrayIncRef(const py::array& arr) {
                });
 }
 
+/**
+ * Wrap a caller-owned numpy array as Array without any copy or cast, it is
+ * written to in place.
+ */
+template <typename dtype>
+struct NumpyToBufferHelper {
+  static Array Convert(const py::array& arr) {
+    if (!arr.dtype().equal(py::dtype::of<dtype>()) ||
+        !(arr.flags() & py::array::c_style) || !arr.writeable()) {
+      throw std::invalid_argument(
+          "Buffers must be writeable C-contiguous arrays of the state dtype");
+    }
+    return NumpyToArrayIncRef<dtype>(arr);
+  }
+};
+
+template <typename dtype>
+struct NumpyToBufferHelper<Container<dtype>> {
+  static Array Convert(const py::array& arr) {
+    throw std::invalid_argument("Buffers are not supported for Container states");
+  }
+};
+
 template <typename Spec>
 struct SpecTupleHelper {
   static decltype(auto) Make(const Spec& spec) {
@@ -197,6 +224,24 @@ void ToArray(const std::vector<py::array>& py_arrs,
       specs);
 }
 
+template <typename... Spec>
+void ToBuffer(const std::vector<py::array>& py_arrs,
+              const std::tuple<Spec...>& specs, std::vector<Array>* ret) {
+  if (py_arrs.size() != sizeof...(Spec)) {
+    throw std::invalid_argument("Expected " + std::to_string(sizeof...(Spec)) +
+                                " buffers, got " +
+                                std::to_string(py_arrs.size()));
+  }
+  std::size_t index = 0;
+  std::apply(
+      [&](auto&&... spec) {
+        (ret->emplace_back(NumpyToBufferHelper<typename Spec::dtype>::Convert(
+             py_arrs[index++])),
+         ...);
+      },
+      specs);
+}
+
 /**
  * Templated subclass of EnvPool,
  * to be overrided by the real EnvPool.
@@ -209,6 +254,7 @@ class PyEnvPool : public EnvPool {
   PySpec py_spec;
   static std::vector<std::string> py_state_keys;
   static std::vector<std::string> py_action_keys;
+  std::unique_ptr<XlaEnvPool<EnvPool>> xla;
 
   explicit PyEnvPool(const PySpec& py_spec)
       : EnvPool(py_spec), py_spec(py_spec) {}
@@ -240,6 +286,125 @@ class PyEnvPool : public EnvPool {
     return ret;
   }
 
+  /**
+   * py api
+   * Like PyRecv, but once timeout seconds have passed it returns the envs
+   * that have finished so far, at least min_batch of them. The others are
+   * returned by later calls.
+   */
+  std::vector<py::array> PyRecvPartial(double timeout, int min_batch) {
+    std::vector<Array> arr;
+    {
+      py::gil_scoped_release release;
+      arr = EnvPool::Recv(timeout, min_batch);
+    }
+    std::vector<py::array> ret;
+    ret.reserve(EnvPool::State::kSize);
+    ToNumpy(arr, py_spec.state_spec, &ret);
+    return ret;
+  }
+
+  /**
+   * py api
+   * Like PyRecv, but the batch ends up in the given arrays, one per state
+   * with the full batched shape. Nothing is copied when the envs have
+   * written the batch into them already, i.e. they are a registered buffer
+   * set that was handed out for this batch. Any other registered set is
+   * rejected, the envs may be writing a later batch into it.
+   */
+  std::vector<py::array> PyRecvInto(const std::vector<py::array>& buffers) {
+    std::vector<Array> dst;
+    dst.reserve(buffers.size());
+    ToBuffer(buffers, py_spec.state_spec, &dst);
+    if (!EnvPool::CanRecvInto(dst)) {
+      throw std::invalid_argument(
+          "Registered buffers can only be received into by the batch written "
+          "to them");
+    }
+    std::vector<Array> arr;
+    {
+      py::gil_scoped_release release;
+      arr = EnvPool::Recv();
+      for (std::size_t i = 0; i < arr.size(); ++i) {
+        if (arr[i].Data() == dst[i].Data()) {
+          continue;
+        }
+        DCHECK_LE(arr[i].size, dst[i].size);
+        std::memcpy(dst[i].Data(), arr[i].Data(),
+                    arr[i].size * arr[i].element_size);
+        arr[i] = dst[i].Truncate(arr[i].Shape(0));
+      }
+    }
+    std::vector<py::array> ret;
+    ret.reserve(EnvPool::State::kSize);
+    ToNumpy(arr, py_spec.state_spec, &ret);
+    return ret;
+  }
+
+  /**
+   * py api
+   * Register sets of buffers that later batches are written into directly,
+   * see StateBufferQueue::RegisterBuffers.
+   */
+  void PyRegisterRecvBuffers(
+      const std::vector<std::vector<py::array>>& buffers) {
+    std::vector<std::vector<Array>> sets(buffers.size());
+    for (std::size_t i = 0; i < buffers.size(); ++i) {
+      ToBuffer(buffers[i], py_spec.state_spec, &sets[i]);
+    }
+    EnvPool::RegisterRecvBuffers(std::move(sets));
+  }
+
+  /**
+   * py api
+   * Byte offsets of the states in the arena of a batch, and its size.
+   */
+  std::pair<std::vector<std::size_t>, std::size_t> PyRecvLayout() {
+    return EnvPool::RecvLayout();
+  }
+
+  /**
+   * py api
+   * Snapshot and reset the latency histograms, by name: the count, sum and
+   * max in nanoseconds, and the (lowest value, count) of non-empty buckets.
+   */
+  std::map<std::string,
+           std::tuple<uint64_t, uint64_t, uint64_t,
+                      std::vector<std::pair<uint64_t, uint64_t>>>>
+  PyStats() {
+    std::map<std::string,
+             std::tuple<uint64_t, uint64_t, uint64_t,
+                        std::vector<std::pair<uint64_t, uint64_t>>>>
+        ret;
+    for (const auto& [name, s] : EnvPool::Stats()) {
+      std::vector<std::pair<uint64_t, uint64_t>> buckets;
+      for (std::size_t i = 0; i < s.counts.size(); ++i) {
+        if (s.counts[i] > 0) {
+          buckets.emplace_back(LatencyHistogram::BucketLow(i), s.counts[i]);
+        }
+      }
+      ret.emplace(name, std::make_tuple(s.count, s.sum_ns, s.max_ns,
+                                        std::move(buckets)));
+    }
+    return ret;
+  }
+
+  /**
+   * py api
+   * Handle and CPU custom call targets of recv and send, see XlaEnvPool.
+   */
+  std::tuple<py::array, py::capsule, py::capsule> PyXla() {
+    if (xla == nullptr) {
+      xla = std::make_unique<XlaEnvPool<EnvPool>>(this);
+    }
+    auto handle = xla->Handle();
+    const char* name = "xla._CUSTOM_CALL_TARGET";
+    return std::make_tuple(
+        py::array_t<uint8_t>(handle.size(), handle.data()),
+        py::capsule(reinterpret_cast<void*>(&XlaEnvPool<EnvPool>::Recv), name),
+        py::capsule(reinterpret_cast<void*>(&XlaEnvPool<EnvPool>::Send), name));
+  }
+
   /**
    * py api
    */
@@ -281,7 +446,14 @@ py::object abc_meta = py::module::import("abc").attr("ABCMeta");
       .def_readonly("_spec", &ENVPOOL::py_spec)                      \
       .def("_recv", &ENVPOOL::PyRecv)                                \
       .def("_send", &ENVPOOL::PySend)                                \
+      .def("_recv_partial", &ENVPOOL::PyRecvPartial)                 \
       .def("_reset", &ENVPOOL::PyReset)                              \
+      .def("_recv_into", &ENVPOOL::PyRecvInto)                       \
+      .def("_register_recv_buffers",                                 \
+           &ENVPOOL::PyRegisterRecvBuffers)                          \
+      .def("_recv_layout", &ENVPOOL::PyRecvLayout)                   \
+      .def("_xla", &ENVPOOL::PyXla)                                  \
+      .def("_stats", &ENVPOOL::PyStats)                              \
       .def_readonly_static("_state_keys", &ENVPOOL::py_state_keys)   \
       .def_readonly_static("_action_keys",                           \
                            &ENVPOOL::py_action_keys);                \
@@ -21,14 +21,18 @@
 #define MOODYCAMEL_DELETE_FUNCTION = delete
 #endif
 
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <utility>
 #include <vector>
 
 #include "ygoenv/core/array.h"
 #include "ygoenv/core/dict.h"
 #include "ygoenv/core/spec.h"
+#include "ygoenv/core/state_buffer_pool.h"
 #include "concurrentqueue/moodycamel/lightweightsemaphore.h"
 
 /**
@@ -36,17 +40,21 @@
  * for the environments to write their state outputs of each step.
  * There's a quota for how many envs' results are stored in this buffer,
  * which is controlled by the batch argments in the constructor.
+ * A buffer is reused for later batches, see Reset.
  */
 class StateBuffer {
  protected:
   std::size_t batch_;
   std::size_t max_num_players_;
+  std::shared_ptr<StateBufferPool> pool_;
   std::vector<Array> arrays_;
   std::vector<bool> is_player_state_;
   std::atomic<uint64_t> offsets_{0};
   std::atomic<std::size_t> alloc_count_{0};
   std::atomic<std::size_t> done_count_{0};
   moodycamel::LightweightSemaphore sem_;
+  // the signal of sem_ has been taken by WaitFor, only used by the waiter
+  bool ready_{false};
 
  public:
   /**
@@ -60,15 +68,16 @@ class StateBuffer {
   };
 
   /**
-   * Create a StateBuffer instance with the player_specs and shared_specs
-   * provided.
+   * Create a StateBuffer instance with its arrays taken from the pool, which
+   * holds the player_specs and shared_specs.
    */
   StateBuffer(std::size_t batch, std::size_t max_num_players,
-              const std::vector<ShapeSpec>& specs,
+              std::shared_ptr<StateBufferPool> pool,
               std::vector<bool> is_player_state)
       : batch_(batch),
         max_num_players_(max_num_players),
-        arrays_(MakeArray(specs)),
+        pool_(std::move(pool)),
+        arrays_(pool_->Acquire()),
         is_player_state_(std::move(is_player_state)) {}
 
   /**
@@ -128,6 +137,17 @@ class StateBuffer {
     }
   }
 
+  /**
+   * Blocks for at most timeout_usecs until the entire buffer is ready, and
+   * returns whether it is. A following Wait then returns at once.
+   */
+  bool WaitFor(std::int64_t timeout_usecs) {
+    if (!ready_) {
+      ready_ = sem_.wait(std::max<std::int64_t>(timeout_usecs, 0));
+    }
+    return ready_;
+  }
+
   /**
    * Blocks until the entire buffer is ready, aka, all quota has been
    * distributed out, and all user has called done.
@@ -136,7 +156,8 @@ class StateBuffer {
     if (additional_done_count > 0) {
       Done(additional_done_count);
     }
-    while (!sem_.wait()) {
+    while (!ready_) {
+      ready_ = sem_.wait();
     }
     // when things are all done, compact the buffer.
     uint64_t offsets = offsets_;
@@ -152,9 +173,30 @@ class StateBuffer {
       } else {
         ret.emplace_back(a.Truncate(shared_offset));
       }
+      // nothing past the truncated rows has been written
+      StateBufferPool::MarkDirty(a, i, ret.back().size * a.element_size);
     }
     return ret;
   }
+
+  /**
+   * The arrays the envs write into, replaced by Reset.
+   */
+  [[nodiscard]] const std::vector<Array>& Arrays() const { return arrays_; }
+
+  /**
+   * Prepare the buffer for a new batch after Wait has returned, the returned
+   * arrays keep the old memory and fresh (or recycled) arrays are taken from
+   * the pool. The buffer object itself stays in place, so writers that are
+   * still returning from Done never touch freed memory.
+   */
+  void Reset() {
+    arrays_ = pool_->Acquire();
+    offsets_ = 0;
+    alloc_count_ = 0;
+    done_count_ = 0;
+    ready_ = false;
+  }
 };
 
 #endif  // YGOENV_CORE_STATE_BUFFER_H_
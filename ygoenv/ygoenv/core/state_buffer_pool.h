@@ -0,0 +1,259 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YGOENV_CORE_STATE_BUFFER_POOL_H_
+#define YGOENV_CORE_STATE_BUFFER_POOL_H_
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ygoenv/core/array.h"
+#include "ygoenv/core/spec.h"
+
+/**
+ * Recycles the array memory of StateBuffers.
+ *
+ * All states of a batch live in one arena, a single 64-byte aligned
+ * allocation in which each state is a typed view at a fixed offset (see
+ * Offsets). The whole batch can therefore be moved with one memcpy or DMA.
+ *
+ * The arrays handed out by Acquire share the arena, which returns here when
+ * the last of them is dropped, usually when python frees the numpy arrays of
+ * a batch. A recycled arena is cleared again before reuse, but only the bytes
+ * of each state that were marked as written with MarkDirty, which are kept in
+ * a header in front of the arena. Arrays keep the pool alive, so it may
+ * outlive the StateBufferQueue.
+ *
+ * Sets of caller-owned arrays (e.g. pinned staging buffers) can be registered
+ * as well. They are handed out before any arena, so the envs write a batch
+ * straight into them. A registered set is free again once all arrays handed
+ * out from it are released, and is cleared in full before reuse since its
+ * owner may have written to it.
+ */
+class StateBufferPool : public std::enable_shared_from_this<StateBufferPool> {
+ public:
+  static constexpr std::size_t kAlignment = 64;
+
+ protected:
+  struct RegisteredSet {
+    // keep the owner's memory alive
+    std::vector<Array> arrays;
+    std::size_t in_use{0};
+  };
+
+  // deleters are named types so that MarkDirty can find the arena of an array
+  struct ArenaDeleter {
+    std::shared_ptr<StateBufferPool> pool;
+    char* arena;
+    void operator()(char* /*unused*/) const { pool->Release(arena); }
+  };
+
+  struct RegisteredDeleter {
+    std::shared_ptr<StateBufferPool> pool;
+    std::size_t set;
+    void operator()(char* /*unused*/) const { pool->ReleaseRegistered(set); }
+  };
+
+  std::vector<ShapeSpec> specs_;
+  std::vector<std::size_t> bytes_;
+  std::vector<std::size_t> offsets_;
+  // dirty sizes of all states, rounded up to the alignment
+  std::size_t header_size_;
+  std::size_t arena_size_;
+  std::vector<char*> free_;
+  std::vector<RegisteredSet> registered_;
+  std::vector<std::size_t> free_registered_;
+  std::mutex mutex_;
+
+  static std::size_t AlignUp(std::size_t n) {
+    return (n + kAlignment - 1) / kAlignment * kAlignment;
+  }
+
+  std::size_t* Dirty(char* arena) const {
+    return reinterpret_cast<std::size_t*>(arena - header_size_);
+  }
+
+  char* NewArena() const {
+    char* p = static_cast<char*>(::operator new(
+        header_size_ + arena_size_, std::align_val_t(kAlignment)));
+    std::memset(p, 0, header_size_ + arena_size_);
+    return p + header_size_;
+  }
+
+  void DeleteArena(char* arena) const {
+    ::operator delete(arena - header_size_, std::align_val_t(kAlignment));
+  }
+
+  void Release(char* arena) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(arena);
+  }
+
+  void ReleaseRegistered(std::size_t set) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--registered_[set].in_use == 0) {
+      free_registered_.push_back(set);
+    }
+  }
+
+ public:
+  explicit StateBufferPool(std::vector<ShapeSpec> specs)
+      : specs_(std::move(specs)),
+        header_size_(AlignUp(specs_.size() * sizeof(std::size_t))),
+        arena_size_(0) {
+    for (const auto& spec : specs_) {
+      auto shape = spec.Shape();
+      bytes_.push_back(Prod(shape.data(), shape.size()) * spec.element_size);
+      offsets_.push_back(arena_size_);
+      arena_size_ += AlignUp(bytes_.back());
+    }
+  }
+
+  ~StateBufferPool() {
+    for (char* arena : free_) {
+      DeleteArena(arena);
+    }
+  }
+
+  StateBufferPool(const StateBufferPool&) = delete;
+  StateBufferPool& operator=(const StateBufferPool&) = delete;
+
+  /**
+   * Byte offset of each state in the arena.
+   */
+  [[nodiscard]] const std::vector<std::size_t>& Offsets() const {
+    return offsets_;
+  }
+
+  [[nodiscard]] std::size_t ArenaSize() const { return arena_size_; }
+
+  /**
+   * Zeroed arrays for all states, recycled ones when available.
+   */
+  std::vector<Array> Acquire() {
+    char* arena = nullptr;
+    bool registered = false;
+    std::size_t set = 0;
+    std::vector<char*> blocks;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_registered_.empty()) {
+        set = free_registered_.back();
+        free_registered_.pop_back();
+        registered = true;
+        registered_[set].in_use = specs_.size();
+        for (const auto& a : registered_[set].arrays) {
+          blocks.push_back(static_cast<char*>(a.Data()));
+        }
+      } else if (!free_.empty()) {
+        arena = free_.back();
+        free_.pop_back();
+      }
+    }
+    auto self = shared_from_this();
+    std::vector<Array> arrays;
+    arrays.reserve(specs_.size());
+    if (registered) {
+      for (std::size_t i = 0; i < specs_.size(); ++i) {
+        std::memset(blocks[i], 0, bytes_[i]);
+        arrays.emplace_back(specs_[i], blocks[i], RegisteredDeleter{self, set});
+      }
+      return arrays;
+    }
+    if (arena == nullptr) {
+      arena = NewArena();
+    } else {
+      std::size_t* dirty = Dirty(arena);
+      for (std::size_t i = 0; i < specs_.size(); ++i) {
+        std::memset(arena + offsets_[i], 0, dirty[i]);
+        dirty[i] = 0;
+      }
+    }
+    std::shared_ptr<char> owner(arena, ArenaDeleter{self, arena});
+    for (std::size_t i = 0; i < specs_.size(); ++i) {
+      arrays.emplace_back(specs_[i],
+                          std::shared_ptr<char>(owner, arena + offsets_[i]));
+    }
+    return arrays;
+  }
+
+  /**
+   * Record that the first bytes of the i-th array from Acquire have been
+   * written.
+   */
+  static void MarkDirty(const Array& a, std::size_t i, std::size_t bytes) {
+    auto* deleter = std::get_deleter<ArenaDeleter>(a.SharedPtr());
+    if (deleter == nullptr) {
+      // registered, cleared in full
+      return;
+    }
+    std::size_t* dirty = deleter->pool->Dirty(deleter->arena);
+    dirty[i] = std::max(dirty[i], bytes);
+  }
+
+  /**
+   * Whether the memory of a overlaps an array of a registered set.
+   */
+  bool IsRegistered(const Array& a) {
+    auto* begin = static_cast<const char*>(a.Data());
+    auto* end = begin + a.size * a.element_size;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& set : registered_) {
+      for (const auto& r : set.arrays) {
+        auto* r_begin = static_cast<const char*>(r.Data());
+        auto* r_end = r_begin + r.size * r.element_size;
+        if ((begin < r_end) && (r_begin < end)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  /**
+   * Register sets of caller-owned arrays, each set has one array per state
+   * with exactly the batched shape of the state.
+   */
+  void Register(std::vector<std::vector<Array>> sets) {
+    for (const auto& arrays : sets) {
+      if (arrays.size() != specs_.size()) {
+        throw std::invalid_argument(
+            "Expected " + std::to_string(specs_.size()) +
+            " arrays in a buffer set, got " + std::to_string(arrays.size()));
+      }
+      for (std::size_t i = 0; i < specs_.size(); ++i) {
+        if ((arrays[i].Shape() != specs_[i].Shape()) ||
+            (arrays[i].element_size !=
+             static_cast<std::size_t>(specs_[i].element_size))) {
+          throw std::invalid_argument(
+              "Shape or dtype mismatch of buffer " + std::to_string(i));
+        }
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& arrays : sets) {
+      free_registered_.push_back(registered_.size());
+      registered_.push_back(RegisteredSet{std::move(arrays)});
+    }
+  }
+};
+
+#endif  // YGOENV_CORE_STATE_BUFFER_POOL_H_
@@ -18,16 +18,16 @@
 #define YGOENV_CORE_STATE_BUFFER_QUEUE_H_
 
 #include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <memory>
-#include <thread>
 #include <utility>
 #include <vector>
 
 #include "ygoenv/core/array.h"
-#include "ygoenv/core/circular_buffer.h"
 #include "ygoenv/core/spec.h"
 #include "ygoenv/core/state_buffer.h"
+#include "ygoenv/core/state_buffer_pool.h"
 
 class StateBufferQueue {
  protected:
@@ -38,11 +38,8 @@ class StateBufferQueue {
   std::size_t queue_size_;
   std::vector<std::unique_ptr<StateBuffer>> queue_;
   std::atomic<uint64_t> alloc_count_, done_ptr_, alloc_tail_;
-
-  // Create stock statebuffers in a background thread
-  CircularBuffer<std::unique_ptr<StateBuffer>> stock_buffer_;
-  std::vector<std::thread> create_buffer_thread_;
-  std::atomic<bool> quit_;
+  // memory of the buffers that python has released
+  std::shared_ptr<StateBufferPool> pool_;
 
  public:
   StateBufferQueue(std::size_t batch_env, std::size_t num_envs,
@@ -69,41 +66,11 @@ class StateBufferQueue {
         queue_(queue_size_),  // circular buffer
         alloc_count_(0),
         done_ptr_(0),
-        stock_buffer_((num_envs / batch_env + 2) * 2),
-        quit_(false) {
-    // Only initialize first half of the buffer
-    // At the consumption of each block, the first consumping thread
-    // will allocate a new state buffer and append to the tail.
-    // alloc_tail_ = num_envs / batch_env + 2;
+        pool_(std::make_shared<StateBufferPool>(specs_)) {
     for (auto& q : queue_) {
-      q = std::make_unique<StateBuffer>(batch_, max_num_players_, specs_,
+      q = std::make_unique<StateBuffer>(batch_, max_num_players_, pool_,
                                         is_player_state_);
     }
-    std::size_t processor_count = std::thread::hardware_concurrency();
-    // hardcode here :(
-    std::size_t create_buffer_thread_num = std::max(1UL, processor_count / 64);
-    for (std::size_t i = 0; i < create_buffer_thread_num; ++i) {
-      create_buffer_thread_.emplace_back(std::thread([&]() {
-        while (true) {
-          stock_buffer_.Put(std::make_unique<StateBuffer>(
-              batch_, max_num_players_, specs_, is_player_state_));
-          if (quit_) {
-            break;
-          }
-        }
-      }));
-    }
-  }
-
-  ~StateBufferQueue() {
-    // stop the thread
-    quit_ = true;
-    for (std::size_t i = 0; i < create_buffer_thread_.size(); ++i) {
-      stock_buffer_.Get();
-    }
-    for (auto& t : create_buffer_thread_) {
-      t.join();
-    }
   }
 
   /**
@@ -127,6 +94,41 @@ class StateBufferQueue {
     return queue_[offset]->Allocate(num_players, order);
   }
 
+  /**
+   * Let later batches be written into the given caller-owned arrays, see
+   * StateBufferPool::Register. Every buffer of the ring already holds its
+   * arrays and only takes new ones when it is reset after Wait, so a set is
+   * first written about queue_size_ batches after the current head.
+   */
+  void RegisterBuffers(std::vector<std::vector<Array>> sets) {
+    pool_->Register(std::move(sets));
+  }
+
+  /**
+   * Whether the batch returned by the next Wait may end up in dst, i.e. dst
+   * is not registered memory or is the very arrays the batch is written to.
+   * Any other registered set may belong to a buffer of a later batch that the
+   * envs are writing, or to a batch still held by python. Same single thread
+   * caveat as Wait.
+   */
+  bool CanWaitInto(const std::vector<Array>& dst) {
+    const auto& head = queue_[done_ptr_ % queue_size_]->Arrays();
+    for (std::size_t i = 0; i < dst.size(); ++i) {
+      if ((dst[i].Data() != head[i].Data()) && pool_->IsRegistered(dst[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /**
+   * Byte offsets of the states in a batch arena, and the arena size.
+   */
+  [[nodiscard]] std::pair<std::vector<std::size_t>, std::size_t> Layout()
+      const {
+    return {pool_->Offsets(), pool_->ArenaSize()};
+  }
+
   /**
    * Wait for the state buffer at the head to be ready.
    * This function can only be accessed from one thread.
@@ -137,7 +139,6 @@ class StateBufferQueue {
    * time of each state buffer is in the same order as the allocation time.
    */
   std::vector<Array> Wait(std::size_t additional_done_count = 0) {
-    std::unique_ptr<StateBuffer> newbuf = stock_buffer_.Get();
     std::size_t pos = done_ptr_.fetch_add(1);
     std::size_t offset = pos % queue_size_;
     auto arr = queue_[offset]->Wait(additional_done_count);
@@ -145,7 +146,50 @@ class StateBufferQueue {
       // move pointer to the next block
       alloc_count_.fetch_add(additional_done_count);
     }
-    std::swap(queue_[offset], newbuf);
+    queue_[offset]->Reset();
+    return arr;
+  }
+
+  /**
+   * Like Wait, but once the timeout has passed the buffer at the head is
+   * closed with the envs that have taken a slot in it so far, waiting until
+   * there are at least min_batch of them. Its remaining slots are skipped like
+   * an additional_done_count, so envs that finish later go to the next buffer.
+   * Same single thread caveat as Wait.
+   */
+  std::vector<Array> Wait(std::chrono::microseconds timeout,
+                          std::size_t min_batch) {
+    // how often the slot count is checked while short of min_batch
+    constexpr std::int64_t kPollUsecs = 100;
+    std::size_t pos = done_ptr_.fetch_add(1);
+    std::size_t offset = pos % queue_size_;
+    auto& buffer = queue_[offset];
+    // every earlier buffer has used up exactly batch_ slots
+    uint64_t begin = pos * batch_;
+    uint64_t end = begin + batch_;
+    min_batch = std::clamp<std::size_t>(min_batch, 1, batch_);
+    std::size_t skipped = 0;
+    if (!buffer->WaitFor(timeout.count())) {
+      while (true) {
+        uint64_t count = alloc_count_.load();
+        if (count >= end) {
+          // all slots are taken, only writes are left
+          break;
+        }
+        if (count >= begin + min_batch) {
+          if (alloc_count_.compare_exchange_strong(count, end)) {
+            skipped = end - count;
+            break;
+          }
+          continue;
+        }
+        if (buffer->WaitFor(kPollUsecs)) {
+          break;
+        }
+      }
+    }
+    auto arr = buffer->Wait(skipped);
+    buffer->Reset();
     return arr;
   }
 };
@@ -0,0 +1,157 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YGOENV_CORE_WATCHDOG_H_
+#define YGOENV_CORE_WATCHDOG_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Process-wide timeout supervisor for env steps.
+ *
+ * Steps run inline on the AsyncEnvPool workers. Around a call that may not
+ * return, an env arms its Watch with a deadline and disarms it afterwards.
+ * A single monitor thread scans all registered watches; once a deadline has
+ * passed it claims the watch and runs its expiry callback, which writes a
+ * substitute result for the env. The stepping thread learns from Disarm()
+ * that its result has been claimed and must not be written.
+ */
+class Watchdog {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  class Watch {
+   protected:
+    // (ticket << 1) | armed, only the owner of the current ticket may write
+    // the env result.
+    std::atomic<uint64_t> state_{0};
+    std::atomic<Clock::rep> deadline_{0};
+    std::function<void()> on_expire_;
+
+    friend class Watchdog;
+
+    /**
+     * Called by the monitor thread. Returns true if the watch was armed past
+     * its deadline and has now been claimed.
+     */
+    bool Claim(Clock::rep now) {
+      uint64_t state = state_.load(std::memory_order_acquire);
+      if ((state & 1) == 0) {
+        return false;
+      }
+      if (now < deadline_.load(std::memory_order_relaxed)) {
+        return false;
+      }
+      return state_.compare_exchange_strong(state, state & ~uint64_t(1),
+                                            std::memory_order_acq_rel);
+    }
+
+   public:
+    explicit Watch(std::function<void()> on_expire)
+        : on_expire_(std::move(on_expire)) {
+      Watchdog::Instance().Register(this);
+    }
+
+    ~Watch() { Watchdog::Instance().Unregister(this); }
+
+    Watch(const Watch&) = delete;
+    Watch& operator=(const Watch&) = delete;
+
+    /**
+     * Start a new ticket that expires after timeout.
+     */
+    uint64_t Arm(Clock::duration timeout) {
+      deadline_.store((Clock::now() + timeout).time_since_epoch().count(),
+                      std::memory_order_relaxed);
+      uint64_t ticket = (state_.load(std::memory_order_relaxed) >> 1) + 1;
+      state_.store((ticket << 1) | 1, std::memory_order_release);
+      return ticket;
+    }
+
+    /**
+     * End the ticket returned by Arm. Returns false if the monitor has
+     * already claimed it, in which case the caller must leave the env alone.
+     */
+    bool Disarm(uint64_t ticket) {
+      uint64_t state = (ticket << 1) | 1;
+      return state_.compare_exchange_strong(state, ticket << 1,
+                                            std::memory_order_acq_rel);
+    }
+  };
+
+  static Watchdog& Instance() {
+    static Watchdog watchdog;
+    return watchdog;
+  }
+
+  ~Watchdog() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    if (monitor_.joinable()) {
+      monitor_.join();
+    }
+  }
+
+ protected:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Watch*> watches_;
+  std::thread monitor_;
+  bool quit_{false};
+  const std::chrono::milliseconds interval_{100};
+
+  Watchdog() = default;
+
+  void Register(Watch* watch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    watches_.push_back(watch);
+    if (!monitor_.joinable()) {
+      monitor_ = std::thread([this] { Run(); });
+    }
+  }
+
+  void Unregister(Watch* watch) {
+    // Holding the lock also waits for a running expiry callback of the watch
+    std::lock_guard<std::mutex> lock(mutex_);
+    watches_.erase(std::remove(watches_.begin(), watches_.end(), watch),
+                   watches_.end());
+  }
+
+  void Run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!quit_) {
+      cv_.wait_for(lock, interval_);
+      auto now = Clock::now().time_since_epoch().count();
+      for (auto* watch : watches_) {
+        if (watch->Claim(now)) {
+          watch->on_expire_();
+        }
+      }
+    }
+  }
+};
+
+#endif  // YGOENV_CORE_WATCHDOG_H_
@@ -0,0 +1,150 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YGOENV_CORE_XLA_H_
+#define YGOENV_CORE_XLA_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "ygoenv/core/array.h"
+#include "ygoenv/core/dict.h"
+#include "ygoenv/core/spec.h"
+
+template <typename T>
+struct IsContainer : std::false_type {};
+
+template <typename T>
+struct IsContainer<Container<T>> : std::true_type {};
+
+/**
+ * Shape of a spec in a full batch, specs starting with -1 are per player.
+ */
+inline ShapeSpec XlaBatchSpec(const ShapeSpec& spec, int batch_size,
+                              int max_num_players) {
+  if (!spec.shape.empty() && spec.shape[0] == -1) {
+    std::vector<int> shape(spec.shape);
+    shape[0] = batch_size * max_num_players;
+    return {spec.element_size, std::move(shape)};
+  }
+  return spec.Batch(batch_size);
+}
+
+template <typename... Spec>
+std::vector<ShapeSpec> XlaBatchSpecs(const std::tuple<Spec...>& specs,
+                                     int batch_size, int max_num_players) {
+  if ((IsContainer<typename Spec::dtype>::value || ...)) {
+    throw std::runtime_error("XLA is not supported for Container states");
+  }
+  std::vector<ShapeSpec> ret;
+  std::apply(
+      [&](auto&&... spec) {
+        (ret.push_back(XlaBatchSpec(spec, batch_size, max_num_players)), ...);
+      },
+      specs);
+  return ret;
+}
+
+/**
+ * Send and recv of an EnvPool as XLA CPU custom calls.
+ *
+ * Both follow the original custom call ABI, void(void* out, const void** in).
+ * The first operand is a handle, the address of this object as a uint8 array,
+ * which is also returned as the first result so that jax orders a chain of
+ * calls by their data dependence. Send takes the batched actions and returns
+ * only the handle; recv returns the handle and a full batch of states, so
+ * XLA passes its results as an array of buffers.
+ *
+ * The buffers of XLA only live for the call, so actions are copied before
+ * they are queued and states are copied out of the received batch.
+ */
+template <typename EnvPool>
+class XlaEnvPool {
+ protected:
+  EnvPool* pool_;
+  std::vector<ShapeSpec> state_specs_;
+  std::vector<ShapeSpec> action_specs_;
+
+  static XlaEnvPool* FromHandle(const void* handle) {
+    XlaEnvPool* xla;
+    std::memcpy(&xla, handle, sizeof(xla));
+    return xla;
+  }
+
+ public:
+  static constexpr std::size_t kHandleSize = sizeof(XlaEnvPool*);
+
+  explicit XlaEnvPool(EnvPool* pool)
+      : pool_(pool),
+        state_specs_(XlaBatchSpecs(pool->spec.state_spec,
+                                   pool->spec.config["batch_size"_],
+                                   pool->spec.config["max_num_players"_])),
+        action_specs_(XlaBatchSpecs(pool->spec.action_spec,
+                                    pool->spec.config["batch_size"_],
+                                    pool->spec.config["max_num_players"_])) {}
+
+  [[nodiscard]] std::vector<uint8_t> Handle() const {
+    std::vector<uint8_t> handle(kHandleSize);
+    const XlaEnvPool* self = this;
+    std::memcpy(handle.data(), &self, kHandleSize);
+    return handle;
+  }
+
+  [[nodiscard]] const std::vector<ShapeSpec>& StateSpecs() const {
+    return state_specs_;
+  }
+
+  [[nodiscard]] const std::vector<ShapeSpec>& ActionSpecs() const {
+    return action_specs_;
+  }
+
+  static void Send(void* out, const void** in) {
+    XlaEnvPool* xla = FromHandle(in[0]);
+    std::vector<Array> action;
+    action.reserve(xla->action_specs_.size());
+    for (std::size_t i = 0; i < xla->action_specs_.size(); ++i) {
+      Array a(xla->action_specs_[i]);
+      std::memcpy(a.Data(), in[i + 1], a.size * a.element_size);
+      action.push_back(std::move(a));
+    }
+    xla->pool_->Send(std::move(action));
+    std::memcpy(out, in[0], kHandleSize);
+  }
+
+  static void Recv(void* out, const void** in) {
+    XlaEnvPool* xla = FromHandle(in[0]);
+    void** outs = reinterpret_cast<void**>(out);
+    std::vector<Array> state = xla->pool_->Recv();
+    for (std::size_t i = 0; i < state.size(); ++i) {
+      auto shape = xla->state_specs_[i].Shape();
+      std::size_t capacity =
+          Prod(shape.data(), shape.size()) * xla->state_specs_[i].element_size;
+      std::size_t bytes =
+          std::min(state[i].size * state[i].element_size, capacity);
+      // a batch with fewer players than the maximum is zero padded
+      std::memcpy(outs[i + 1], state[i].Data(), bytes);
+      std::memset(static_cast<char*>(outs[i + 1]) + bytes, 0,
+                  capacity - bytes);
+    }
+    std::memcpy(outs[0], in[0], kHandleSize);
+  }
+};
+
+#endif  // YGOENV_CORE_XLA_H_
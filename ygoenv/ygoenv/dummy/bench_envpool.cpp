@@ -0,0 +1,204 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Microbenchmark of the AsyncEnvPool scheduling overhead.
+ *
+ * For each thread count it measures the ActionBufferQueue alone, with
+ * workers that do nothing but dequeue, and the whole pool stepping the
+ * dummy env, whose steps do almost no work, in async mode
+ * (batch_size < num_envs). Both run with shared and env_affinity
+ * scheduling.
+ *
+ * Usage: bench_envpool [num_envs] [batch_size] [num_batches] [threads...]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "ygoenv/core/action_buffer_queue.h"
+#include "ygoenv/dummy/dummy_envpool.h"
+
+struct QueueResult {
+  // ns per action through the queue, and mean enqueue -> dequeue time
+  double ns_per_action;
+  double wait_ns;
+};
+
+/**
+ * Pushes batches of actions into an ActionBufferQueue like SendImpl, with at
+ * most num_envs of them queued, while num_threads workers dequeue them.
+ */
+QueueResult RunQueue(int num_envs, int batch_size, int num_threads,
+                     bool affinity, int num_batches) {
+  ActionBufferQueue queue(num_envs, num_threads, affinity);
+  std::atomic<bool> stop(false);
+  std::atomic<int64_t> dequeued(0);
+  std::atomic<int64_t> wait_ns(0);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < num_threads; ++i) {
+    workers.emplace_back([&, i] {
+      int64_t wait = 0;
+      for (;;) {
+        auto action = queue.Dequeue(i);
+        if (stop) {
+          break;
+        }
+        wait += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch())
+                    .count() -
+                action.enqueue_ns;
+        dequeued.fetch_add(1, std::memory_order_release);
+      }
+      wait_ns += wait;
+    });
+  }
+
+  std::vector<ActionBufferQueue::ActionSlice> batch(batch_size);
+  int next_env = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int it = 0; it < num_batches; ++it) {
+    // as in the pool, an env has at most one pending action
+    int64_t sent = static_cast<int64_t>(it) * batch_size;
+    while (sent + batch_size - dequeued.load(std::memory_order_acquire) >
+           num_envs) {
+      std::this_thread::yield();
+    }
+    for (auto& a : batch) {
+      a.env_id = next_env;
+      a.order = -1;
+      a.force_reset = false;
+      next_env = (next_env + 1) % num_envs;
+    }
+    queue.EnqueueBulk(batch);
+  }
+  int64_t total = static_cast<int64_t>(num_batches) * batch_size;
+  while (dequeued.load(std::memory_order_acquire) < total) {
+    std::this_thread::yield();
+  }
+  std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  stop = true;
+  std::vector<ActionBufferQueue::ActionSlice> stop_actions(num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    stop_actions[i].env_id = i;
+  }
+  queue.EnqueueBulk(stop_actions);
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  return {elapsed.count() / static_cast<double>(total),
+          static_cast<double>(wait_ns) / static_cast<double>(total)};
+}
+
+double RunPool(int num_envs, int batch_size, int num_threads, bool affinity,
+               int num_batches) {
+  auto config = dummy::DummyEnvSpec::kDefaultConfig;
+  config["num_envs"_] = num_envs;
+  config["batch_size"_] = batch_size;
+  config["num_threads"_] = num_threads;
+  config["env_affinity"_] = affinity;
+  // episode length of the dummy env
+  config["seed"_] = 1000;
+  dummy::DummyEnvSpec spec(config);
+  dummy::DummyEnvPool pool(spec);
+  using State = EnvPool<dummy::DummyEnvSpec>::State;
+
+  Array all_env_ids(Spec<int>({num_envs}));
+  for (int i = 0; i < num_envs; ++i) {
+    all_env_ids[i] = i;
+  }
+  pool.Reset(all_env_ids);
+
+  int warmup = num_batches / 10;
+  std::size_t num_steps = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int it = 0; it < warmup + num_batches; ++it) {
+    if (it == warmup) {
+      num_steps = 0;
+      start = std::chrono::steady_clock::now();
+    }
+    auto raw_state = pool.Recv();
+    State state(&raw_state);
+    const Array& state_env_id = state["info:env_id"_];
+    int n = state_env_id.Shape(0);
+    num_steps += n;
+    // the containers of obs:dyn are owned by the receiver, as the numpy
+    // conversion does in python
+    const Array& state_dyn = state["obs:dyn"_];
+    auto* dyn = reinterpret_cast<Container<int>*>(state_dyn.Data());
+    for (std::size_t i = 0; i < state_dyn.size; ++i) {
+      dyn[i].reset();
+    }
+    Array env_id(Spec<int>({n}));
+    env_id.Assign(state_env_id);
+    std::vector<Array> action;
+    action.push_back(env_id);
+    action.push_back(env_id);
+    Array list_action(Spec<double>({n, 6}));
+    list_action.Fill(0.0);
+    action.push_back(list_action);
+    Array players_action(Spec<int>({n}));
+    players_action.Fill(0);
+    action.push_back(players_action);
+    action.push_back(players_action);
+    pool.Send(action);
+  }
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return num_steps / elapsed.count();
+}
+
+int main(int argc, char** argv) {
+  int num_envs = argc > 1 ? std::atoi(argv[1]) : 1024;
+  int batch_size = argc > 2 ? std::atoi(argv[2]) : 256;
+  int num_batches = argc > 3 ? std::atoi(argv[3]) : 20000;
+  std::vector<int> threads;
+  for (int i = 4; i < argc; ++i) {
+    threads.push_back(std::atoi(argv[i]));
+  }
+  if (threads.empty()) {
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    for (int t = 1; t <= n; t *= 2) {
+      threads.push_back(t);
+    }
+  }
+
+  std::printf("ActionBufferQueue only\n");
+  std::printf("%8s %14s %14s %14s %14s\n", "threads", "ns/action",
+              "wait ns", "affinity ns/a", "affinity wait");
+  for (int t : threads) {
+    auto shared = RunQueue(num_envs, batch_size, t, false, num_batches);
+    auto affinity = RunQueue(num_envs, batch_size, t, true, num_batches);
+    std::printf("%8d %14.1f %14.1f %14.1f %14.1f\n", t, shared.ns_per_action,
+                shared.wait_ns, affinity.ns_per_action, affinity.wait_ns);
+  }
+
+  std::printf("\nAsyncEnvPool with the dummy env\n");
+  std::printf("%8s %14s %14s %14s\n", "threads", "steps/s", "ns/step",
+              "affinity st/s");
+  for (int t : threads) {
+    double sps = RunPool(num_envs, batch_size, t, false, num_batches);
+    double sps_affinity = RunPool(num_envs, batch_size, t, true, num_batches);
+    std::printf("%8d %14.0f %14.1f %14.0f\n", t, sps, 1e9 / sps,
+                sps_affinity);
+  }
+  return 0;
+}
@@ -36,12 +36,14 @@ class DummyEnvFns {
    * 2. batch_size: the batch_size when interacting with the envpool
    * 3. num_threads: the number of threads to run all the envs
    * 4. thread_affinity_offset: sets the thread affinity of the threads
-   * 5. base_path: contains the path of the envpool python package
-   * 6. seed: random seed
+   * 5. env_affinity: always step an env on the same (home) thread, other
+   *    threads only take its actions when they are idle
+   * 6. base_path: contains the path of the envpool python package
+   * 7. seed: random seed
    *
    * These's also single env specific configurations
    *
-   * 7. max_num_players: defines the number of players in a single env.
+   * 8. max_num_players: defines the number of players in a single env.
    *
    */
   static decltype(auto) DefaultConfig() {
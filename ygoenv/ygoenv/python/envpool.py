@@ -123,11 +123,116 @@ class EnvPoolMixin(ABC):
     self: EnvPool,
     reset: bool = False,
     return_info: bool = True,
+    timeout: Optional[float] = None,
+    min_batch: int = 1,
   ) -> Union[TimeStep, Tuple]:
-    """Recv a batch state from EnvPool."""
-    state_list = self._recv()
+    """Recv a batch state from EnvPool.
+
+    With a ``timeout`` in seconds (async mode only), the batch is cut short
+    once it has passed: it holds the envs that have finished by then, at
+    least ``min_batch`` of them, and ``env_id`` tells which. The slow envs
+    are returned by later calls.
+    """
+    if timeout is None:
+      state_list = self._recv()
+    else:
+      state_list = self._recv_partial(timeout, min_batch)
+    return self._to(state_list, reset, return_info)
+
+  def recv_into(
+    self: EnvPool,
+    buffers: List[np.ndarray],
+    reset: bool = False,
+    return_info: bool = True,
+  ) -> Union[TimeStep, Tuple]:
+    """Recv a batch state from EnvPool into caller-owned buffers.
+
+    ``buffers`` has one array per state key (in ``_state_keys`` order) with
+    the shapes and dtypes of ``recv_buffer_spec``. If they are a set given to
+    ``register_recv_buffers`` that the envs have written the batch into, no
+    copy is made. Other registered sets are rejected, since the envs may be
+    writing a later batch into them.
+    """
+    state_list = self._recv_into(buffers)
     return self._to(state_list, reset, return_info)
 
+  def register_recv_buffers(
+    self: EnvPool, buffers: List[List[np.ndarray]]
+  ) -> None:
+    """Let later batches be written directly into the buffer sets.
+
+    Each set is a list of arrays like in ``recv_into``, e.g. pinned host
+    staging memory. A set is reused once all arrays returned from it are
+    released. The buffers of the batches already queued in the pool are not
+    replaced, so the sets are only picked up after about
+    ``2 * (num_envs // batch_size + 2)`` batches.
+    """
+    self._register_recv_buffers(buffers)
+
+  def recv_buffer_spec(self: EnvPool) -> List[Tuple[Tuple[int, ...], Any]]:
+    """Shapes and dtypes of a buffer set, in ``_state_keys`` order."""
+    batch_size = self.config["batch_size"]
+    max_num_players = self.config["max_num_players"]
+    spec = []
+    for dtype, shape, *_ in self._spec._state_spec:
+      shape = tuple(shape)
+      if len(shape) > 0 and shape[0] == -1:
+        shape = (batch_size * max_num_players, *shape[1:])
+      else:
+        shape = (batch_size, *shape)
+      spec.append((shape, dtype))
+    return spec
+
+  def recv_layout(self: EnvPool) -> Dict[str, Any]:
+    """Memory layout of a received batch.
+
+    All states of a batch are views into one arena of ``size`` bytes. Each
+    state has a byte ``offset`` into it, and its full-batch ``shape``,
+    ``strides`` and ``dtype``, so the arena base of a batch is the address of
+    any state minus its offset. Batches written into registered buffers do not
+    follow this layout.
+    """
+    offsets, size = self._recv_layout()
+    states = {}
+    for key, offset, (shape, dtype) in zip(
+      self._state_keys, offsets, self.recv_buffer_spec()
+    ):
+      itemsize = np.dtype(dtype).itemsize
+      strides = []
+      for dim in reversed(shape):
+        strides.append(itemsize)
+        itemsize *= dim
+      states[key] = {
+        "offset": offset,
+        "shape": shape,
+        "strides": tuple(reversed(strides)),
+        "dtype": dtype,
+      }
+    return {"size": size, "states": states}
+
+  def stats(self: EnvPool) -> Dict[str, Dict[str, float]]:
+    """Snapshot and reset the latency stats of the envpool.
+
+    Each entry, e.g. ``queue_wait``, ``env_step``, ``state_wait`` and the
+    phases an env adds, has the ``count`` of records, and the ``mean``,
+    ``p50``, ``p90``, ``p99`` and ``max`` latency in milliseconds. Percentiles
+    are the lower bound of their histogram bucket, within 12.5%.
+    """
+    ret = {}
+    for name, (count, sum_ns, max_ns, buckets) in self._stats().items():
+      entry = {"count": count, "mean": sum_ns / count / 1e6}
+      for q in (50, 90, 99):
+        target = count * q / 100
+        acc = 0
+        for low, n in buckets:
+          acc += n
+          if acc >= target:
+            break
+        entry[f"p{q}"] = low / 1e6
+      entry["max"] = max_ns / 1e6
+      ret[name] = entry
+    return ret
+
   def async_reset(self: EnvPool) -> None:
     """Follows the async semantics, reset the envs in env_ids."""
     self._reset(self.all_env_ids)
@@ -0,0 +1,156 @@
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+"""XLA send/recv of EnvPool, to be used inside jitted functions."""
+
+from abc import ABC
+from typing import Any, Callable, Dict, List, Optional, Tuple, Union
+
+import jax
+import numpy as np
+from dm_env import TimeStep
+from jax import core
+from jax import numpy as jnp
+from jax.interpreters import mlir
+
+from .protocol import EnvPool
+
+try:
+  from jax.extend.core import Primitive
+except ImportError:
+  Primitive = core.Primitive
+
+_registered_targets = set()
+
+
+def _register_target(name: str, capsule: Any) -> None:
+  if name in _registered_targets:
+    return
+  try:
+    from jax.ffi import register_ffi_target
+    register_ffi_target(name, capsule, platform="cpu", api_version=0)
+  except ImportError:
+    from jax.lib import xla_client
+    xla_client.register_custom_call_target(name, capsule, platform="cpu")
+  _registered_targets.add(name)
+
+
+def _make_primitive(
+  name: str,
+  capsule: Any,
+  out_specs: List[Tuple[Tuple[int, ...], Any]],
+) -> Primitive:
+  """Primitive of a custom call with the original CPU ABI.
+
+  It returns arrays of ``out_specs``. The call has side effects, so it is
+  never deduplicated or dropped.
+  """
+  _register_target(name, capsule)
+  prim = Primitive(name)
+  prim.multiple_results = len(out_specs) > 1
+
+  def abstract_eval(*args: Any) -> Any:
+    outs = [core.ShapedArray(shape, dtype) for shape, dtype in out_specs]
+    return outs if prim.multiple_results else outs[0]
+
+  def lowering(ctx: Any, *args: Any) -> Any:
+    result_types = [
+      mlir.ir.RankedTensorType.get(
+        shape, mlir.dtype_to_ir_type(np.dtype(dtype))
+      ) for shape, dtype in out_specs
+    ]
+    op = mlir.custom_call(
+      name,
+      result_types=result_types,
+      operands=list(args),
+      has_side_effect=True,
+      api_version=1,
+    )
+    return op.results
+
+  prim.def_abstract_eval(abstract_eval)
+  # outside of jit, compile the single call
+  prim.def_impl(lambda *args: jax.jit(prim.bind)(*args))
+  mlir.register_lowering(prim, lowering, platform="cpu")
+  return prim
+
+
+class XlaMixin(ABC):
+  """Mixin to provide XLA for envpool class."""
+
+  def _action_buffer_spec(
+    self: EnvPool
+  ) -> List[Tuple[Tuple[int, ...], Any]]:
+    batch_size = self.config["batch_size"]
+    max_num_players = self.config["max_num_players"]
+    spec = []
+    for dtype, shape, *_ in self._spec._action_spec:
+      shape = tuple(shape)
+      if len(shape) > 0 and shape[0] == -1:
+        shape = (batch_size * max_num_players, *shape[1:])
+      else:
+        shape = (batch_size, *shape)
+      spec.append((shape, dtype))
+    return spec
+
+  def xla(self: Any) -> Tuple[Any, Callable, Callable, Callable]:
+    """Return the XLA version of send/recv/step functions.
+
+    Returns ``(handle, recv, send, step)``. The handle is threaded through
+    the calls to order them, e.g. as the carry of a ``lax.scan`` rollout::
+
+      handle, recv, send, step = envs.xla()
+
+      def body(handle, _):
+        handle, (obs, rew, term, trunc, info) = recv(handle)
+        action = policy(obs)
+        handle = send(handle, action, info["env_id"])
+        return handle, rew
+
+      handle, rews = jax.lax.scan(body, handle, None, length=num_steps)
+
+    Every call moves a full batch of ``batch_size`` envs.
+    """
+    handle, recv_capsule, send_capsule = self._xla()
+    handle = jnp.asarray(handle)
+    prefix = type(self).__name__
+    handle_spec = (tuple(handle.shape), np.uint8)
+    recv_prim = _make_primitive(
+      f"{prefix}_recv", recv_capsule,
+      [handle_spec, *self.recv_buffer_spec()]
+    )
+    send_prim = _make_primitive(f"{prefix}_send", send_capsule, [handle_spec])
+    action_spec = self._action_buffer_spec()
+
+    def recv(handle: jnp.ndarray) -> Tuple[jnp.ndarray, Union[TimeStep, Tuple]]:
+      ret = recv_prim.bind(handle)
+      return ret[0], self._to(ret[1:], reset=False, return_info=True)
+
+    def send(
+      handle: jnp.ndarray,
+      action: Union[Dict[str, Any], jnp.ndarray],
+      env_id: Optional[jnp.ndarray] = None,
+    ) -> jnp.ndarray:
+      action = self._from(action, env_id)
+      action = [
+        jnp.asarray(a).astype(dtype).reshape(shape)
+        for a, (shape, dtype) in zip(action, action_spec)
+      ]
+      return send_prim.bind(handle, *action)
+
+    def step(
+      handle: jnp.ndarray,
+      action: Union[Dict[str, Any], jnp.ndarray],
+      env_id: Optional[jnp.ndarray] = None,
+    ) -> Tuple[jnp.ndarray, Union[TimeStep, Tuple]]:
+      return recv(send(handle, action, env_id))
+
+    return handle, recv, send, step
@@ -154,9 +154,27 @@ class EnvPool(Protocol):
   def _send(self, action: List[np.ndarray]) -> None:
     """Cpp private _send method."""
 
+  def _recv_partial(self, timeout: float, min_batch: int) -> List[np.ndarray]:
+    """Cpp private _recv_partial method."""
+
   def _reset(self, env_id: np.ndarray) -> None:
     """Cpp private _reset method."""
 
+  def _recv_into(self, buffers: List[np.ndarray]) -> List[np.ndarray]:
+    """Cpp private _recv_into method."""
+
+  def _register_recv_buffers(self, buffers: List[List[np.ndarray]]) -> None:
+    """Cpp private _register_recv_buffers method."""
+
+  def _recv_layout(self) -> Tuple[List[int], int]:
+    """Cpp private _recv_layout method."""
+
+  def _xla(self) -> Tuple[np.ndarray, Any, Any]:
+    """Cpp private _xla method."""
+
+  def _stats(self) -> Dict[str, Tuple[int, int, int, List[Tuple[int, int]]]]:
+    """Cpp private _stats method."""
+
   def _from(
     self,
     action: Union[Dict[str, Any], np.ndarray],
@@ -212,9 +230,34 @@ class EnvPool(Protocol):
     self,
     reset: bool = False,
     return_info: bool = True,
+    timeout: Optional[float] = None,
+    min_batch: int = 1,
   ) -> Union[TimeStep, Tuple]:
     """Envpool recv wrapper."""
 
+  def recv_into(
+    self,
+    buffers: List[np.ndarray],
+    reset: bool = False,
+    return_info: bool = True,
+  ) -> Union[TimeStep, Tuple]:
+    """Envpool recv into caller-owned buffers."""
+
+  def register_recv_buffers(self, buffers: List[List[np.ndarray]]) -> None:
+    """Register buffer sets that batches are written into directly."""
+
+  def recv_buffer_spec(self) -> List[Tuple[Tuple[int, ...], Any]]:
+    """Shapes and dtypes of a buffer set."""
+
+  def recv_layout(self) -> Dict[str, Any]:
+    """Memory layout of a received batch arena."""
+
+  def xla(self) -> Tuple[Any, Callable, Callable, Callable]:
+    """XLA handle and recv/send/step functions."""
+
+  def stats(self) -> Dict[str, Dict[str, float]]:
+    """Snapshot and reset the latency stats."""
+
   def async_reset(self) -> None:
     """Envpool async reset interface."""
 
@@ -5,6 +5,7 @@ from .ygopro_ygoenv import (
   _YGOProEnvSpec,
   init_module,
 )
+from .search import YGOProSearch
 
 (
   YGOProEnvSpec,
@@ -19,4 +20,5 @@ __all__ = [
   "YGOProDMEnvPool",
   "YGOProGymEnvPool",
   "YGOProGymnasiumEnvPool",
+  "YGOProSearch",
 ]
@@ -0,0 +1,435 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef YGOENV_YGOPRO_SEARCH_H_
+#define YGOENV_YGOPRO_SEARCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "ygoenv/core/ThreadPool.h"
+#include "ygoenv/ygopro/ygopro.h"
+
+namespace ygopro {
+
+// AlphaZero search over the duels of a YGOProEnvPool, driven in C++.
+//
+// The roots are snapshots of envs of the pool. Each simulation selects one
+// leaf per root with PUCT, restores one of the envs_per_root env impls of the
+// root to it and writes the leaf observation into row i of the batch. Then
+// evaluate is called once for the whole batch to fill the policy logits and
+// values, after which the leaves are expanded and backed up.
+//
+// An impl steps on if it is at an ancestor of the leaf. Otherwise it copies
+// the env state of the root snapshot and takes the duel of the root from a
+// DuelResimulator, whose checkpoints at the roots are built again in the
+// background after each use (see DuelResimulator::run). Either way only the
+// actions below the root are stepped through the env and only the leaf is
+// encoded, so a leaf costs its depth rather than the length of the duel.
+//
+// Values are from the view of the player to move, a node keeps the value for
+// the player who chose it, so they are negated where the turn changes.
+class YGOProSearch {
+public:
+  // Reads the observations of Batch() and fills logits of shape
+  // (num_roots, max_options) and values of shape (num_roots)
+  using Evaluate = std::function<void(float *logits, float *values)>;
+
+  YGOProSearch(const YGOProEnvSpec &spec, int num_roots, int envs_per_root,
+               int num_threads, float pb_c_base, float pb_c_init,
+               float dirichlet_alpha, float exploration_fraction,
+               float value_delta_max, uint32_t seed, int resim_interval,
+               int resim_capacity)
+      : spec_(spec), num_roots_(num_roots),
+        envs_per_root_(std::max(envs_per_root, 1)),
+        max_options_(spec.config["max_options"_]), pb_c_base_(pb_c_base),
+        pb_c_init_(pb_c_init), dirichlet_alpha_(dirichlet_alpha),
+        exploration_fraction_(exploration_fraction),
+        value_delta_max_(value_delta_max), rng_(seed),
+        workers_(std::max(num_threads, 1)),
+        resim_(std::max(resim_interval, 1), std::max(resim_capacity, 0),
+               std::max(num_threads, 1)),
+        logits_(num_roots * max_options_), values_(num_roots),
+        num_options_(num_roots), leaves_(num_roots), targets_(num_roots),
+        min_max_(num_roots) {
+    std::uniform_int_distribution<uint64_t> dist(0, 0xffffffff);
+    for (int i = 0; i < num_roots_ * envs_per_root_; ++i) {
+      impls_.emplace_back(new YGOProEnvImpl(spec_, dist(rng_)));
+      last_use_.push_back(0);
+    }
+    for (const auto &s : spec_.state_spec.template AllValues<ShapeSpec>()) {
+      std::vector<int> shape(s.shape);
+      bool per_player = !shape.empty() && (shape[0] == -1);
+      if (per_player) {
+        shape[0] = num_roots_;
+      } else {
+        shape.insert(shape.begin(), num_roots_);
+      }
+      batch_.emplace_back(ShapeSpec(s.element_size, shape));
+      per_player_.push_back(per_player);
+    }
+  }
+
+  // The leaf observations, in the order of the state spec
+  const std::vector<Array> &Batch() const { return batch_; }
+
+  int MaxOptions() const { return max_options_; }
+
+  // Run num_simulations simulations from each root, writes the visit counts
+  // of the legal actions of the roots (num_roots, max_options) and the root
+  // values.
+  void Search(const std::vector<DuelSnapshot> &roots, int num_simulations,
+              const Evaluate &evaluate, int *visit_counts,
+              float *root_values) {
+    int n = roots.size();
+    if (n > num_roots_) {
+      throw std::invalid_argument("At most " + std::to_string(num_roots_) +
+                                  " roots, got " + std::to_string(n));
+    }
+    nodes_.clear();
+    root_ids_.assign(n, 0);
+    for (int i = 0; i < n; ++i) {
+      root_ids_[i] = NewNode(-1, 0);
+      targets_[i] = roots[i];
+      leaves_[i] = root_ids_[i];
+      min_max_[i] = MinMax();
+    }
+
+    StepLeaves(n, roots);
+    evaluate(logits_.data(), values_.data());
+    for (int i = 0; i < n; ++i) {
+      Node &root = nodes_[root_ids_[i]];
+      if (root.terminal) {
+        throw std::invalid_argument("Can't search from a finished duel");
+      }
+      Expand(i, root_ids_[i]);
+      if (exploration_fraction_ > 0) {
+        AddNoise(root_ids_[i]);
+      }
+      nodes_[root_ids_[i]].visits = 1;
+      nodes_[root_ids_[i]].value_sum = values_[i];
+    }
+
+    for (int sim = 0; sim < num_simulations; ++sim) {
+      for (int i = 0; i < n; ++i) {
+        leaves_[i] = Select(i, roots[i]);
+      }
+      StepLeaves(n, roots);
+      bool need_eval = false;
+      for (int i = 0; i < n; ++i) {
+        need_eval |= !nodes_[leaves_[i]].terminal;
+      }
+      if (need_eval) {
+        evaluate(logits_.data(), values_.data());
+      }
+      for (int i = 0; i < n; ++i) {
+        int leaf = leaves_[i];
+        float value;
+        int player;
+        if (nodes_[leaf].terminal) {
+          value = nodes_[leaf].terminal_value;
+          player = nodes_[leaf].mover;
+        } else {
+          Expand(i, leaf);
+          value = values_[i];
+          player = nodes_[leaf].to_play;
+        }
+        Backup(i, leaf, value, player);
+      }
+    }
+
+    for (int i = 0; i < n; ++i) {
+      const Node &root = nodes_[root_ids_[i]];
+      int *counts = visit_counts + i * max_options_;
+      std::fill(counts, counts + max_options_, 0);
+      for (int c = 0; c < root.n_children; ++c) {
+        counts[c] = nodes_[root.first_child + c].visits;
+      }
+      root_values[i] = root.value_sum / root.visits;
+    }
+  }
+
+protected:
+  struct Node {
+    int parent;
+    // children are contiguous, child c is legal action c of the node
+    int first_child = -1;
+    int n_children = 0;
+    int visits = 0;
+    // for the player who chose the node
+    float value_sum = 0;
+    float prior;
+    // player to move in and player who chose the node, -1 if unknown
+    int8_t to_play = -1;
+    int8_t mover = -1;
+    bool stepped = false;
+    bool terminal = false;
+    // reward of the finished duel for the mover
+    float terminal_value = 0;
+
+    float value() const { return visits == 0 ? 0 : value_sum / visits; }
+  };
+
+  struct MinMax {
+    float maximum = -1e6;
+    float minimum = 1e6;
+
+    void update(float v) {
+      maximum = std::max(maximum, v);
+      minimum = std::min(minimum, v);
+    }
+
+    float normalize(float v, float delta_max) const {
+      float delta = maximum - minimum;
+      if (delta <= 0) {
+        return v;
+      }
+      return (v - minimum) / std::max(delta, delta_max);
+    }
+  };
+
+  const YGOProEnvSpec spec_;
+  const int num_roots_;
+  const int envs_per_root_;
+  const int max_options_;
+  const float pb_c_base_;
+  const float pb_c_init_;
+  const float dirichlet_alpha_;
+  const float exploration_fraction_;
+  const float value_delta_max_;
+  std::mt19937 rng_;
+  ThreadPool workers_;
+  // rebuilds the duels of the roots for the impls that can't step on
+  DuelResimulator resim_;
+
+  std::vector<std::unique_ptr<YGOProEnvImpl>> impls_;
+  std::vector<uint64_t> last_use_;
+  uint64_t clock_ = 0;
+  std::vector<Array> batch_;
+  std::vector<bool> per_player_;
+  std::vector<float> logits_;
+  std::vector<float> values_;
+  // legal actions of the leaf of each root, as encoded
+  std::vector<int> num_options_;
+
+  std::vector<Node> nodes_;
+  std::vector<int> root_ids_;
+  std::vector<int> leaves_;
+  std::vector<DuelSnapshot> targets_;
+  std::vector<MinMax> min_max_;
+
+  int NewNode(int parent, float prior) {
+    Node node;
+    node.parent = parent;
+    node.prior = prior;
+    nodes_.push_back(node);
+    return nodes_.size() - 1;
+  }
+
+  // the impl of root i that is closest to target, or else the least recently
+  // used one
+  YGOProEnvImpl &ImplFor(int i, const DuelSnapshot &target) {
+    int best = -1;
+    int best_steps = -2;
+    for (int j = i * envs_per_root_; j < (i + 1) * envs_per_root_; ++j) {
+      int steps = impls_[j]->resume_steps(target);
+      if ((steps > best_steps) ||
+          ((steps == best_steps) && (last_use_[j] < last_use_[best]))) {
+        best = j;
+        best_steps = steps;
+      }
+    }
+    last_use_[best] = ++clock_;
+    return *impls_[best];
+  }
+
+  // Restores the impls to the leaves and writes their observations, in
+  // parallel over the roots
+  void StepLeaves(int n, const std::vector<DuelSnapshot> &roots) {
+    std::vector<YGOProEnvImpl *> impls(n, nullptr);
+    for (int i = 0; i < n; ++i) {
+      if (!nodes_[leaves_[i]].terminal) {
+        impls[i] = &ImplFor(i, targets_[i]);
+      }
+    }
+    std::vector<std::future<void>> futures;
+    for (int i = 0; i < n; ++i) {
+      if (impls[i] != nullptr) {
+        futures.push_back(
+            workers_.enqueue([this, i, impl = impls[i]] { StepLeaf(i, impl); }));
+      }
+    }
+    // the tasks use the search's buffers, so all of them must finish before
+    // a failure propagates
+    std::exception_ptr error;
+    for (auto &f : futures) {
+      try {
+        f.get();
+      } catch (...) {
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  void StepLeaf(int i, YGOProEnvImpl *impl) {
+    Node &leaf = nodes_[leaves_[i]];
+    impl->restore(targets_[i], resim_);
+    std::vector<Array> row;
+    row.reserve(batch_.size());
+    for (std::size_t k = 0; k < batch_.size(); ++k) {
+      Array a = per_player_[k] ? batch_[k].Slice(i, i + 1) : batch_[k][i];
+      std::memset(a.Data(), 0, a.size * a.element_size);
+      row.push_back(std::move(a));
+    }
+    YGOProEnvImpl::State state(row);
+    impl->WriteState(state);
+    leaf.stepped = true;
+    leaf.to_play = impl->to_play();
+    num_options_[i] = std::min(impl->num_options(), max_options_);
+    if (impl->done() || (num_options_[i] == 0)) {
+      leaf.terminal = true;
+      leaf.terminal_value = impl->ret_reward_;
+    }
+  }
+
+  void Expand(int i, int id) {
+    const float *logits = logits_.data() + i * max_options_;
+    int n = num_options_[i];
+    float max_logit = -1e30f;
+    for (int a = 0; a < n; ++a) {
+      max_logit = std::max(max_logit, logits[a]);
+    }
+    float sum = 0;
+    for (int a = 0; a < n; ++a) {
+      sum += std::exp(logits[a] - max_logit);
+    }
+    int first = nodes_.size();
+    int to_play = nodes_[id].to_play;
+    for (int a = 0; a < n; ++a) {
+      int c = NewNode(id, std::exp(logits[a] - max_logit) / sum);
+      nodes_[c].mover = to_play;
+    }
+    nodes_[id].first_child = first;
+    nodes_[id].n_children = n;
+  }
+
+  void AddNoise(int id) {
+    Node &node = nodes_[id];
+    std::gamma_distribution<float> gamma(dirichlet_alpha_, 1);
+    std::vector<float> noise(node.n_children);
+    float sum = 0;
+    for (auto &x : noise) {
+      x = gamma(rng_);
+      sum += x;
+    }
+    for (int c = 0; c < node.n_children; ++c) {
+      float &prior = nodes_[node.first_child + c].prior;
+      prior = prior * (1 - exploration_fraction_) +
+              noise[c] / sum * exploration_fraction_;
+    }
+  }
+
+  // value of a node for the player to move in it
+  float ValueToPlay(const Node &node, float value) const {
+    return node.mover == node.to_play || node.mover < 0 ? value : -value;
+  }
+
+  int SelectChild(int i, int id, float parent_q) {
+    const Node &node = nodes_[id];
+    float sum_q = 0;
+    int visited = 0;
+    for (int c = 0; c < node.n_children; ++c) {
+      const Node &child = nodes_[node.first_child + c];
+      if (child.visits > 0) {
+        sum_q += child.value();
+        visited += 1;
+      }
+    }
+    float mean_q = (node.parent < 0) && (visited > 0)
+                       ? sum_q / visited
+                       : (parent_q + sum_q) / (visited + 1);
+
+    float pb_c = std::log((node.visits + pb_c_base_ + 1) / pb_c_base_) +
+                 pb_c_init_;
+    pb_c *= std::sqrt(static_cast<float>(node.visits));
+    float best_score = -1e30f;
+    int n_best = 0;
+    int best = 0;
+    for (int c = 0; c < node.n_children; ++c) {
+      const Node &child = nodes_[node.first_child + c];
+      float q = child.visits == 0 ? mean_q : child.value();
+      q = std::clamp(min_max_[i].normalize(q, value_delta_max_), 0.0f, 1.0f);
+      float score = pb_c / (child.visits + 1) * child.prior + q;
+      if (score > best_score + 1e-6f) {
+        best_score = score;
+        best = c;
+        n_best = 1;
+      } else if (score >= best_score - 1e-6f) {
+        // uniform among ties, by reservoir sampling
+        n_best += 1;
+        if (std::uniform_int_distribution<int>(0, n_best - 1)(rng_) == 0) {
+          best = c;
+        }
+      }
+    }
+    return node.first_child + best;
+  }
+
+  // Descends from root i to a node that is not stepped yet or finished, and
+  // sets the actions to it as the target of the root
+  int Select(int i, const DuelSnapshot &root) {
+    int id = root_ids_[i];
+    auto &actions = targets_[i].actions;
+    actions.assign(root.actions.begin(), root.actions.end());
+    while (nodes_[id].stepped && !nodes_[id].terminal) {
+      const Node &node = nodes_[id];
+      float parent_q = ValueToPlay(node, node.value());
+      int child = SelectChild(i, id, parent_q);
+      actions.push_back(child - node.first_child);
+      id = child;
+    }
+    return id;
+  }
+
+  void Backup(int i, int leaf, float value, int player) {
+    for (int id = leaf; id >= 0; id = nodes_[id].parent) {
+      Node &node = nodes_[id];
+      int view = node.parent < 0 ? node.to_play : node.mover;
+      node.value_sum += view == player ? value : -value;
+      node.visits += 1;
+      if (node.parent >= 0) {
+        min_max_[i].update(node.value());
+      }
+    }
+  }
+};
+
+} // namespace ygopro
+
+#endif // YGOENV_YGOPRO_SEARCH_H_
@@ -0,0 +1,105 @@
+"""AlphaZero search over the duels of a YGOPro env pool."""
+
+from typing import Any, Callable, Dict, Optional, Sequence, Tuple
+
+import numpy as np
+
+from .ygopro_ygoenv import _YGOProSearch
+
+
+class YGOProSearch:
+  """Batched AlphaZero search that steps cloned duels in C++.
+
+  The roots are the current duels of ``env_ids`` of ``envs``. Selection,
+  expansion, backup and the replay of the duels to the leaves run in C++,
+  ``predict_fn`` is only called once per simulation with the observations of
+  one leaf per root, like ``AlphaZeroMCTSCtree``.
+
+  Leaves that no env of their root can step on to are restored from the
+  root: its env state is copied and its duel is taken from checkpoints that
+  are rebuilt by replaying responses in the engine only, at most
+  ``resim_capacity`` of them, every ``resim_interval`` responses and at the
+  roots.
+
+  ``predict_fn(obs)`` takes a dict of arrays with ``num_roots`` rows, which
+  are reused by the next call, and returns ``(logits, values)`` of shapes
+  ``(num_roots, max_options)`` and ``(num_roots,)``.
+  """
+
+  def __init__(
+    self,
+    envs: Any,
+    num_roots: int,
+    predict_fn: Optional[Callable] = None,
+    envs_per_root: int = 4,
+    num_threads: Optional[int] = None,
+    root_dirichlet_alpha: float = 0.3,
+    root_exploration_fraction: float = 0.25,
+    pb_c_init: float = 1.25,
+    pb_c_base: float = 19652,
+    value_delta_max: float = 0.01,
+    seed: int = 0,
+    resim_interval: int = 16,
+    resim_capacity: Optional[int] = None,
+  ):
+    if num_threads is None:
+      num_threads = envs.config["num_threads"]
+    if resim_capacity is None:
+      # the position of each root, the multiples of resim_interval below it
+      # and their rebuilds in flight
+      resim_capacity = 4 * num_roots
+    self._envs = envs
+    self._num_roots = num_roots
+    self._predict_fn = predict_fn
+    self._search = _YGOProSearch(
+      envs, num_roots, envs_per_root, num_threads, pb_c_base, pb_c_init,
+      root_dirichlet_alpha, root_exploration_fraction, value_delta_max, seed,
+      resim_interval, resim_capacity
+    )
+    self._obs_keys = [
+      (i, k[4:]) for i, k in enumerate(envs._state_keys)
+      if k.startswith("obs:")
+    ]
+
+  def set_predict_fn(self, predict_fn: Callable) -> None:
+    self._predict_fn = predict_fn
+
+  def _evaluate(self, states: Sequence[np.ndarray]) -> Tuple[Any, Any]:
+    obs: Dict[str, np.ndarray] = {k: states[i] for i, k in self._obs_keys}
+    logits, values = self._predict_fn(obs)
+    return np.asarray(logits, np.float32), np.asarray(values, np.float32)
+
+  def tree_search(
+    self,
+    env_ids: Sequence[int],
+    num_simulations: int,
+    temperature: float = 1.0,
+    sample: bool = False,
+  ) -> Tuple[np.ndarray, np.ndarray, np.ndarray]:
+    """Search from the current duels of the envs.
+
+    The envs must not be stepping, i.e. all their states have been received.
+
+    Returns
+    -------
+    probs : np.ndarray, shape (len(env_ids), max_options)
+        The visit distributions of the roots.
+    values : np.ndarray, shape (len(env_ids),)
+        The values of the roots for their players to move.
+    actions : np.ndarray, shape (len(env_ids),)
+        The selected actions of the roots.
+    """
+    assert self._predict_fn is not None, "The predict function is not set."
+    env_ids = np.asarray(env_ids, np.int32)
+    counts, values = self._search.search(
+      self._envs, env_ids.tolist(), num_simulations, self._evaluate
+    )
+    counts = counts.astype(np.float64)
+    probs = counts / np.maximum(counts.sum(-1, keepdims=True), 1)
+    if sample:
+      weights = counts ** (1 / temperature) if temperature != 1 else counts
+      weights = weights / weights.sum(-1, keepdims=True)
+      actions = np.array([np.random.choice(len(w), p=w) for w in weights])
+    else:
+      actions = counts.argmax(-1)
+    return probs, values, actions
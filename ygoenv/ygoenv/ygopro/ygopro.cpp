@@ -1,4 +1,7 @@
+#include <cstring>
+
 #include "ygoenv/ygopro/ygopro.h"
+#include "ygoenv/ygopro/search.h"
 #include "ygoenv/core/py_envpool.h"
 
 using YGOProEnvSpec = PyEnvSpec<ygopro::YGOProEnvSpec>;
@@ -7,5 +10,81 @@ using YGOProEnvPool = PyEnvPool<ygopro::YGOProEnvPool>;
 PYBIND11_MODULE(ygopro_ygoenv, m) {
   REGISTER(m, YGOProEnvSpec, YGOProEnvPool)
 
+  // snapshots of the duels, see ygopro::YGOProEnvPool
+  py::reinterpret_borrow<py::class_<YGOProEnvPool>>(
+      m.attr("_YGOProEnvPool"))
+      .def("snapshot", &YGOProEnvPool::Snapshot, py::arg("env_ids"))
+      .def("restore", &YGOProEnvPool::Restore, py::arg("handles"),
+           py::arg("env_ids"), py::arg("exact") = false)
+      .def("release_snapshots", &YGOProEnvPool::Release, py::arg("handles"))
+      .def("clone_envs", &YGOProEnvPool::CloneEnvs, py::arg("src_ids"),
+           py::arg("dst_ids"), py::arg("exact") = false);
+
+  // search over snapshots of the pool, evaluate is called with the
+  // observations of the leaves as a list in state key order, which are
+  // overwritten by the next batch, and returns (logits, values)
+  py::class_<ygopro::YGOProSearch>(m, "_YGOProSearch")
+      .def(py::init([](const YGOProEnvPool &pool, int num_roots,
+                       int envs_per_root, int num_threads, float pb_c_base,
+                       float pb_c_init, float dirichlet_alpha,
+                       float exploration_fraction, float value_delta_max,
+                       uint32_t seed, int resim_interval, int resim_capacity) {
+             return new ygopro::YGOProSearch(
+                 pool.spec, num_roots, envs_per_root, num_threads, pb_c_base,
+                 pb_c_init, dirichlet_alpha, exploration_fraction,
+                 value_delta_max, seed, resim_interval, resim_capacity);
+           }),
+           py::arg("pool"), py::arg("num_roots"), py::arg("envs_per_root"),
+           py::arg("num_threads"), py::arg("pb_c_base"), py::arg("pb_c_init"),
+           py::arg("dirichlet_alpha"), py::arg("exploration_fraction"),
+           py::arg("value_delta_max"), py::arg("seed"),
+           py::arg("resim_interval"), py::arg("resim_capacity"))
+      .def(
+          "search",
+          [](ygopro::YGOProSearch &search, YGOProEnvPool &pool,
+             const std::vector<int> &env_ids, int num_simulations,
+             const py::function &evaluate) {
+            using FloatArray =
+                py::array_t<float, py::array::c_style | py::array::forcecast>;
+            std::vector<py::array> obs;
+            ToNumpy(search.Batch(), pool.spec.state_spec, &obs);
+            py::list py_obs;
+            for (auto &a : obs) {
+              py_obs.append(a);
+            }
+            auto roots = pool.Snapshots(env_ids);
+            int n = env_ids.size();
+            int max_options = search.MaxOptions();
+            py::array_t<int> counts({n, max_options});
+            py::array_t<float> values(n);
+            int *counts_ptr = counts.mutable_data();
+            float *values_ptr = values.mutable_data();
+            {
+              py::gil_scoped_release release;
+              search.Search(
+                  roots, num_simulations,
+                  [&](float *logits, float *leaf_values) {
+                    py::gil_scoped_acquire acquire;
+                    py::tuple ret = evaluate(py_obs);
+                    auto l = FloatArray::ensure(ret[0]);
+                    auto v = FloatArray::ensure(ret[1]);
+                    py::ssize_t rows = n;
+                    if (!l || !v || (l.size() < rows * max_options) ||
+                        (v.size() < rows)) {
+                      throw std::invalid_argument(
+                          "evaluate must return logits of shape (num_roots, "
+                          "max_options) and values of shape (num_roots,)");
+                    }
+                    std::memcpy(logits, l.data(),
+                                n * max_options * sizeof(float));
+                    std::memcpy(leaf_values, v.data(), n * sizeof(float));
+                  },
+                  counts_ptr, values_ptr);
+            }
+            return py::make_tuple(counts, values);
+          },
+          py::arg("pool"), py::arg("env_ids"), py::arg("num_simulations"),
+          py::arg("evaluate"));
+
   m.def("init_module", &ygopro::init_module);
 }
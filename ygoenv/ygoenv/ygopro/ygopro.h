@@ -3,6 +3,9 @@
 
 // clang-format off
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
 #include <chrono>
 #include <cstdint>
 #include <cstdio>
@@ -12,8 +15,14 @@
 #include <string>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
+#include <thread>
+#include <type_traits>
 
 
 #include <fmt/core.h>
@@ -23,10 +32,12 @@
 #include <ankerl/unordered_dense.h>
 #include <unordered_set>
 
-#include "ygoenv/core/BS_thread_pool.h"
 
+#include "ygoenv/core/ThreadPool.h"
 #include "ygoenv/core/async_envpool.h"
 #include "ygoenv/core/env.h"
+#include "ygoenv/core/latency_stats.h"
+#include "ygoenv/core/watchdog.h"
 
 #include "ygopro-core/common.h"
 #include "ygopro-core/card_data.h"
@@ -37,101 +48,154 @@
 
 namespace ygopro {
 
-inline std::vector<std::vector<int>> combinations(int n, int r) {
-  std::vector<std::vector<int>> combs;
-  std::vector<bool> m(n);
-  std::fill(m.begin(), m.begin() + r, true);
-
-  do {
-    std::vector<int> cs;
-    cs.reserve(r);
-    for (int i = 0; i < n; ++i) {
-      if (m[i]) {
-        cs.push_back(i);
+// Incremental subset sum for selecting cards whose weights sum to a target
+// exactly. Cards are picked in increasing index order and each card counts
+// with one of its weights, card i has weights[offsets[i], offsets[i + 1]).
+//
+// Sums are bitsets of target + 1 bits. Row i of reachable_ holds the sums of
+// the subsets of cards [i, n), computed once per selection. residuals_ holds
+// the sums still missing after the picks so far, so checking or making a pick
+// is a few shifts and ands over the rows. All buffers are kept between
+// selections and only grow.
+class SubsetSum {
+public:
+  void init(const std::vector<int> &weights, const std::vector<int> &offsets,
+            int target) {
+    n_ = offsets.size() - 1;
+    target_ = std::max(target, 0);
+    n_words_ = target_ / 64 + 1;
+    last_ = -1;
+
+    w_offsets_.resize(n_ + 1);
+    weights_.clear();
+    for (int i = 0; i < n_; ++i) {
+      w_offsets_[i] = weights_.size();
+      for (int k = offsets[i]; k < offsets[i + 1]; ++k) {
+        int w = weights[k];
+        if ((w > 0) && (w <= target_)) {
+          weights_.push_back(w);
+        }
       }
     }
-    combs.push_back(cs);
-  } while (std::prev_permutation(m.begin(), m.end()));
+    w_offsets_[n_] = weights_.size();
 
-  return combs;
-}
+    reachable_.assign((n_ + 1) * n_words_, 0);
+    row(n_)[0] = 1;
+    for (int i = n_ - 1; i >= 0; --i) {
+      uint64_t *dst = row(i);
+      const uint64_t *src = row(i + 1);
+      std::copy(src, src + n_words_, dst);
+      for (int k = w_offsets_[i]; k < w_offsets_[i + 1]; ++k) {
+        shl_or(src, weights_[k], dst);
+      }
+    }
 
-inline bool sum_to(const std::vector<int> &w, const std::vector<int> ind, int i,
-                   int r) {
-  if (r <= 0) {
-    return false;
-  }
-  int n = ind.size();
-  if (i == n - 1) {
-    return r == 1 || (w[ind[i]] == r);
+    // an empty selection never completes
+    residuals_.assign(n_words_, 0);
+    if (target > 0) {
+      residuals_[target_ / 64] = uint64_t(1) << (target_ % 64);
+    }
+    next_.resize(n_words_);
   }
-  return sum_to(w, ind, i + 1, r - 1) || sum_to(w, ind, i + 1, r - w[ind[i]]);
-}
-
-inline bool sum_to(const std::vector<int> &w, const std::vector<int> ind,
-                   int r) {
-  return sum_to(w, ind, 0, r);
-}
 
-inline std::vector<std::vector<int>>
-combinations_with_weight(const std::vector<int> &weights, int r) {
-  int n = weights.size();
-  std::vector<std::vector<int>> results;
+  int size() const { return n_; }
 
-  for (int k = 1; k <= n; k++) {
-    std::vector<std::vector<int>> combs = combinations(n, k);
-    for (const auto &comb : combs) {
-      if (sum_to(weights, comb, r)) {
-        results.push_back(comb);
+  // Whether card i can be picked next and the sum still be completed.
+  bool can_pick(int i) const {
+    if (i <= last_ || i >= n_) {
+      return false;
+    }
+    for (int k = w_offsets_[i]; k < w_offsets_[i + 1]; ++k) {
+      if (shr_and_any(residuals_.data(), weights_[k], row(i + 1))) {
+        return true;
       }
     }
-  }
-  return results;
-}
-
-inline bool sum_to2(const std::vector<std::vector<int>> &w,
-                    const std::vector<int> ind, int i, int r) {
-  if (r <= 0) {
     return false;
   }
-  int n = ind.size();
-  const auto &w_ = w[ind[i]];
-  if (i == n - 1) {
-    if (w_.size() == 1) {
-      return w_[0] == r;
-    } else {
-      return w_[0] == r || w_[1] == r;
+
+  std::vector<int> next_picks() const {
+    std::vector<int> picks;
+    for (int i = last_ + 1; i < n_; ++i) {
+      if (can_pick(i)) {
+        picks.push_back(i);
+      }
     }
+    return picks;
   }
-  if (w_.size() == 1) {
-    return sum_to2(w, ind, i + 1, r - w_[0]);
-  } else {
-    return sum_to2(w, ind, i + 1, r - w_[0]) ||
-           sum_to2(w, ind, i + 1, r - w_[1]);
+
+  // Pick card i, returns true if the picked cards now sum to the target.
+  bool pick(int i) {
+    std::fill(next_.begin(), next_.end(), 0);
+    for (int k = w_offsets_[i]; k < w_offsets_[i + 1]; ++k) {
+      shr_and_or(residuals_.data(), weights_[k], row(i + 1), next_.data());
+    }
+    std::swap(residuals_, next_);
+    last_ = i;
+    return residuals_[0] & 1;
   }
-}
 
-inline bool sum_to2(const std::vector<std::vector<int>> &w,
-                    const std::vector<int> ind, int r) {
-  return sum_to2(w, ind, 0, r);
-}
+private:
+  int n_ = 0;
+  int target_ = 0;
+  int n_words_ = 1;
+  int last_ = -1;
+  // weights of card i are weights_[w_offsets_[i]:w_offsets_[i + 1]]
+  std::vector<int> weights_;
+  std::vector<int> w_offsets_;
+  std::vector<uint64_t> reachable_;
+  std::vector<uint64_t> residuals_;
+  std::vector<uint64_t> next_;
+
+  uint64_t *row(int i) { return reachable_.data() + i * n_words_; }
+  const uint64_t *row(int i) const {
+    return reachable_.data() + i * n_words_;
+  }
+
+  // src >> w, word j of the result
+  uint64_t shr_word(const uint64_t *src, int w, int j) const {
+    int q = w / 64, b = w % 64;
+    if (j + q >= n_words_) {
+      return 0;
+    }
+    uint64_t x = src[j + q] >> b;
+    if ((b != 0) && (j + q + 1 < n_words_)) {
+      x |= src[j + q + 1] << (64 - b);
+    }
+    return x;
+  }
 
-inline std::vector<std::vector<int>>
-combinations_with_weight2(
-  const std::vector<std::vector<int>> &weights, int r) {
-  int n = weights.size();
-  std::vector<std::vector<int>> results;
+  // dst |= (src << w), truncated to target_ + 1 bits
+  void shl_or(const uint64_t *src, int w, uint64_t *dst) const {
+    int q = w / 64, b = w % 64;
+    for (int j = n_words_ - 1; j >= q; --j) {
+      uint64_t x = src[j - q] << b;
+      if ((b != 0) && (j - q - 1 >= 0)) {
+        x |= src[j - q - 1] >> (64 - b);
+      }
+      dst[j] |= x;
+    }
+    int tail = (target_ + 1) % 64;
+    if (tail != 0) {
+      dst[n_words_ - 1] &= (uint64_t(1) << tail) - 1;
+    }
+  }
 
-  for (int k = 1; k <= n; k++) {
-    std::vector<std::vector<int>> combs = combinations(n, k);
-    for (const auto &comb : combs) {
-      if (sum_to2(weights, comb, r)) {
-        results.push_back(comb);
+  bool shr_and_any(const uint64_t *src, int w, const uint64_t *mask) const {
+    for (int j = 0; j < n_words_; ++j) {
+      if (shr_word(src, w, j) & mask[j]) {
+        return true;
       }
     }
+    return false;
   }
-  return results;
-}
+
+  void shr_and_or(const uint64_t *src, int w, const uint64_t *mask,
+                  uint64_t *dst) const {
+    for (int j = 0; j < n_words_; ++j) {
+      dst[j] |= shr_word(src, w, j) & mask[j];
+    }
+  }
+};
 
 inline std::vector<uint32_t>
 parse_codes_from_opcodes(const std::vector<uint32_t> &opcodes) {
@@ -515,6 +579,49 @@ spec_to_ls(uint8_t player, const std::string spec) {
   return {controller, loc, seq, pos};
 }
 
+// Packed form of a spec, used as key on the hot path. Bits 0-7 are the overlay
+// position (only for LOCATION_OVERLAY), 8-15 the sequence, 16-23 the location
+// and bit 24 is set for the opponent. 0 means no spec.
+using SpecKey = uint32_t;
+
+inline SpecKey ls_to_spec_key(uint8_t loc, uint8_t seq, uint8_t pos,
+                              bool opponent) {
+  if (!(loc & LOCATION_OVERLAY)) {
+    pos = 0;
+  }
+  return (SpecKey(opponent) << 24) | (SpecKey(loc) << 16) |
+         (SpecKey(seq) << 8) | SpecKey(pos);
+}
+
+inline bool spec_key_opponent(SpecKey key) { return (key >> 24) & 1; }
+inline uint8_t spec_key_loc(SpecKey key) { return (key >> 16) & 0xff; }
+inline uint8_t spec_key_seq(SpecKey key) { return (key >> 8) & 0xff; }
+inline uint8_t spec_key_pos(SpecKey key) { return key & 0xff; }
+
+inline std::tuple<uint8_t, uint8_t, uint8_t, uint8_t>
+spec_key_to_ls(uint8_t player, SpecKey key) {
+  uint8_t controller = spec_key_opponent(key) ? 1 - player : player;
+  return {controller, spec_key_loc(key), spec_key_seq(key), spec_key_pos(key)};
+}
+
+inline std::string spec_key_to_string(SpecKey key) {
+  if (key == 0) {
+    return "";
+  }
+  return ls_to_spec(spec_key_loc(key), spec_key_seq(key), spec_key_pos(key),
+                    spec_key_opponent(key));
+}
+
+inline std::vector<std::string>
+spec_keys_to_strings(const std::vector<SpecKey> &keys) {
+  std::vector<std::string> specs;
+  specs.reserve(keys.size());
+  for (auto key : keys) {
+    specs.push_back(spec_key_to_string(key));
+  }
+  return specs;
+}
+
 
 static std::tuple<std::vector<uint32>, std::vector<uint32>, std::vector<uint32>> read_decks(const std::string &fp) {
   std::ifstream file(fp);
@@ -800,6 +907,50 @@ static const ankerl::unordered_dense::map<int, uint8_t> msg2id =
     make_ids(_msgs, 1);
 DEFINE_X_TO_ID_FUN(msg_to_id, msg2id)
 
+// Messages that only prompt, hint or reveal and never change the field
+inline bool is_prompt_or_hint(int msg) {
+  switch (msg) {
+  case MSG_RETRY:
+  case MSG_HINT:
+  case MSG_WAITING:
+  case MSG_SELECT_BATTLECMD:
+  case MSG_SELECT_IDLECMD:
+  case MSG_SELECT_EFFECTYN:
+  case MSG_SELECT_YESNO:
+  case MSG_SELECT_OPTION:
+  case MSG_SELECT_CARD:
+  case MSG_SELECT_CHAIN:
+  case MSG_SELECT_PLACE:
+  case MSG_SELECT_POSITION:
+  case MSG_SELECT_TRIBUTE:
+  case MSG_SORT_CHAIN:
+  case MSG_SELECT_COUNTER:
+  case MSG_SELECT_SUM:
+  case MSG_SELECT_DISFIELD:
+  case MSG_SORT_CARD:
+  case MSG_SELECT_UNSELECT_CARD:
+  case MSG_CONFIRM_DECKTOP:
+  case MSG_CONFIRM_CARDS:
+  case MSG_CONFIRM_EXTRATOP:
+  case MSG_CARD_SELECTED:
+  case MSG_RANDOM_SELECTED:
+  case MSG_BECOME_TARGET:
+  case MSG_MISSED_EFFECT:
+  case MSG_TOSS_COIN:
+  case MSG_TOSS_DICE:
+  case MSG_HAND_RES:
+  case MSG_ANNOUNCE_RACE:
+  case MSG_ANNOUNCE_ATTRIB:
+  case MSG_ANNOUNCE_CARD:
+  case MSG_ANNOUNCE_NUMBER:
+  case MSG_CARD_HINT:
+  case MSG_PLAYER_HINT:
+    return true;
+  default:
+    return false;
+  }
+}
+
 
 enum class ActionAct {
   None,
@@ -1010,11 +1161,22 @@ using CardCode = uint32_t;
 using CardId = uint16_t;
 
 const int DESCRIPTION_LIMIT = 10000;
+// columns of obs:cards_
+const int CARD_FEATURE_DIM = 41;
+// columns of obs:mask_
+const int MASK_FEATURE_DIM = 14;
+// with packed_obs, an obs:cards_ row holds the 14 non-boolean columns in
+// order, followed by the boolean columns as a little-endian uint32: bit j
+// (j < 25) is type column 16 + j, bit 25 is column 6 (overlay) and bit 26 is
+// column 11 (disabled). An obs:mask_ row is a little-endian uint16 with bit j
+// for column j.
+const int PACKED_CARD_FEATURE_DIM = 18;
+const int PACKED_MASK_FEATURE_DIM = 2;
 const int CARD_EFFECT_OFFSET = 10010;
 
 class LegalAction {
 public:
-  std::string spec_ = "";
+  SpecKey spec_ = 0;
   ActionAct act_ = ActionAct::None;
   ActionPhase phase_ = ActionPhase::None;
   bool finish_ = false;
@@ -1029,13 +1191,13 @@ public:
   int msg_ = 0;
   uint32_t response_ = 0;
 
-  static LegalAction from_spec(const std::string &spec) {
+  static LegalAction from_spec(SpecKey spec) {
     LegalAction la;
     la.spec_ = spec;
     return la;
   }
 
-  static LegalAction act_spec(ActionAct act, const std::string &spec) {
+  static LegalAction act_spec(ActionAct act, SpecKey spec) {
     LegalAction la;
     la.act_ = act;
     la.spec_ = spec;
@@ -1054,7 +1216,7 @@ public:
     return la;
   }
 
-  static LegalAction activate_spec(int effect_idx, const std::string &spec) {
+  static LegalAction activate_spec(int effect_idx, SpecKey spec) {
     LegalAction la;
     la.act_ = ActionAct::Activate;
     la.effect_ = effect_idx;
@@ -1087,12 +1249,165 @@ public:
   }
 };
 
+// Actions are copied freely and kept in buffers reused across messages
+static_assert(std::is_trivially_copyable_v<LegalAction>);
+
 class SpecInfo {
 public:
   uint16_t index;
   CardId cid;
 };
 
+// Spec infos of the cards written to the observation, stored in flat tables
+// indexed by the fields of the spec key. index 0 means no card.
+class SpecInfos {
+public:
+  void clear() {
+    for (int i = 0; i < 2; ++i) {
+      for (auto &zone : zones_[i]) {
+        zone.clear();
+      }
+      for (auto &overlay : overlays_[i]) {
+        overlay.clear();
+      }
+    }
+  }
+
+  void set(SpecKey key, const SpecInfo &info) {
+    auto *zone = get_zone(key);
+    if (zone == nullptr) {
+      return;
+    }
+    auto i = slot(key);
+    if (zone->size() <= i) {
+      zone->resize(i + 1, SpecInfo{0, 0});
+    }
+    (*zone)[i] = info;
+  }
+
+  const SpecInfo *find(SpecKey key) const {
+    auto *zone = get_zone(key);
+    if (zone == nullptr) {
+      return nullptr;
+    }
+    auto i = slot(key);
+    if ((i >= zone->size()) || ((*zone)[i].index == 0)) {
+      return nullptr;
+    }
+    return &(*zone)[i];
+  }
+
+private:
+  std::vector<SpecInfo> zones_[2][7];
+  // indexed by the sequence of the xyz monster
+  std::vector<SpecInfo> overlays_[2][7];
+
+  static uint8_t slot(SpecKey key) {
+    return (spec_key_loc(key) & LOCATION_OVERLAY) ? spec_key_pos(key)
+                                                  : spec_key_seq(key);
+  }
+
+  std::vector<SpecInfo> *get_zone(SpecKey key) {
+    return const_cast<std::vector<SpecInfo> *>(
+      static_cast<const SpecInfos *>(this)->get_zone(key));
+  }
+
+  const std::vector<SpecInfo> *get_zone(SpecKey key) const {
+    int opponent = spec_key_opponent(key);
+    uint8_t loc = spec_key_loc(key);
+    if (loc & LOCATION_OVERLAY) {
+      auto seq = spec_key_seq(key);
+      return seq < 7 ? &overlays_[opponent][seq] : nullptr;
+    }
+    loc &= 0x7f;
+    if ((loc == 0) || (loc & (loc - 1))) {
+      return nullptr;
+    }
+    return &zones_[opponent][__builtin_ctz(loc)];
+  }
+};
+
+// Maps card codes to CardIds, the line numbers of the cards in the code list.
+// Built once by init_module and read-only afterwards. Open addressing at a load
+// factor of at most 0.5 in one flat array, so a lookup is usually one probe.
+class CardIndex {
+public:
+  void build(const std::vector<CardCode> &codes) {
+    size_t n = 16;
+    while (n < codes.size() * 2) {
+      n <<= 1;
+    }
+    mask_ = n - 1;
+    slots_.assign(n, Slot{0, 0});
+    for (size_t id = 1; id < codes.size(); ++id) {
+      if (codes[id] != 0) {
+        insert(codes[id], id);
+      }
+    }
+  }
+
+  // 0 if the code is not in the code list
+  CardId find(CardCode code) const {
+    if (slots_.empty()) {
+      return 0;
+    }
+    for (size_t i = hash(code) & mask_;; i = (i + 1) & mask_) {
+      const auto &slot = slots_[i];
+      if (slot.id == 0) {
+        return 0;
+      }
+      if (slot.code == code) {
+        return slot.id;
+      }
+    }
+  }
+
+private:
+  struct Slot {
+    CardCode code;
+    CardId id;
+  };
+
+  std::vector<Slot> slots_;
+  size_t mask_ = 0;
+
+  static size_t hash(CardCode code) {
+    return (uint64_t(code) * 0x9e3779b97f4a7c15ULL) >> 32;
+  }
+
+  void insert(CardCode code, CardId id) {
+    for (size_t i = hash(code) & mask_;; i = (i + 1) & mask_) {
+      auto &slot = slots_[i];
+      if ((slot.id == 0) || (slot.code == code)) {
+        slot = {code, id};
+        return;
+      }
+    }
+  }
+};
+
+static CardIndex card_index_;
+
+// Card texts are only needed for verbose output and effect descriptions,
+// so they live in their own table instead of being copied with every Card
+struct CardText {
+  std::string name;
+  std::string desc;
+  std::vector<std::string> strings;
+};
+
+// indexed by CardId
+static std::vector<CardText> cards_text_;
+
+inline const CardText &c_get_card_text(CardCode code) {
+  static const CardText empty;
+  CardId id = card_index_.find(code);
+  if (id != 0) {
+    return cards_text_[id];
+  }
+  return empty;
+}
+
 class Card {
   friend class YGOProEnvImpl;
 
@@ -1110,14 +1425,12 @@ protected:
   uint32_t attribute_;
   uint32_t link_marker_;
   // uint32_t category_;
-  std::string name_;
-  std::string desc_;
-  std::vector<std::string> strings_;
 
   uint32_t data_ = 0;
 
   uint32_t status_ = 0;
   PlayerId controler_ = 0;
+  CardId id_ = 0;
   uint32_t location_ = 0;
   uint32_t sequence_ = 0;
   uint32_t position_ = 0;
@@ -1128,16 +1441,16 @@ public:
 
   Card(CardCode code, uint32_t alias, uint64_t setcode, uint32_t type,
        uint32_t level, uint32_t lscale, uint32_t rscale, int32_t attack,
-       int32_t defense, uint32_t race, uint32_t attribute, uint32_t link_marker,
-       const std::string &name, const std::string &desc,
-       const std::vector<std::string> &strings)
+       int32_t defense, uint32_t race, uint32_t attribute, uint32_t link_marker)
       : code_(code), alias_(alias), setcode_(setcode), type_(type),
         level_(level), lscale_(lscale), rscale_(rscale), attack_(attack),
         defense_(defense), race_(race), attribute_(attribute),
-        link_marker_(link_marker), name_(name), desc_(desc), strings_(strings) {
+        link_marker_(link_marker) {
   }
 
-  ~Card() = default;
+  void set_id(CardId id) { id_ = id; }
+
+  CardId id() const { return id_; }
 
   void set_location(uint32_t location) {
     controler_ = location & 0xff;
@@ -1146,11 +1459,28 @@ public:
     position_ = (location >> 24) & 0xff;
   }
 
-  const std::string &name() const { return name_; }
-  const std::string &desc() const { return desc_; }
+  // Row of obs:cards_ with the columns that never change for the card (id,
+  // attribute, race, types), all dynamic columns are left zero
+  std::array<uint8_t, CARD_FEATURE_DIM> static_features() const {
+    std::array<uint8_t, CARD_FEATURE_DIM> row{};
+    row[0] = static_cast<uint8_t>(id_ >> 8);
+    row[1] = static_cast<uint8_t>(id_ & 0xff);
+    row[7] = attribute_to_id(attribute_);
+    row[8] = race_to_id(race_);
+    auto type_ids = type_to_ids(type_);
+    for (int j = 0; j < type_ids.size(); ++j) {
+      row[16 + j] = type_ids[j];
+    }
+    return row;
+  }
+
+  const std::string &name() const { return c_get_card_text(code_).name; }
+  const std::string &desc() const { return c_get_card_text(code_).desc; }
   const uint32_t &type() const { return type_; }
   const uint32_t &level() const { return level_; }
-  const std::vector<std::string> &strings() const { return strings_; }
+  const std::vector<std::string> &strings() const {
+    return c_get_card_text(code_).strings;
+  }
 
   std::string get_spec(bool opponent) const {
     return ls_to_spec(location_, sequence_, position_, opponent);
@@ -1160,6 +1490,14 @@ public:
     return get_spec(player != controler_);
   }
 
+  SpecKey get_spec_key(bool opponent) const {
+    return ls_to_spec_key(location_, sequence_, position_, opponent);
+  }
+
+  SpecKey get_spec_key(PlayerId player) const {
+    return get_spec_key(player != controler_);
+  }
+
   std::string get_position() const { return position_to_string(position_); }
 
   std::string get_effect_description(CardCode code, int effect_idx) const {
@@ -1174,7 +1512,7 @@ public:
       throw std::runtime_error(
           fmt::format("Invalid effect index: {}", effect_idx));
     }
-    auto s = strings_[effect_idx];
+    const auto &s = strings()[effect_idx];
     if (s.empty()) {
       return "effect " + std::to_string(effect_idx);
     }
@@ -1182,6 +1520,8 @@ public:
   }
 };
 
+static_assert(std::is_trivially_copyable_v<Card>);
+
 struct MDuel {
   intptr_t pduel;
   uint64_t seed;
@@ -1193,6 +1533,17 @@ struct MDuel {
   std::string deck_name1;
 };
 
+// Shared by all envs to build the duels for async_reset in the background.
+// The pool is created by the first call, with num_threads threads or, if it
+// is not positive, one per 16 hardware threads.
+inline ThreadPool &duel_builder(int num_threads = 0) {
+  static ThreadPool pool(
+      num_threads > 0
+          ? static_cast<std::size_t>(num_threads)
+          : std::max(1u, std::thread::hardware_concurrency() / 16));
+  return pool;
+}
+
 inline Card db_query_card(const SQLite::Database &db, CardCode code) {
   SQLite::Statement query1(db, "SELECT * FROM datas WHERE id=?");
   query1.bind(1, code);
@@ -1219,19 +1570,22 @@ inline Card db_query_card(const SQLite::Database &db, CardCode code) {
   uint32_t race = query1.getColumn("race");
   uint32_t attribute = query1.getColumn("attribute");
 
-  SQLite::Statement query2(db, "SELECT * FROM texts WHERE id=?");
-  query2.bind(1, code);
-  query2.executeStep();
+  return Card(code, alias, setcode, type, level, lscale, rscale, attack,
+              defense, race, attribute, link_marker);
+}
+
+inline CardText db_query_card_text(const SQLite::Database &db, CardCode code) {
+  SQLite::Statement query(db, "SELECT * FROM texts WHERE id=?");
+  query.bind(1, code);
+  query.executeStep();
 
-  std::string name = query2.getColumn(1);
-  std::string desc = query2.getColumn(2);
-  std::vector<std::string> strings;
-  for (int i = 3; i < query2.getColumnCount(); ++i) {
-    std::string str = query2.getColumn(i);
-    strings.push_back(str);
+  CardText text;
+  text.name = query.getColumn(1).getString();
+  text.desc = query.getColumn(2).getString();
+  for (int i = 3; i < query.getColumnCount(); ++i) {
+    text.strings.push_back(query.getColumn(i).getString());
   }
-  return Card(code, alias, setcode, type, level, lscale, rscale, attack,
-              defense, race, attribute, link_marker, name, desc, strings);
+  return text;
 }
 
 inline card_data db_query_card_data(const SQLite::Database &db, CardCode code) {
@@ -1266,9 +1620,12 @@ struct card_script {
   int len;
 };
 
-static ankerl::unordered_dense::map<CardCode, Card> cards_;
-static ankerl::unordered_dense::map<CardCode, CardId> card_ids_;
-static ankerl::unordered_dense::map<CardCode, card_data> cards_data_;
+// Dense card tables indexed by CardId, filled by init_module. Entry 0 (and
+// any id of an unparsable code list line) is empty.
+static std::vector<Card> cards_;
+static std::vector<card_data> cards_data_;
+// Card::static_features of each card, copied by the observation encoder
+static std::vector<std::array<uint8_t, CARD_FEATURE_DIM>> cards_features_;
 static ankerl::unordered_dense::map<std::string, card_script> cards_script_;
 static ankerl::unordered_dense::map<std::string, std::vector<CardCode>>
     main_decks_;
@@ -1277,18 +1634,27 @@ static ankerl::unordered_dense::map<std::string, std::vector<CardCode>>
 static std::vector<std::string> deck_names_;
 static ankerl::unordered_dense::map<std::string, int> deck_names_ids_;
 
+// Keys of the latency stats, see LatencyRecorder. The per message keys are
+// indexed by message id and filled by init_module.
+static const std::size_t process_key_ = LatencyKeys::Get("process");
+static const std::size_t encode_key_ = LatencyKeys::Get("encode");
+static const std::size_t reset_key_ = LatencyKeys::Get("reset");
+static const std::size_t restore_key_ = LatencyKeys::Get("restore");
+static std::array<std::size_t, 256> handle_message_keys_;
+static std::array<std::size_t, 256> decision_keys_;
+
 inline const Card &c_get_card(CardCode code) {
-  auto it = cards_.find(code);
-  if (it != cards_.end()) {
-    return it->second;
+  CardId id = card_index_.find(code);
+  if (id != 0) {
+    return cards_[id];
   }
   throw std::runtime_error("[c_get_card] Card not found: " + std::to_string(code));
 }
 
-inline CardId &c_get_card_id(CardCode code) {
-  auto it = card_ids_.find(code);
-  if (it != card_ids_.end()) {
-    return it->second;
+inline CardId c_get_card_id(CardCode code) {
+  CardId id = card_index_.find(code);
+  if (id != 0) {
+    return id;
   }
   throw std::runtime_error("[c_get_card_id] Card not found: " + std::to_string(code));
 }
@@ -1337,32 +1703,26 @@ inline void sort_extra_deck(std::vector<CardCode> &deck) {
   deck = c;
 }
 
+// All cards of the code list are loaded by init_module, so this only checks
+// that the deck is covered
 inline void preload_deck(const SQLite::Database &db,
                          const std::vector<CardCode> &deck) {
   for (const auto &code : deck) {
-    auto it = cards_.find(code);
-    if (it == cards_.end()) {
-      cards_[code] = db_query_card(db, code);
-      if (card_ids_.find(code) == card_ids_.end()) {
-        throw std::runtime_error("Card not found in code list: " +
-                                 std::to_string(code));
-      }
-    }
-
-    auto it2 = cards_data_.find(code);
-    if (it2 == cards_data_.end()) {
-      cards_data_[code] = db_query_card_data(db, code);
+    if (card_index_.find(code) == 0) {
+      throw std::runtime_error("Card not found in code list: " +
+                               std::to_string(code));
     }
   }
 }
 
 inline uint32 card_reader_callback(CardCode code, card_data *card) {
-  auto it = cards_data_.find(code);
-  if (it == cards_data_.end()) {
+  // code 0 is read for the empty card, its entry is cards_data_[0]
+  CardId id = code == 0 ? 0 : card_index_.find(code);
+  if ((code != 0) && (id == 0)) {
     fmt::println("[card_reader_callback] Card not found: " + std::to_string(code));
     throw std::runtime_error("[card_reader_callback] Card not found: " + std::to_string(code));
   }
-  *card = it->second;
+  *card = cards_data_[id];
   return 0;
 }
 
@@ -1405,16 +1765,30 @@ static void init_module(const std::string &db_path,
   int i = 0;
   CardCode code;
   int has_script, script_len;
+  // codes[id], 0 for unparsable lines
+  std::vector<CardCode> codes(1, 0);
+  cards_.assign(1, Card());
+  cards_text_.assign(1, CardText());
+  cards_data_.assign(1, card_data());
+  cards_features_.assign(1, {});
   while (std::getline(file, line)) {
     i++;
+    codes.resize(i + 1, 0);
+    cards_.resize(i + 1);
+    cards_text_.resize(i + 1);
+    cards_data_.resize(i + 1);
+    cards_features_.resize(i + 1);
     std::istringstream iss(line);
     if (!(iss >> code >> has_script)) {
         std::cerr << "Failed to parse line in code_list: " << line << std::endl;
         continue;
     }
-    card_ids_[code] = i;
-    cards_[code] = db_query_card(db, code);
-    cards_data_[code] = db_query_card_data(db, code);
+    codes[i] = code;
+    cards_[i] = db_query_card(db, code);
+    cards_[i].set_id(i);
+    cards_text_[i] = db_query_card_text(db, code);
+    cards_data_[i] = db_query_card_data(db, code);
+    cards_features_[i] = cards_[i].static_features();
     if (has_script) {
       std::string path = "./script/c" + std::to_string(code) + ".lua";
       byte *buf = read_card_script(path, &script_len);
@@ -1442,8 +1816,14 @@ static void init_module(const std::string &db_path,
     sort_extra_deck(deck);
   }
 
-  card_data card;
-  cards_data_[0] = card;
+  card_index_.build(codes);
+
+  for (int msg = 0; msg < 256; ++msg) {
+    handle_message_keys_[msg] =
+        LatencyKeys::Get("handle_message/" + msg_to_string(msg));
+    decision_keys_[msg] =
+        LatencyKeys::Get("step_by_decision/" + msg_to_string(msg));
+  }
 
   std::vector<std::string> preload = {
     "./script/constant.lua",
@@ -1515,6 +1895,11 @@ public:
   const int &init_lp() const { return init_lp_; }
 
   virtual int think(const std::vector<LegalAction> &actions) = 0;
+
+  virtual std::unique_ptr<Player> clone() const = 0;
+
+  // only random players have an rng to seed
+  virtual void seed(uint32_t seed) {}
 };
 
 class GreedyAI : public Player {
@@ -1525,6 +1910,10 @@ public:
       : Player(nickname, init_lp, duel_player, verbose) {}
 
   int think(const std::vector<LegalAction> &actions) override { return 0; }
+
+  std::unique_ptr<Player> clone() const override {
+    return std::make_unique<GreedyAI>(*this);
+  }
 };
 
 class RandomAI : public Player {
@@ -1541,6 +1930,12 @@ public:
   int think(const std::vector<LegalAction> &actions) override {
     return dist_(gen_) % actions.size();
   }
+
+  std::unique_ptr<Player> clone() const override {
+    return std::make_unique<RandomAI>(*this);
+  }
+
+  void seed(uint32_t seed) override { gen_.seed(seed); }
 };
 
 class HumanPlayer : public Player {
@@ -1570,6 +1965,10 @@ public:
       }
     }
   }
+
+  std::unique_ptr<Player> clone() const override {
+    return std::make_unique<HumanPlayer>(*this);
+  }
 };
 
 class YGOProEnvFns {
@@ -1581,20 +1980,29 @@ public:
                     "verbose"_.Bind(false), "max_options"_.Bind(16),
                     "max_cards"_.Bind(80), "n_history_actions"_.Bind(16),
                     "record"_.Bind(false), "async_reset"_.Bind(false),
+                    "async_reset_threads"_.Bind(0),
+                    "resim_interval"_.Bind(16), "resim_capacity"_.Bind(32),
+                    "resim_threads"_.Bind(1),
                     "greedy_reward"_.Bind(true), "timeout"_.Bind(600),
-                    "oppo_info"_.Bind(false), "max_steps"_.Bind(1000));
+                    "oppo_info"_.Bind(false), "max_steps"_.Bind(1000),
+                    "packed_obs"_.Bind(false));
   }
   template <typename Config>
   static decltype(auto) StateSpec(const Config &conf) {
     int n_action_feats = 12;
+    bool packed = conf["packed_obs"_];
     return MakeDict(
-        "obs:cards_"_.Bind(Spec<uint8_t>({conf["max_cards"_] * 2, 41})),
+        "obs:cards_"_.Bind(Spec<uint8_t>(
+            {conf["max_cards"_] * 2,
+             packed ? PACKED_CARD_FEATURE_DIM : CARD_FEATURE_DIM})),
         "obs:global_"_.Bind(Spec<uint8_t>({23})),
         "obs:actions_"_.Bind(
             Spec<uint8_t>({conf["max_options"_], n_action_feats})),
         "obs:h_actions_"_.Bind(
             Spec<uint8_t>({conf["n_history_actions"_], n_action_feats + 2})),
-        "obs:mask_"_.Bind(Spec<uint8_t>({conf["max_cards"_] * 2, 14})),
+        "obs:mask_"_.Bind(Spec<uint8_t>(
+            {conf["max_cards"_] * 2,
+             packed ? PACKED_MASK_FEATURE_DIM : MASK_FEATURE_DIM})),
         "info:num_options"_.Bind(Spec<int>({}, {0, conf["max_options"_] - 1})),
         "info:to_play"_.Bind(Spec<int>({}, {0, 1})),
         "info:is_selfplay"_.Bind(Spec<int>({}, {0, 1})),
@@ -1647,6 +2055,80 @@ inline std::vector<PlayMode> parse_play_modes(const std::string &play_mode) {
 constexpr int32_t rules_ = 5;
 constexpr int32_t duel_options_ = ((rules_ & 0xFF) << 16) + (0 & 0xFFFF);
 
+// Responses of a duel in the encoding of replays, the size and the bytes of
+// each, with a hash of every prefix to look up shared prefixes.
+class ResponseLog {
+public:
+  static constexpr uint64_t kHashBasis = 0xcbf29ce484222325ULL;
+  static constexpr int kMaxSize = 255;
+
+  void clear() {
+    data_.clear();
+    offsets_.clear();
+    hashes_.clear();
+  }
+
+  void add(const byte *buf, int size) {
+    // the size is kept in a byte
+    assert((size >= 0) && (size <= kMaxSize));
+    uint64_t h = prefix_hash(offsets_.size());
+    offsets_.push_back(data_.size());
+    data_.push_back(static_cast<byte>(size));
+    data_.insert(data_.end(), buf, buf + size);
+    // FNV-1a over the size and bytes
+    for (std::size_t i = offsets_.back(); i < data_.size(); ++i) {
+      h = (h ^ data_[i]) * 0x100000001b3ULL;
+    }
+    hashes_.push_back(h);
+  }
+
+  std::size_t size() const { return offsets_.size(); }
+
+  const byte *data(std::size_t i) const { return &data_[offsets_[i] + 1]; }
+
+  int size(std::size_t i) const { return data_[offsets_[i]]; }
+
+  // hash of the first n responses
+  uint64_t prefix_hash(std::size_t n) const {
+    return n == 0 ? kHashBasis : hashes_[n - 1];
+  }
+
+  ResponseLog prefix(std::size_t n) const {
+    ResponseLog log;
+    std::size_t end = n < size() ? offsets_[n] : data_.size();
+    log.data_.assign(data_.begin(), data_.begin() + end);
+    log.offsets_.assign(offsets_.begin(), offsets_.begin() + n);
+    log.hashes_.assign(hashes_.begin(), hashes_.begin() + n);
+    return log;
+  }
+
+private:
+  std::vector<byte> data_;
+  std::vector<uint32_t> offsets_;
+  std::vector<uint64_t> hashes_;
+};
+
+// The duel an episode starts from, shared by all snapshots taken in the
+// episode. pduel of the duel is unused.
+struct DuelStart {
+  MDuel duel;
+};
+
+class YGOProEnvImpl;
+class DuelResimulator;
+
+// A position of a duel. ygopro-core can't copy a duel (its lua state), but a
+// duel is fully determined by its seed, decks and responses. So the env is
+// copied without its duel, which is rebuilt from the responses in the log of
+// the copy by a DuelResimulator. Any actions after those of the copy are then
+// stepped through the env, e.g. to a leaf of a search from the snapshot.
+struct DuelSnapshot {
+  std::shared_ptr<const DuelStart> start;
+  std::vector<int> actions;
+  // taken after a prefix of actions, see YGOProEnvImpl::restore
+  std::shared_ptr<const YGOProEnvImpl> state;
+};
+
 
 class YGOProEnvImpl {
 protected:
@@ -1681,9 +2163,21 @@ protected:
   intptr_t pduel_ = 0;
   std::unique_ptr<Player> players_[2]; //  abstract class must be pointer
 
+  // start of the episode and actions passed to step since, see DuelSnapshot
+  std::shared_ptr<const DuelStart> duel_start_;
+  std::vector<int> step_log_;
+  // responses to the engine in the episode, see DuelResimulator
+  ResponseLog response_log_;
+
   std::uniform_int_distribution<uint64_t> dist_int_;
   bool done_{true};
   long step_count_{0};
+  // mean and max time of the steps in this episode, in seconds
+  double step_time_{0};
+  double step_time_max_{0};
+  long step_time_count_{0};
+  // latency stat keys of the step time by the deck of the acting player
+  std::size_t deck_step_keys_[2] = {0, 0};
   bool duel_started_{false};
   uint32_t eng_flag_{0};
 
@@ -1701,7 +2195,9 @@ protected:
   int msg_;
   std::vector<LegalAction> legal_actions_;
   PlayerId to_play_;
-  std::function<void(int)> callback_;
+  // takes the env instead of capturing this, so that it stays valid in a
+  // copy of the env, see DuelSnapshot
+  std::function<void(YGOProEnvImpl &, int)> callback_;
 
   byte data_[4096];
   int dp_ = 0;
@@ -1710,9 +2206,23 @@ protected:
   byte query_buf_[4096];
   int qdp_ = 0;
 
+  // field mirror, cards of each player and location (indexed by bit) as
+  // returned by get_cards_in_location, see field_cards
+  std::vector<Card> field_cards_[2][7];
+  bool field_dirty_[2][7];
+
   byte resp_buf_[128];
 
-  using IdleCardSpec = std::tuple<CardCode, std::string, uint32_t>;
+  using IdleCardSpec = std::tuple<CardCode, SpecKey, uint32_t>;
+
+  // scratch buffers of the message handlers, reused to avoid allocations
+  std::vector<IdleCardSpec> card_specs_[6];
+  std::vector<SpecKey> select_specs_;
+  std::vector<CardCode> select_codes_;
+  std::vector<uint32_t> select_descs_;
+  std::vector<int> select_params_;
+  // flat weights of the cards of a sum selection, see SubsetSum::init
+  std::vector<int> select_weights_, select_offsets_;
 
   // chain
   PlayerId chaining_player_;
@@ -1725,7 +2235,10 @@ protected:
   int ha_p_1_ = 0;
   int ha_p_2_ = 0;
 
-  std::unordered_set<std::string> revealed_;
+  ankerl::unordered_dense::set<SpecKey> revealed_;
+
+  // filled when writing the cards of the observation
+  SpecInfos spec_infos_;
 
   // multi select
   int ms_idx_ = -1;
@@ -1733,9 +2246,9 @@ protected:
   int ms_min_ = 0;
   int ms_max_ = 0;
   int ms_must_ = 0;
-  std::vector<std::string> ms_specs_;
-  std::vector<std::vector<int>> ms_combs_;
-  ankerl::unordered_dense::map<std::string, int> ms_spec2idx_;
+  std::vector<SpecKey> ms_specs_;
+  SubsetSum ms_sum_;
+  ankerl::unordered_dense::map<SpecKey, int> ms_spec2idx_;
   std::vector<int> ms_r_idxs_;
 
   // discard hand cards
@@ -1753,6 +2266,10 @@ protected:
 
   std::mt19937 duel_gen_;
 
+  // async reset, the duel for the next reset is created, shuffled and
+  // started by duel_builder while the current one is played
+  const bool async_reset_;
+  std::future<MDuel> next_duel_;
 
 public:
   // step return
@@ -1768,7 +2285,12 @@ public:
         play_modes_(parse_play_modes(spec.config["play_mode"_])),
         verbose_(spec.config["verbose"_]), record_(spec.config["record"_]),
         n_history_actions_(spec.config["n_history_actions"_]),
-        greedy_reward_(spec.config["greedy_reward"_]) {
+        greedy_reward_(spec.config["greedy_reward"_]),
+        async_reset_(spec.config["async_reset"_]) {
+    if (async_reset_) {
+      // sizes the builder if this is the first env using it
+      duel_builder(spec.config["async_reset_threads"_]);
+    }
     if (record_) {
       if (!verbose_) {
         throw std::runtime_error("record mode must be used with verbose mode and num_envs=1");
@@ -1780,19 +2302,57 @@ public:
     duel_gen_ = std::mt19937(dist_int_(gen_));
 
     int max_options = spec.config["max_options"_];
-    int n_action_feats = spec.state_spec["obs:actions_"_].shape[1];
-    history_actions_1_ = TArray<uint8_t>(Array(
-        ShapeSpec(sizeof(uint8_t), {n_history_actions_, n_action_feats + 2})));
-    history_actions_2_ = TArray<uint8_t>(Array(
-        ShapeSpec(sizeof(uint8_t), {n_history_actions_, n_action_feats + 2})));
+    history_actions_1_ = new_history_actions();
+    history_actions_2_ = new_history_actions();
+
+    // enough for most messages, legal actions are cleared but never shrunk
+    legal_actions_.reserve(std::max(max_options, 64) * 2);
+  }
+
+  // Only needed by std::vector, impls are never moved once reset is called
+  YGOProEnvImpl(YGOProEnvImpl &&) = default;
+
+  // The episode of other without its duel, only to be restored from, see
+  // DuelSnapshot
+  YGOProEnvImpl(const YGOProEnvImpl &other)
+      : spec_(other.spec_), deck1_(other.deck1_), deck2_(other.deck2_),
+        play_modes_(other.play_modes_), player_(other.player_),
+        verbose_(other.verbose_), dist_int_(0, 0xffffffff),
+        greedy_reward_(other.greedy_reward_),
+        n_history_actions_(other.n_history_actions_),
+        async_reset_(other.async_reset_) {
+    history_actions_1_ = new_history_actions();
+    history_actions_2_ = new_history_actions();
+    copy_episode(other);
+  }
+
+  ~YGOProEnvImpl() {
+    // the builder task refers to this impl, so it must finish first
+    if (next_duel_.valid()) {
+      try {
+        YGO_EndDuel(next_duel_.get().pduel);
+      } catch (const std::exception &e) {
+        fmt::println("[~YGOProEnvImpl] Next duel failed: {}", e.what());
+      } catch (...) {
+        fmt::println("[~YGOProEnvImpl] Next duel failed");
+      }
+    }
   }
 
   int max_options() const { return spec_.config["max_options"_]; }
 
   int max_cards() const { return spec_.config["max_cards"_]; }
 
+  bool packed_obs() const { return spec_.config["packed_obs"_]; }
+
   bool done() const { return done_; }
 
+  PlayerId to_play() const { return to_play_; }
+
+  // legal actions of the current decision, at most max_options once the
+  // state is written
+  int num_options() const { return legal_actions_.size(); }
+
   bool random_mode() const { return play_modes_.size() > 1; }
 
   bool self_play() const {
@@ -1800,10 +2360,11 @@ public:
            play_modes_.end();
   }
 
-  void update_time_stat(const clock_t& start, uint64_t time_count, double& time_stat) {
-    double seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
-    time_stat = time_stat * (static_cast<double>(time_count) /
-      (time_count + 1)) + seconds / (time_count + 1);
+  void update_time_stat(double seconds) {
+    step_time_ = step_time_ * (static_cast<double>(step_time_count_) /
+      (step_time_count_ + 1)) + seconds / (step_time_count_ + 1);
+    step_time_max_ = std::max(step_time_max_, seconds);
+    step_time_count_++;
   }
 
   // void update_time_stat(const std::string& deck, double seconds) {
@@ -1835,6 +2396,36 @@ public:
     return mduel;
   }
 
+  // The duel of mduel created again, with the same seed and deck order
+  static intptr_t rebuild_duel(const MDuel &mduel) {
+    auto pduel = YGO_CreateDuel(mduel.seed);
+    for (PlayerId i = 0; i < 2; i++) {
+      YGO_SetPlayerInfo(pduel, i, init_lp_, startcount_, drawcount_);
+      if (i == 0) {
+        add_deck(pduel, i, mduel.main_deck0, mduel.extra_deck0);
+      } else {
+        add_deck(pduel, i, mduel.main_deck1, mduel.extra_deck1);
+      }
+    }
+    YGO_StartDuel(pduel, duel_options_);
+    return pduel;
+  }
+
+  static void destroy_duel(intptr_t pduel) { YGO_EndDuel(pduel); }
+
+  // Ends old_duel (if any) and builds the duel for the next reset on
+  // duel_builder. duel_gen_ is only used by the builder until next_duel_ is
+  // collected in reset.
+  void prepare_next_duel(intptr_t old_duel) {
+    uint32_t seed = dist_int_(gen_);
+    next_duel_ = duel_builder().enqueue([this, old_duel, seed]() {
+      if (old_duel != 0) {
+        YGO_EndDuel(old_duel);
+      }
+      return new_duel(seed);
+    });
+  }
+
   void reset() {
     // clock_t start = clock();
 
@@ -1852,47 +2443,31 @@ public:
       }
     }
 
-    turn_count_ = 0;
-    ms_idx_ = -1;
-
-    history_actions_1_.Zero();
-    history_actions_2_.Zero();
-    ha_p_1_ = 0;
-    ha_p_2_ = 0;
-
     // clock_t _start = clock();
 
-    intptr_t old_duel = pduel_;
-    if (duel_started_) {
-      YGO_EndDuel(pduel_);
-    }
+    intptr_t old_duel = duel_started_ ? pduel_ : 0;
     MDuel mduel;
-    mduel = new_duel(dist_int_(gen_));
+    if (async_reset_ && next_duel_.valid()) {
+      mduel = next_duel_.get();
+    } else {
+      if (old_duel != 0) {
+        YGO_EndDuel(old_duel);
+        old_duel = 0;
+      }
+      mduel = new_duel(dist_int_(gen_));
+    }
 
     auto duel_seed = mduel.seed;
-    pduel_ = mduel.pduel;
+    uint32_t player_seeds[2] = {0, 0};
+    if (play_mode_ == kRandomBot) {
+      for (PlayerId i = 0; i < 2; i++) {
+        player_seeds[i] = dist_int_(gen_);
+      }
+    }
+    start_episode(mduel, player_seeds);
 
-    deck_name_[0] = mduel.deck_name0;
-    deck_name_[1] = mduel.deck_name1;
-    main_deck0_ = mduel.main_deck0;
-    extra_deck0_ = mduel.extra_deck0;
-    main_deck1_ = mduel.main_deck1;
-    extra_deck1_ = mduel.extra_deck1;
-
-    for (PlayerId i = 0; i < 2; i++) {
-      std::string nickname = i == 0 ? "Alice" : "Bob";
-      if (i == ai_player_) {
-        nickname = "Agent";
-      }
-      nickname_[i] = nickname;
-      if ((play_mode_ == kHuman) && (i != ai_player_)) {
-        players_[i] = std::make_unique<HumanPlayer>(nickname, init_lp_, i, verbose_);
-      } else if (play_mode_ == kRandomBot) {
-        players_[i] = std::make_unique<RandomAI>(max_options(), dist_int_(gen_), nickname, init_lp_, i, verbose_);
-      } else {
-        players_[i] = std::make_unique<GreedyAI>(nickname, init_lp_, i, verbose_);
-      }
-      lp_[i] = players_[i]->init_lp_;
+    if (async_reset_) {
+      prepare_next_duel(old_duel);
     }
 
     if (record_) {
@@ -1960,6 +2535,58 @@ public:
 
     }
 
+    mduel.pduel = 0;
+    duel_start_ = std::make_shared<const DuelStart>(DuelStart{std::move(mduel)});
+
+    // update_time_stat(_start, reset_time_count_, reset_time_2_);
+    // _start = clock();
+
+    next();
+
+    ret_reward_ = 0;
+    ret_win_reason_ = 0;
+  }
+
+  // Env side state of a new episode on the started duel of mduel, shared by
+  // reset and restore
+  void start_episode(const MDuel &mduel, const uint32_t player_seeds[2]) {
+    turn_count_ = 0;
+    ms_idx_ = -1;
+    mark_field_dirty();
+
+    history_actions_1_.Zero();
+    history_actions_2_.Zero();
+    ha_p_1_ = 0;
+    ha_p_2_ = 0;
+
+    pduel_ = mduel.pduel;
+
+    deck_name_[0] = mduel.deck_name0;
+    deck_name_[1] = mduel.deck_name1;
+    for (int i = 0; i < 2; i++) {
+      deck_step_keys_[i] = LatencyKeys::Get("step_by_deck/" + deck_name_[i]);
+    }
+    main_deck0_ = mduel.main_deck0;
+    extra_deck0_ = mduel.extra_deck0;
+    main_deck1_ = mduel.main_deck1;
+    extra_deck1_ = mduel.extra_deck1;
+
+    for (PlayerId i = 0; i < 2; i++) {
+      std::string nickname = i == 0 ? "Alice" : "Bob";
+      if (i == ai_player_) {
+        nickname = "Agent";
+      }
+      nickname_[i] = nickname;
+      if ((play_mode_ == kHuman) && (i != ai_player_)) {
+        players_[i] = std::make_unique<HumanPlayer>(nickname, init_lp_, i, verbose_);
+      } else if (play_mode_ == kRandomBot) {
+        players_[i] = std::make_unique<RandomAI>(max_options(), player_seeds[i], nickname, init_lp_, i, verbose_);
+      } else {
+        players_[i] = std::make_unique<GreedyAI>(nickname, init_lp_, i, verbose_);
+      }
+      lp_[i] = players_[i]->init_lp_;
+    }
+
     duel_started_ = true;
     eng_flag_ = 0;
     winner_ = 255;
@@ -1968,19 +2595,149 @@ public:
 
     done_ = false;
     step_count_ = 0;
+    step_time_ = 0;
+    step_time_max_ = 0;
+    step_time_count_ = 0;
+    step_log_.clear();
+    response_log_.clear();
+  }
 
-    // update_time_stat(_start, reset_time_count_, reset_time_2_);
-    // _start = clock();
-
-    next();
+  TArray<uint8_t> new_history_actions() const {
+    int n_action_feats = spec_.state_spec["obs:actions_"_].shape[1];
+    return TArray<uint8_t>(Array(
+        ShapeSpec(sizeof(uint8_t), {n_history_actions_, n_action_feats + 2})));
+  }
 
-    ret_reward_ = 0;
-    ret_win_reason_ = 0;
+  // Env side state of the episode of other, an impl of the same spec. The
+  // duel, the duel being built for the next reset with duel_gen_ and the
+  // replay file stay those of this impl.
+  void copy_episode(const YGOProEnvImpl &other) {
+    main_deck0_ = other.main_deck0_;
+    main_deck1_ = other.main_deck1_;
+    extra_deck0_ = other.extra_deck0_;
+    extra_deck1_ = other.extra_deck1_;
+    for (int i = 0; i < 2; ++i) {
+      deck_name_[i] = other.deck_name_[i];
+      nickname_[i] = other.nickname_[i];
+      players_[i] =
+          other.players_[i] == nullptr ? nullptr : other.players_[i]->clone();
+      deck_step_keys_[i] = other.deck_step_keys_[i];
+      lp_[i] = other.lp_[i];
+    }
+    play_mode_ = other.play_mode_;
+    ai_player_ = other.ai_player_;
+
+    duel_start_ = other.duel_start_;
+    step_log_ = other.step_log_;
+    response_log_ = other.response_log_;
+
+    done_ = other.done_;
+    step_count_ = other.step_count_;
+    step_time_ = other.step_time_;
+    step_time_max_ = other.step_time_max_;
+    step_time_count_ = other.step_time_count_;
+    eng_flag_ = other.eng_flag_;
+    winner_ = other.winner_;
+    win_reason_ = other.win_reason_;
+    tp_ = other.tp_;
+    current_phase_ = other.current_phase_;
+    turn_count_ = other.turn_count_;
+
+    msg_ = other.msg_;
+    legal_actions_ = other.legal_actions_;
+    to_play_ = other.to_play_;
+    callback_ = other.callback_;
+    // the rest of the last message, handled by the next step
+    std::memcpy(data_, other.data_, sizeof(data_));
+    dp_ = other.dp_;
+    dl_ = other.dl_;
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 0; j < 7; ++j) {
+        field_cards_[i][j] = other.field_cards_[i][j];
+        field_dirty_[i][j] = other.field_dirty_[i][j];
+      }
+    }
+    for (int i = 0; i < 6; ++i) {
+      card_specs_[i] = other.card_specs_[i];
+    }
+    select_specs_ = other.select_specs_;
+    select_codes_ = other.select_codes_;
+    select_descs_ = other.select_descs_;
+    select_params_ = other.select_params_;
+    select_weights_ = other.select_weights_;
+    select_offsets_ = other.select_offsets_;
+    chaining_player_ = other.chaining_player_;
+
+    history_actions_1_.Assign(other.history_actions_1_);
+    history_actions_2_.Assign(other.history_actions_2_);
+    ha_p_1_ = other.ha_p_1_;
+    ha_p_2_ = other.ha_p_2_;
+    revealed_ = other.revealed_;
+    spec_infos_ = other.spec_infos_;
+
+    ms_idx_ = other.ms_idx_;
+    ms_mode_ = other.ms_mode_;
+    ms_min_ = other.ms_min_;
+    ms_max_ = other.ms_max_;
+    ms_must_ = other.ms_must_;
+    ms_specs_ = other.ms_specs_;
+    ms_sum_ = other.ms_sum_;
+    ms_spec2idx_ = other.ms_spec2idx_;
+    ms_r_idxs_ = other.ms_r_idxs_;
+
+    discard_hand_ = other.discard_hand_;
+    n_counters_ = other.n_counters_;
+    gen_ = other.gen_;
+    ret_reward_ = other.ret_reward_;
+    ret_win_reason_ = other.ret_win_reason_;
+  }
+
+  DuelSnapshot snapshot() const {
+    if (done_ || (duel_start_ == nullptr)) {
+      throw std::runtime_error("No duel in progress to snapshot");
+    }
+    if (play_mode_ == kHuman) {
+      throw std::runtime_error("Snapshot is not supported in human mode");
+    }
+    return {duel_start_, step_log_, std::make_shared<const YGOProEnvImpl>(*this)};
+  }
+
+  // Number of actions of the snapshot already taken in the current duel, if
+  // it is an earlier position of the same one, or -1
+  int resume_steps(const DuelSnapshot &snapshot) const {
+    const auto &actions = snapshot.actions;
+    bool resume = !done_ && (duel_start_ == snapshot.start) &&
+                  (step_log_.size() <= actions.size()) &&
+                  std::equal(step_log_.begin(), step_log_.end(),
+                             actions.begin());
+    return resume ? static_cast<int>(step_log_.size()) : -1;
+  }
+
+  // Steps to the position of the snapshot. The current duel is continued if
+  // it is an earlier position of the same one, e.g. when a search goes deeper
+  // from the root. Otherwise the env state of the snapshot is copied and its
+  // duel is taken from resim, which only replays the responses after its
+  // nearest checkpoint in the engine. Defined after DuelResimulator.
+  void restore(const DuelSnapshot &snapshot, DuelResimulator &resim);
+
+  // Draws new streams for the env rng and the random players from the
+  // current ones mixed with salt, so that the duels restored from one
+  // snapshot go on differently.
+  void reseed(uint64_t salt) {
+    std::seed_seq seq{static_cast<uint32_t>(gen_()),
+                      static_cast<uint32_t>(salt),
+                      static_cast<uint32_t>(salt >> 32)};
+    gen_.seed(seq);
+    for (auto &player : players_) {
+      if (player != nullptr) {
+        player->seed(dist_int_(gen_));
+      }
+    }
   }
 
   void init_multi_select(
-    int min, int max, int must, const std::vector<std::string> &specs,
-    int mode = 0, const std::vector<std::vector<int>> &combs = {}) {
+    int min, int max, int must, const std::vector<SpecKey> &specs,
+    int mode = 0) {
     ms_idx_ = 0;
     ms_mode_ = mode;
     ms_min_ = min;
@@ -1991,17 +2748,14 @@ public:
     ms_spec2idx_.clear();
 
     for (int j = 0; j < ms_specs_.size(); ++j) {
-      const auto &spec = ms_specs_[j];
-      ms_spec2idx_[spec] = j;
+      ms_spec2idx_[ms_specs_[j]] = j;
     }
 
     if (ms_mode_ == 0) {
       for (int j = 0; j < ms_specs_.size(); ++j) {
-        const auto &spec = ms_specs_[j];
-        legal_actions_.push_back(LegalAction::from_spec(spec));
+        legal_actions_.push_back(LegalAction::from_spec(ms_specs_[j]));
       }
     } else {
-      ms_combs_ = combs;
       _callback_multi_select_2_prepare();
     }
   }
@@ -2019,28 +2773,28 @@ public:
         if (ms_idx_ >= ms_min_) {
           legal_actions_.push_back(LegalAction::finish());
         }
-        callback_ = [this](int idx) {
-          _callback_multi_select(idx, true);
+        callback_ = [](YGOProEnvImpl &env, int idx) {
+          env._callback_multi_select(idx, true);
         };
       } else if (ms_idx_ >= ms_min_) {
         legal_actions_.push_back(LegalAction::finish());
-        callback_ = [this](int idx) {
-          _callback_multi_select(idx, false);
+        callback_ = [](YGOProEnvImpl &env, int idx) {
+          env._callback_multi_select(idx, false);
         };
       } else {
-        callback_ = [this](int idx) {
-          _callback_multi_select(idx, false);
+        callback_ = [](YGOProEnvImpl &env, int idx) {
+          env._callback_multi_select(idx, false);
         };    
       }
     } else {
       _callback_multi_select_2_prepare();
-      callback_ = [this](int idx) {
-        _callback_multi_select_2(idx);
+      callback_ = [](YGOProEnvImpl &env, int idx) {
+        env._callback_multi_select_2(idx);
       };
     }
   }
 
-  int get_ms_spec_idx(const std::string &spec) const {
+  int get_ms_spec_idx(SpecKey spec) const {
     auto it = ms_spec2idx_.find(spec);
     if (it != ms_spec2idx_.end()) {
       return it->second;
@@ -2051,10 +2805,10 @@ public:
     show_deck(1);
     show_buffer();
     show_turn();
-    fmt::println("MS: idx: {}, mode: {}, min: {}, max: {}, must: {}, specs: {}, combs: {}, r_idx: {}", ms_idx_, ms_mode_, ms_min_, ms_max_, ms_must_, ms_specs_, ms_combs_, ms_r_idxs_);
+    fmt::println("MS: idx: {}, mode: {}, min: {}, max: {}, must: {}, specs: {}, next: {}, r_idx: {}", ms_idx_, ms_mode_, ms_min_, ms_max_, ms_must_, spec_keys_to_strings(ms_specs_), ms_sum_.next_picks(), ms_r_idxs_);
     fmt::print("ms_spec2idx: ");
     for (const auto &[k, v] : ms_spec2idx_) {
-      fmt::print("({}, {}), ", k, v);
+      fmt::print("({}, {}), ", spec_key_to_string(k), v);
     }
     fmt::print("\n");
     return -1;
@@ -2068,37 +2822,25 @@ public:
       // TODO(2): find the root cause
       std::vector<std::string> specs;
       for (const auto &la : legal_actions_) {
-        specs.push_back(la.spec_);
+        specs.push_back(spec_key_to_string(la.spec_));
       }
-      fmt::println("specs: {}, idx: {}, spec: {}", specs, idx, action.spec_);
+      fmt::println("specs: {}, idx: {}, spec: {}", specs, idx, spec_key_to_string(action.spec_));
       throw std::runtime_error("Spec not found");
     }
     ms_r_idxs_.push_back(idx);
-    std::vector<std::vector<int>> combs;
-    for (auto &c : ms_combs_) {
-      if (c[0] == idx) {
-        c.erase(c.begin());
-        if (c.empty()) {
-          // TODO: maybe finish too early
-          _callback_multi_select_2_finish();
-          return;
-        } else {
-          combs.push_back(c);
-        }
-      }
+    if (ms_sum_.pick(idx)) {
+      // TODO: maybe finish too early
+      _callback_multi_select_2_finish();
+      return;
     }
     ms_idx_++;
-    ms_combs_ = combs;
   }
 
   void _callback_multi_select_2_prepare() {
-    std::set<int> comb;
-    for (const auto &c : ms_combs_) {
-      comb.insert(c[0]);
-    }
-    for (auto &i : comb) {
-      const auto &spec = ms_specs_[i];
-      legal_actions_.push_back(LegalAction::from_spec(spec));
+    for (int i = 0; i < ms_sum_.size(); ++i) {
+      if (ms_sum_.can_pick(i)) {
+        legal_actions_.push_back(LegalAction::from_spec(ms_specs_[i]));
+      }
     }
   }
 
@@ -2127,9 +2869,9 @@ public:
         // TODO(2): find the root cause
         std::vector<std::string> specs;
         for (const auto &la : legal_actions_) {
-          specs.push_back(la.spec_);
+          specs.push_back(spec_key_to_string(la.spec_));
         }
-        fmt::println("specs: {}, idx: {}, spec: {}", specs, idx, action.spec_);
+        fmt::println("specs: {}, idx: {}, spec: {}", specs, idx, spec_key_to_string(action.spec_));
         ms_idx_ = -1;
         resp_buf_[0] = ms_min_;
         for (int i = 0; i < ms_min_; ++i) {
@@ -2217,7 +2959,10 @@ public:
   }
 
   void step(int idx) {
-    callback_(idx);
+    LatencyTimer timer(decision_keys_[msg_ & 0xff]);
+    std::size_t deck_key = deck_step_keys_[to_play_];
+    step_log_.push_back(idx);
+    callback_(*this, idx);
     update_history_actions(to_play_, legal_actions_[idx]);
 
     PlayerId player = to_play_;
@@ -2301,25 +3046,9 @@ public:
     }
 
 
-    // update_time_stat(start, step_time_count_, step_time_);
-    // step_time_count_++;
-
-    // double step_time = 0;
-    // if (done_) {
-    //   step_time = step_time_;
-    //   step_time_ = 0;
-    //   step_time_count_ = 0;
-    // }
-
-    // if (done_) {
-    //   update_time_stat(deck_name_[0], step_time_);
-    //   update_time_stat(deck_name_[1], step_time_);
-    //   step_time_ = 0;
-    //   step_time_count_ = 0;
-    // }
-    // if (step_time_count_ % 3000 == 0) {
-    //   fmt::println("Step time: {:.3f}", step_time_ * 1000);
-    // }
+    uint64_t ns = timer.Elapsed();
+    LatencyRecorder::Record(deck_key, ns);
+    update_time_stat(ns / 1e9);
     ret_reward_ = reward;
     ret_win_reason_ = reason;
   }
@@ -2330,6 +3059,7 @@ public:
            typename SpecToTArray<typename YGOProEnvSpec::StateSpec::Values>::Type>;
 
   void WriteState(State &state) {
+    LatencyTimer timer(encode_key_);
     float reward = ret_reward_;
     int win_reason = ret_win_reason_;
     int n_options = legal_actions_.size();
@@ -2338,8 +3068,8 @@ public:
     state["info:is_selfplay"_] = int(play_mode_ == kSelfPlay);
     state["info:win_reason"_] = win_reason;
     if (reward != 0.0) {
-      state["info:step_time"_][0] = 0;
-      state["info:step_time"_][1] = 0;
+      state["info:step_time"_][0] = step_time_;
+      state["info:step_time"_][1] = step_time_max_;
       state["info:deck"_][0] = deck_names_ids_[deck_name_[0]];
       state["info:deck"_][1] = deck_names_ids_[deck_name_[1]];
     }
@@ -2353,18 +3083,13 @@ public:
       return;
     }
 
-    SpecInfos spec_infos;
     std::vector<int> loc_n_cards;
 
     if (spec_.config["oppo_info"_]) {
       _set_obs_g_cards(state["obs:cards_"_], to_play_);
-      auto [spec_infos_, loc_n_cards_] = _set_obs_mask(state["obs:mask_"_], to_play_);
-      spec_infos = spec_infos_;
-      loc_n_cards = loc_n_cards_;
+      loc_n_cards = _set_obs_mask(state["obs:mask_"_], to_play_);
     } else {
-      auto [spec_infos_, loc_n_cards_] = _set_obs_cards(state["obs:cards_"_], to_play_);
-      spec_infos = spec_infos_;
-      loc_n_cards = loc_n_cards_;
+      loc_n_cards = _set_obs_cards(state["obs:cards_"_], to_play_);
     }
 
     _set_obs_global(state["obs:global_"_], to_play_, loc_n_cards);
@@ -2380,9 +3105,9 @@ public:
     for (int i = 0; i < n_options; ++i) {
       auto &action = legal_actions_[i];
       action.msg_ = msg_;
-      const auto &spec = action.spec_;
-      if (!spec.empty()) {
-        const auto& spec_info = find_spec_info(spec_infos, spec);
+      const auto spec = action.spec_;
+      if (spec != 0) {
+        const auto& spec_info = find_spec_info(spec);
         action.spec_index_ = spec_info.index;
         if (action.cid_ == 0) {
           action.cid_ = spec_info.cid;
@@ -2416,10 +3141,8 @@ public:
   }
 
 private:
-  using SpecInfos = ankerl::unordered_dense::map<std::string, SpecInfo>;
-
-  std::tuple<SpecInfos, std::vector<int>> _set_obs_cards(TArray<uint8_t> &f_cards, PlayerId to_play) {
-    SpecInfos spec_infos;
+  std::vector<int> _set_obs_cards(TArray<uint8_t> &f_cards, PlayerId to_play) {
+    spec_infos_.clear();
     std::vector<int> loc_n_cards;
     int offset = 0;
     for (auto pi = 0; pi < 2; pi++) {
@@ -2439,18 +3162,21 @@ private:
         if (opponent && hidden_for_opponent) {
           auto n_cards = YGO_QueryFieldCount(pduel_, player, location);
           loc_n_cards.push_back(n_cards);
+          // only the location and the controller are known
+          std::array<uint8_t, CARD_FEATURE_DIM> row{};
+          row[2] = location_to_id(location);
+          row[4] = 1;
           for (auto i = 0; i < n_cards; i++) {
-            f_cards(offset, 2) = location_to_id(location);
-            f_cards(offset, 4) = 1;
+            _write_card_row(f_cards, offset, row);
             offset++;
           }
         } else {
-          std::vector<Card> cards = get_cards_in_location(player, location);
+          const auto &cards = field_cards(player, location);
           int n_cards = cards.size();
           loc_n_cards.push_back(n_cards);
           for (int i = 0; i < n_cards; ++i) {
             const auto &c = cards[i];
-            auto spec = c.get_spec(opponent);
+            auto spec = c.get_spec_key(opponent);
             bool hide = false;
             if (opponent) {
               hide = c.position_ & POS_FACEDOWN;
@@ -2460,17 +3186,17 @@ private:
             }
             CardId card_id = 0;
             if (!hide) {
-              card_id = c_get_card_id(c.code_);
+              card_id = c.id();
             }
             _set_obs_card_(f_cards, offset, c, hide);
             offset++;
 
-            spec_infos[spec] = {static_cast<uint16_t>(offset), card_id};
+            spec_infos_.set(spec, {static_cast<uint16_t>(offset), card_id});
           }
         }
       }
     }
-    return {spec_infos, loc_n_cards};
+    return loc_n_cards;
   }
 
   void _set_obs_g_cards(TArray<uint8_t> &f_cards, PlayerId to_play) {
@@ -2483,11 +3209,11 @@ private:
           LOCATION_EXTRA,
       };
       for (auto location : configs) {
-        std::vector<Card> cards = get_cards_in_location(player, location);
+        const auto &cards = field_cards(player, location);
         int n_cards = cards.size();
         for (int i = 0; i < n_cards; ++i) {
           const auto &c = cards[i];
-          CardId card_id = c_get_card_id(c.code_);
+          CardId card_id = c.id();
           _set_obs_card_(f_cards, offset, c, false, card_id, false);
           offset++;
           if (offset == (spec_.config["max_cards"_] * 2 - 1)) {
@@ -2498,8 +3224,8 @@ private:
     }
   }
 
-  std::tuple<SpecInfos, std::vector<int>> _set_obs_mask(TArray<uint8_t> &mask, PlayerId to_play) {
-    SpecInfos spec_infos;
+  std::vector<int> _set_obs_mask(TArray<uint8_t> &mask, PlayerId to_play) {
+    spec_infos_.clear();
     std::vector<int> loc_n_cards;
     int offset = 0;
     for (auto pi = 0; pi < 2; pi++) {
@@ -2520,17 +3246,16 @@ private:
           auto n_cards = YGO_QueryFieldCount(pduel_, player, location);
           loc_n_cards.push_back(n_cards);
           for (auto i = 0; i < n_cards; i++) {
-            mask(offset, 1) = 1;
-            mask(offset, 3) = 1;
+            _write_mask_row(mask, offset, (1 << 1) | (1 << 3));
             offset++;
           }
         } else {
-          std::vector<Card> cards = get_cards_in_location(player, location);
+          const auto &cards = field_cards(player, location);
           int n_cards = cards.size();
           loc_n_cards.push_back(n_cards);
           for (int i = 0; i < n_cards; ++i) {
             const auto &c = cards[i];
-            auto spec = c.get_spec(opponent);
+            auto spec = c.get_spec_key(opponent);
             bool hide = false;
             if (opponent) {
               hide = c.position_ & POS_FACEDOWN;
@@ -2540,17 +3265,17 @@ private:
             }
             CardId card_id = 0;
             if (!hide) {
-              card_id = c_get_card_id(c.code_);
+              card_id = c.id();
             }
             _set_obs_mask_(mask, offset, c, hide);
             offset++;
 
-            spec_infos[spec] = {static_cast<uint16_t>(offset), card_id};
+            spec_infos_.set(spec, {static_cast<uint16_t>(offset), card_id});
           }
         }
       }
     }
-    return {spec_infos, loc_n_cards};
+    return loc_n_cards;
   }
 
   void _set_obs_card_(TArray<uint8_t> &f_cards, int offset, const Card &c,
@@ -2565,53 +3290,75 @@ private:
       hide = false;
     }
 
+    std::array<uint8_t, CARD_FEATURE_DIM> row{};
     if (!hide) {
-      f_cards(offset, 0) = static_cast<uint8_t>(card_id >> 8);
-      f_cards(offset, 1) = static_cast<uint8_t>(card_id & 0xff);
+      // start from the precomputed row, only the dynamic columns are patched
+      row = cards_features_[c.id_];
+      row[0] = static_cast<uint8_t>(card_id >> 8);
+      row[1] = static_cast<uint8_t>(card_id & 0xff);
     }
-    f_cards(offset, 2) = location_to_id(location);
+    row[2] = location_to_id(location);
 
     uint8_t seq = 0;
     if (location == LOCATION_MZONE || location == LOCATION_SZONE ||
         location == LOCATION_GRAVE) {
       seq = c.sequence_ + 1;
     }
-    f_cards(offset, 3) = seq;
-    f_cards(offset, 4) = global ? c.controler_ : ((c.controler_ != to_play_) ? 1 : 0);
+    row[3] = seq;
+    row[4] = global ? c.controler_ : ((c.controler_ != to_play_) ? 1 : 0);
     if (overlay) {
-      f_cards(offset, 5) = position_to_id(POS_FACEUP);
-      f_cards(offset, 6) = 1;
+      row[5] = position_to_id(POS_FACEUP);
+      row[6] = 1;
     } else {
       if (location == LOCATION_DECK || location == LOCATION_HAND || location == LOCATION_EXTRA) {
         if (hide || (c.position_ & POS_FACEDOWN)) {
-          f_cards(offset, 5) = position_to_id(POS_FACEDOWN);
+          row[5] = position_to_id(POS_FACEDOWN);
         }
         // else {
         //   fmt::println("location: {}, position: {}", location2str.at(location), position_to_string(c.position_));
         // }
       } else {
-        f_cards(offset, 5) = position_to_id(c.position_);
+        row[5] = position_to_id(c.position_);
       }
     }
     if (!hide) {
-      f_cards(offset, 7) = attribute_to_id(c.attribute_);
-      f_cards(offset, 8) = race_to_id(c.race_);
-      f_cards(offset, 9) = c.level_;
-      f_cards(offset, 10) = std::min(c.counter_, static_cast<uint32_t>(15));
-      f_cards(offset, 11) = static_cast<uint8_t>((c.status_ & (STATUS_DISABLED | STATUS_FORBIDDEN)) != 0);
+      row[9] = c.level_;
+      row[10] = std::min(c.counter_, static_cast<uint32_t>(15));
+      row[11] = static_cast<uint8_t>((c.status_ & (STATUS_DISABLED | STATUS_FORBIDDEN)) != 0);
       auto [atk1, atk2] = float_transform(c.attack_);
-      f_cards(offset, 12) = atk1;
-      f_cards(offset, 13) = atk2;
+      row[12] = atk1;
+      row[13] = atk2;
 
       auto [def1, def2] = float_transform(c.defense_);
-      f_cards(offset, 14) = def1;
-      f_cards(offset, 15) = def2;
+      row[14] = def1;
+      row[15] = def2;
+    }
+    _write_card_row(f_cards, offset, row);
+  }
 
-      auto type_ids = type_to_ids(c.type_);
-      for (int j = 0; j < type_ids.size(); ++j) {
-        f_cards(offset, 16 + j) = type_ids[j];
+  void _write_card_row(TArray<uint8_t> &f_cards, int offset,
+                       const std::array<uint8_t, CARD_FEATURE_DIM> &row) {
+    if (!packed_obs()) {
+      f_cards[offset].Assign(row.data(), CARD_FEATURE_DIM);
+      return;
+    }
+    std::array<uint8_t, PACKED_CARD_FEATURE_DIM> packed;
+    int k = 0;
+    for (int j = 0; j < 16; ++j) {
+      if (j != 6 && j != 11) {
+        packed[k++] = row[j];
       }
     }
+    uint32_t bits = 0;
+    for (int j = 16; j < CARD_FEATURE_DIM; ++j) {
+      bits |= static_cast<uint32_t>(row[j] != 0) << (j - 16);
+    }
+    bits |= static_cast<uint32_t>(row[6] != 0) << 25;
+    bits |= static_cast<uint32_t>(row[11] != 0) << 26;
+    for (int b = 0; b < 4; ++b) {
+      packed[k++] = static_cast<uint8_t>(bits >> (8 * b));
+    }
+    f_cards[offset].Assign(packed.data(), PACKED_CARD_FEATURE_DIM);
   }
 
   void _set_obs_mask_(TArray<uint8_t> &mask, int offset, const Card &c,
@@ -2626,40 +3373,56 @@ private:
       hide = false;
     }
 
+    uint16_t bits = 0;
     if (!hide) {
       if (card_id != 0) {
-        mask(offset, 0) = 1;
+        bits |= 1 << 0;
       }
     }
-    mask(offset, 1) = 1;
+    bits |= 1 << 1;
 
     if (location == LOCATION_MZONE || location == LOCATION_SZONE ||
         location == LOCATION_GRAVE) {
-      mask(offset, 2) = 1;
+      bits |= 1 << 2;
     }
-    mask(offset, 3) = 1;
+    bits |= 1 << 3;
     if (overlay) {
-      mask(offset, 4) = 1;
-      mask(offset, 5) = 1;
+      bits |= 1 << 4;
+      bits |= 1 << 5;
     } else {
       if (location == LOCATION_DECK || location == LOCATION_HAND || location == LOCATION_EXTRA) {
         if (hide || (c.position_ & POS_FACEDOWN)) {
-          mask(offset, 4) = 1;
+          bits |= 1 << 4;
         }
       } else {
-        mask(offset, 4) = 1;
+        bits |= 1 << 4;
       }
     }
     if (!hide) {
-      mask(offset, 6) = 1;
-      mask(offset, 7) = 1;
-      mask(offset, 8) = 1;
-      mask(offset, 9) = 1;
-      mask(offset, 10) = 1;
-      mask(offset, 11) = 1;
-      mask(offset, 12) = 1;
-      mask(offset, 13) = 1;
+      bits |= 1 << 6;
+      bits |= 1 << 7;
+      bits |= 1 << 8;
+      bits |= 1 << 9;
+      bits |= 1 << 10;
+      bits |= 1 << 11;
+      bits |= 1 << 12;
+      bits |= 1 << 13;
+    }
+    _write_mask_row(mask, offset, bits);
+  }
+
+  void _write_mask_row(TArray<uint8_t> &mask, int offset, uint16_t bits) {
+    if (packed_obs()) {
+      uint8_t packed[PACKED_MASK_FEATURE_DIM] = {
+          static_cast<uint8_t>(bits & 0xff), static_cast<uint8_t>(bits >> 8)};
+      mask[offset].Assign(packed, PACKED_MASK_FEATURE_DIM);
+      return;
+    }
+    uint8_t row[MASK_FEATURE_DIM];
+    for (int j = 0; j < MASK_FEATURE_DIM; ++j) {
+      row[j] = (bits >> j) & 1;
     }
+    mask[offset].Assign(row, MASK_FEATURE_DIM);
   }
 
   void _set_obs_global(TArray<uint8_t> &feat, PlayerId player, const std::vector<int> &loc_n_cards) {
@@ -2684,26 +3447,22 @@ private:
     }
   }
 
-  const SpecInfo& find_spec_info(SpecInfos &spec_infos, const std::string &spec) {
-    auto it = spec_infos.find(spec);
-    if (it == spec_infos.end()) {
+  const SpecInfo& find_spec_info(SpecKey spec) {
+    static const SpecInfo not_found = {0, 0};
+    auto spec_info = spec_infos_.find(spec);
+    if (spec_info == nullptr) {
       // TODO(2): find the root cause
       // print spec2index
       show_deck(0);
       show_deck(1);
       show_buffer();
       show_turn();
-      fmt::println("MS: idx: {}, mode: {}, min: {}, max: {}, must: {}, specs: {}, combs: {}", ms_idx_, ms_mode_, ms_min_, ms_max_, ms_must_, ms_specs_, ms_combs_);
-      fmt::println("Spec: {}, Spec2index:", spec);
-      for (auto &[k, v] : spec_infos) {
-        fmt::print("{}: {} {}, ", k, v.index, v.cid);
-      }
-      fmt::print("\n");
+      fmt::println("MS: idx: {}, mode: {}, min: {}, max: {}, must: {}, specs: {}, next: {}", ms_idx_, ms_mode_, ms_min_, ms_max_, ms_must_, spec_keys_to_strings(ms_specs_), ms_sum_.next_picks());
+      fmt::println("Spec not found: {}", spec_key_to_string(spec));
       // throw std::runtime_error("Spec not found: " + spec);
-      spec_infos[spec] = {0, 0};
-      return spec_infos[spec];
+      return not_found;
     }
-    return it->second;
+    return *spec_info;
   }
 
   void _set_obs_action_spec(
@@ -2807,15 +3566,12 @@ private:
     }
   }
 
-  CardId spec_to_card_id(const std::string &spec, PlayerId player) {
-    int offset = 0;
-    bool opponent = false;
-    if (spec[0] == 'o') {
-      player = 1 - player;
-      opponent = true;
-      offset++;
-    }
-    auto [loc, seq, pos] = spec_to_ls(spec.substr(offset));
+  CardId spec_to_card_id(SpecKey spec, PlayerId player) {
+    bool opponent = spec_key_opponent(spec);
+    auto [controller, loc, seq, pos] = spec_key_to_ls(player, spec);
+    player = controller;
+    // overlay specs resolve to the xyz monster, as the string specs did
+    loc &= 0x7f;
     if (opponent) {
       bool hidden_for_opponent = true;
       if (
@@ -2836,7 +3592,7 @@ private:
       }
       CardId card_id = 0;
       if (!hide) {
-        card_id = c_get_card_id(c.code_);
+        card_id = c.id();
       }
     }
     return c_get_card_id(get_card_code(player, loc, seq));
@@ -2867,7 +3623,7 @@ private:
   }
 
   // ygopro-core API
-  intptr_t YGO_CreateDuel(uint32_t seed) {
+  static intptr_t YGO_CreateDuel(uint32_t seed) {
     std::mt19937 rnd(seed);
     // return create_duel(rnd());
     duel* pduel = new duel();
@@ -2875,19 +3631,19 @@ private:
     return (intptr_t)pduel;
   }
 
-  void YGO_SetPlayerInfo(intptr_t pduel, int32 playerid, int32 lp, int32 startcount, int32 drawcount) const {
+  static void YGO_SetPlayerInfo(intptr_t pduel, int32 playerid, int32 lp, int32 startcount, int32 drawcount) {
     set_player_info(pduel, playerid, lp, startcount, drawcount);
   }
 
-  void YGO_NewCard(intptr_t pduel, uint32 code, uint8 owner, uint8 playerid, uint8 location, uint8 sequence, uint8 position) const {
+  static void YGO_NewCard(intptr_t pduel, uint32 code, uint8 owner, uint8 playerid, uint8 location, uint8 sequence, uint8 position) {
     new_card(pduel, code, owner, playerid, location, sequence, position);
   }
 
-  void YGO_StartDuel(intptr_t pduel, int32 options) const {
+  static void YGO_StartDuel(intptr_t pduel, int32 options) {
     start_duel(pduel, options);
   }
 
-  void YGO_EndDuel(intptr_t pduel) const {
+  static void YGO_EndDuel(intptr_t pduel) {
     // end_duel(pduel);
     duel* pd = (duel*)pduel;
     delete pd;
@@ -2898,6 +3654,7 @@ private:
   }
 
   uint32 YGO_Process(intptr_t pduel) {
+    LatencyTimer timer(process_key_);
     return process(pduel);
   }
 
@@ -2914,6 +3671,9 @@ private:
   }
 
   void YGO_SetResponsei(intptr_t pduel, int32 value) {
+    byte buf[4];
+    std::memcpy(buf, &value, 4);
+    response_log_.add(buf, 4);
     if (record_) {
       ReplayWriteInt8(4);
       ReplayWriteInt32(value);
@@ -2921,27 +3681,27 @@ private:
     set_responsei(pduel, value);
   }
 
+  // size of a byte response to the current message, as in replays
+  int response_size(const byte *buf) const {
+    switch (msg_) {
+      case MSG_SORT_CARD:
+        return 1;
+      case MSG_SELECT_COUNTER:
+        return 2 * n_counters_;
+      case MSG_SELECT_PLACE:
+      case MSG_SELECT_DISFIELD:
+        return 3;
+      default:
+        return buf[0] + 1;
+    }
+  }
+
   void YGO_SetResponseb(intptr_t pduel, byte* buf) {
+    int size = response_size(buf);
+    response_log_.add(buf, size);
     if (record_) {
-      switch (msg_) {
-        case MSG_SORT_CARD:
-          ReplayWriteInt8(1);
-          fwrite(buf, 1, 1, fp_);
-          break;
-        case MSG_SELECT_COUNTER:
-          ReplayWriteInt8(2 * n_counters_);
-          fwrite(buf, 2 * n_counters_, 1, fp_);
-          break;
-        case MSG_SELECT_PLACE:
-        case MSG_SELECT_DISFIELD:
-          ReplayWriteInt8(3);
-          fwrite(buf, 3, 1, fp_);
-          break;
-        default:
-          ReplayWriteInt8(buf[0] + 1);
-          fwrite(buf, buf[0] + 1, 1, fp_);
-          break;
-      }
+      ReplayWriteInt8(size);
+      fwrite(buf, size, 1, fp_);
     }
     set_responseb(pduel, buf);
   }
@@ -2951,8 +3711,8 @@ private:
   void show_decision(int idx) {
     std::string s;
     const auto& a = legal_actions_[idx];
-    if (!a.spec_.empty()) {
-      s = a.spec_;
+    if (a.spec_ != 0) {
+      s = spec_key_to_string(a.spec_);
     } else if (a.place_ != ActionPlace::None) {
       s = action_place_to_string(a.place_);
     } else if (a.position_ != 0) {
@@ -2987,6 +3747,14 @@ private:
       std::shuffle(main_deck.begin(), main_deck.end(), gen);
     }
 
+    add_deck(pduel, player, main_deck, extra_deck);
+
+    return {main_deck, extra_deck, deck_name};
+  }
+
+  static void add_deck(intptr_t pduel, PlayerId player,
+                       const std::vector<CardCode> &main_deck,
+                       const std::vector<CardCode> &extra_deck) {
     // add main deck in reverse order following ygopro
     // but since we have shuffled deck, so just add in order
 
@@ -3000,8 +3768,6 @@ private:
       YGO_NewCard(pduel, extra_deck[i], player, player, LOCATION_EXTRA, 0,
                POS_FACEDOWN_DEFENSE);
     }
-
-    return {main_deck, extra_deck, deck_name};
   }
 
   void next() {
@@ -3022,17 +3788,25 @@ private:
         if (ms_idx_ != -1) {
           handle_multi_select();
         } else {
-          handle_message();
+          {
+            LatencyTimer timer(handle_message_keys_[0]);
+            handle_message();
+            timer.SetKey(handle_message_keys_[msg_ & 0xff]);
+          }
+          if ((dp_ == dl_) && !is_prompt_or_hint(msg_)) {
+            // the rest of the buffer may have been skipped unseen
+            mark_field_dirty();
+          }
           if (legal_actions_.empty()) {
             continue;
           }
         }
         if ((play_mode_ == kSelfPlay) || (to_play_ == ai_player_)) {
           if (legal_actions_.size() == 1) {
-            callback_(0);
+            callback_(*this, 0);
             auto la = legal_actions_[0];
             la.msg_ = msg_;
-            if (la.cid_ == 0 && !la.spec_.empty()) {
+            if (la.cid_ == 0 && la.spec_ != 0) {
               la.cid_ = spec_to_card_id(la.spec_, to_play_);
             }
             update_history_actions(to_play_, la);
@@ -3044,7 +3818,7 @@ private:
           }
         } else {
           auto idx = players_[to_play_]->think(legal_actions_);
-          callback_(idx);
+          callback_(*this, idx);
           if (verbose_) {
             show_decision(idx);
           }
@@ -3138,14 +3912,16 @@ private:
     return c;
   }
 
-  std::vector<Card> get_cards_in_location(PlayerId player, uint8_t loc) {
+  // Cards are written into cards, reusing its storage
+  void get_cards_in_location(PlayerId player, uint8_t loc,
+                             std::vector<Card> &cards) {
     int32_t flags = QUERY_CODE | QUERY_POSITION | QUERY_LEVEL | QUERY_RANK |
                     QUERY_ATTACK | QUERY_DEFENSE | QUERY_EQUIP_CARD |
                     QUERY_OVERLAY_CARD | QUERY_COUNTERS | QUERY_STATUS |
                     QUERY_LSCALE | QUERY_RSCALE | QUERY_LINK;
     int32_t bl = YGO_QueryFieldCard(pduel_, player, loc, flags, query_buf_);
     qdp_ = 0;
-    std::vector<Card> cards;
+    cards.clear();
     while (true) {
       if (qdp_ >= bl) {
         break;
@@ -3220,7 +3996,112 @@ private:
       }
       cards.push_back(c);
     }
-    return cards;
+  }
+
+  void mark_field_dirty() {
+    std::fill(&field_dirty_[0][0], &field_dirty_[0][0] + 14, true);
+  }
+
+  void mark_field_dirty(PlayerId player, uint8_t loc) {
+    if (player > 1) {
+      return;
+    }
+    loc &= 0x7f;
+    while (loc != 0) {
+      field_dirty_[player][__builtin_ctz(loc)] = true;
+      loc &= loc - 1;
+    }
+  }
+
+  // packed location info (controller, location, sequence, position)
+  void mark_field_dirty(const byte *info) {
+    mark_field_dirty(info[0], info[1]);
+  }
+
+  // Cards of a zone from the field mirror, the engine is only queried again
+  // after update_field_mirror has marked the zone dirty
+  const std::vector<Card> &field_cards(PlayerId player, uint8_t loc) {
+    int i = __builtin_ctz(loc);
+    if (field_dirty_[player][i]) {
+      get_cards_in_location(player, loc, field_cards_[player][i]);
+      field_dirty_[player][i] = false;
+    }
+    return field_cards_[player][i];
+  }
+
+  // Marks the zones changed by the message at p. Any message other than a
+  // prompt or hint may change the stats of public cards through continuous
+  // effects, so only the layout of deck and extra deck is tracked exactly.
+  void update_field_mirror(int msg, const byte *p) {
+    if (is_prompt_or_hint(msg)) {
+      return;
+    }
+    for (PlayerId i = 0; i < 2; i++) {
+      mark_field_dirty(i, LOCATION_HAND | LOCATION_ONFIELD | LOCATION_GRAVE |
+                              LOCATION_REMOVED);
+    }
+    switch (msg) {
+    case MSG_MOVE:
+      mark_field_dirty(p + 4);
+      mark_field_dirty(p + 8);
+      break;
+    case MSG_POS_CHANGE:
+    case MSG_SET:
+      mark_field_dirty(p + 4);
+      break;
+    case MSG_SWAP:
+      mark_field_dirty(p + 4);
+      mark_field_dirty(p + 12);
+      break;
+    case MSG_DRAW:
+    case MSG_SHUFFLE_DECK:
+    case MSG_DECK_TOP:
+    case MSG_SWAP_GRAVE_DECK:
+      mark_field_dirty(p[0], LOCATION_DECK);
+      break;
+    case MSG_SHUFFLE_EXTRA:
+      mark_field_dirty(p[0], LOCATION_EXTRA);
+      break;
+    case MSG_SHUFFLE_SET_CARD:
+      mark_field_dirty(0, p[0]);
+      mark_field_dirty(1, p[0]);
+      break;
+    case MSG_SHUFFLE_HAND:
+    case MSG_NEW_TURN:
+    case MSG_NEW_PHASE:
+    case MSG_DAMAGE:
+    case MSG_RECOVER:
+    case MSG_LPUPDATE:
+    case MSG_PAY_LPCOST:
+    case MSG_CHAINING:
+    case MSG_CHAINED:
+    case MSG_CHAIN_SOLVING:
+    case MSG_CHAIN_SOLVED:
+    case MSG_CHAIN_END:
+    case MSG_CHAIN_NEGATED:
+    case MSG_CHAIN_DISABLED:
+    case MSG_SUMMONING:
+    case MSG_SUMMONED:
+    case MSG_SPSUMMONING:
+    case MSG_SPSUMMONED:
+    case MSG_FLIPSUMMONING:
+    case MSG_FLIPSUMMONED:
+    case MSG_EQUIP:
+    case MSG_CARD_TARGET:
+    case MSG_CANCEL_TARGET:
+    case MSG_ADD_COUNTER:
+    case MSG_REMOVE_COUNTER:
+    case MSG_ATTACK:
+    case MSG_BATTLE:
+    case MSG_ATTACK_DISABLED:
+    case MSG_DAMAGE_STEP_START:
+    case MSG_DAMAGE_STEP_END:
+    case MSG_FIELD_DISABLED:
+      break;
+    default:
+      mark_field_dirty();
+      break;
+    }
   }
 
   std::vector<Card> read_cardlist(bool extra = false, bool extra8 = false) {
@@ -3245,10 +4126,12 @@ private:
     return cards;
   }
 
-  std::vector<IdleCardSpec> read_cardlist_spec(PlayerId player, bool extra = false, bool extra8 = false) {
-    std::vector<IdleCardSpec> card_specs;
+  // Cards are written into card_specs, reusing its storage
+  const std::vector<IdleCardSpec> &read_cardlist_spec(
+    PlayerId player, std::vector<IdleCardSpec> &card_specs, bool extra = false,
+    bool extra8 = false) {
+    card_specs.clear();
     auto count = read_u8();
-    card_specs.reserve(count);
     for (int i = 0; i < count; ++i) {
       CardCode code = read_u32();
       auto controller = read_u8();
@@ -3262,7 +4145,7 @@ private:
           data = read_u32();
         }
       }
-      card_specs.push_back({code, ls_to_spec(loc, seq, 0, player != controller), data});
+      card_specs.push_back({code, ls_to_spec_key(loc, seq, 0, player != controller), data});
     }
     return card_specs;
   }
@@ -3292,7 +4175,7 @@ private:
     if ((card.controler_ != pl) && (card.position_ & POS_FACEDOWN)) {
       return position_to_string(card.position_) + "card (" + spec + ")";
     }
-    return card.name_ + " (" + spec + ")";
+    return card.name() + " (" + spec + ")";
   }
 
   // This function does the following:
@@ -3301,1415 +4184,1610 @@ private:
   // 3. update to_play_ and options_ if need action
   void handle_message() {
     msg_ = int(data_[dp_++]);
-    legal_actions_ = {};
+    legal_actions_.clear();
+    update_field_mirror(msg_, data_ + dp_);
 
     if (verbose_) {
       fmt::println("Message {}, length {}, dp {}", msg_to_string(msg_), dl_, dp_);
     }
 
-    if (msg_ == MSG_DRAW) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto player = read_u8();
-      auto drawed = read_u8();
-      std::vector<uint32> codes;
-      for (int i = 0; i < drawed; ++i) {
-        uint32 code = read_u32();
-        codes.push_back(code & 0x7fffffff);
-      }
-      const auto &pl = players_[player];
-      pl->notify(fmt::format("Drew {} cards:", drawed));
-      for (int i = 0; i < drawed; ++i) {
-        const auto &c = c_get_card(codes[i]);
-        pl->notify(fmt::format("{}: {}", i + 1, c.name_));
-      }
-      const auto &op = players_[1 - player];
-      op->notify(fmt::format("Opponent drew {} cards.", drawed));
-    } else if (msg_ == MSG_NEW_TURN) {
-      tp_ = int(read_u8());
-      turn_count_++;
-      if (!verbose_) {
-        return;
-      }
-      auto& player = players_[tp_];
-      player->notify("Your turn.");
-      players_[1 - tp_]->notify(fmt::format("{}'s turn.", player->nickname_));
-    } else if (msg_ == MSG_NEW_PHASE) {
-      current_phase_ = int(read_u16());
-      if (!verbose_) {
-        return;
-      }
-      auto phase_str = phase_to_string(current_phase_);
-      for (int i = 0; i < 2; ++i) {
-        players_[i]->notify(fmt::format("Entering {} phase.", phase_str));
-      }
-    } else if (msg_ == MSG_MOVE) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      CardCode code = read_u32();
-      uint32_t location = read_u32();
-      uint32_t newloc = read_u32();
-      uint32_t reason = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(location);
-      Card cnew = c_get_card(code);
-      cnew.set_location(newloc);
-      auto& pl = players_[card.controler_];
-      auto& op = players_[1 - card.controler_];
-
-      auto plspec = card.get_spec(false);
-      auto opspec = card.get_spec(true);
-      auto plnewspec = cnew.get_spec(false);
-      auto opnewspec = cnew.get_spec(true);
-
-      auto getspec = [&](auto& p) { return p.get() == pl.get() ? plspec : opspec; };
-      auto getnewspec = [&](auto& p) {
-        return p.get() == pl.get() ? plnewspec : opnewspec;
-      };
-      bool card_visible = true;
-      if ((card.position_ & POS_FACEDOWN) && (cnew.position_ & POS_FACEDOWN)) {
-        card_visible = false;
-      }
-      auto getvisiblename = [&](auto& p) {
-        return card_visible ? card.name_ : "Face-down card";
-      };
+    const auto &entry = message_table()[msg_];
+    if (entry.skip_quiet && !verbose_) {
+      dp_ = dl_;
+      return;
+    }
+    if (entry.handler == nullptr) {
+      show_deck(0);
+      show_deck(1);
+      show_buffer();
+      throw std::runtime_error(
+        fmt::format("Unknown message {}, length {}, dp {}",
+        msg_to_string(msg_), dl_, dp_));
+    }
+    (this->*entry.handler)();
+  }
 
-      if ((reason & REASON_DESTROY) && (card.location_ != cnew.location_)) {
-        pl->notify(fmt::format("Card {} ({}) destroyed.", plspec, card.name_));
-        op->notify(fmt::format("Card {} ({}) destroyed.", opspec, card.name_));
-      } else if ((card.location_ == cnew.location_) &&
-                 (card.location_ & LOCATION_ONFIELD)) {
-        if (card.controler_ != cnew.controler_) {
-          pl->notify(
-              fmt::format("Your card {} ({}) changed controller to {} and is "
-                          "now located at {}.",
-                          plspec, card.name_, op->nickname_, plnewspec));
-          op->notify(
-              fmt::format("You now control {}'s card {} ({}) and it's located "
-                          "at {}.",
-                          pl->nickname_, opspec, card.name_, opnewspec));
-        } else {
-          pl->notify(fmt::format("Your card {} ({}) switched its zone to {}.",
-                                 plspec, card.name_, plnewspec));
-          op->notify(fmt::format("{}'s card {} ({}) switched its zone to {}.",
-                                 pl->nickname_, opspec, card.name_, opnewspec));
-        }
-      } else if ((reason & REASON_DISCARD) &&
-                 (card.location_ != cnew.location_)) {
-        pl->notify(fmt::format("You discarded {} ({})", plspec, card.name_));
-        op->notify(fmt::format("{} discarded {} ({})", pl->nickname_, opspec,
-                               card.name_));
-      } else if ((card.location_ == LOCATION_REMOVED) &&
-                 (cnew.location_ & LOCATION_ONFIELD)) {
-        pl->notify(
-            fmt::format("Your banished card {} ({}) returns to the field at "
-                        "{}.",
-                        plspec, card.name_, plnewspec));
-        op->notify(
-            fmt::format("{}'s banished card {} ({}) returns to the field at "
-                        "{}.",
-                        pl->nickname_, opspec, card.name_, opnewspec));
-      } else if ((card.location_ == LOCATION_GRAVE) &&
-                 (cnew.location_ & LOCATION_ONFIELD)) {
-        pl->notify(
-            fmt::format("Your card {} ({}) returns from the graveyard to the "
-                        "field at {}.",
-                        plspec, card.name_, plnewspec));
-        op->notify(
-            fmt::format("{}'s card {} ({}) returns from the graveyard to the "
-                        "field at {}.",
-                        pl->nickname_, opspec, card.name_, opnewspec));
-      } else if ((cnew.location_ == LOCATION_HAND) &&
-                 (card.location_ != cnew.location_)) {
-        pl->notify(
-            fmt::format("Card {} ({}) returned to hand.", plspec, card.name_));
-      } else if ((reason & (REASON_RELEASE | REASON_SUMMON)) &&
-                 (card.location_ != cnew.location_)) {
-        pl->notify(fmt::format("You tribute {} ({}).", plspec, card.name_));
-        op->notify(fmt::format("{} tributes {} ({}).", pl->nickname_, opspec,
-                               getvisiblename(op)));
-      } else if ((card.location_ == (LOCATION_OVERLAY | LOCATION_MZONE)) &&
-                 (cnew.location_ & LOCATION_GRAVE)) {
-        pl->notify(fmt::format("You detached {}.", card.name_));
-        op->notify(fmt::format("{} detached {}.", pl->nickname_, card.name_));
-      } else if ((card.location_ != cnew.location_) &&
-                 (cnew.location_ == LOCATION_GRAVE)) {
-        pl->notify(fmt::format("Your card {} ({}) was sent to the graveyard.",
-                               plspec, card.name_));
-        op->notify(fmt::format("{}'s card {} ({}) was sent to the graveyard.",
-                               pl->nickname_, opspec, card.name_));
-      } else if ((card.location_ != cnew.location_) &&
-                 (cnew.location_ == LOCATION_REMOVED)) {
+  using MessageHandler = void (YGOProEnvImpl::*)();
+
+  struct MessageEntry {
+    MessageHandler handler = nullptr;
+    // without verbose, the rest of the buffer is skipped and the handler is
+    // not called
+    bool skip_quiet = false;
+  };
+
+  static const std::array<MessageEntry, 256> &message_table() {
+    static const std::array<MessageEntry, 256> table = [] {
+      std::array<MessageEntry, 256> t{};
+      t[MSG_DRAW] = {&YGOProEnvImpl::handle_draw, true};
+      t[MSG_NEW_TURN] = {&YGOProEnvImpl::handle_new_turn, false};
+      t[MSG_NEW_PHASE] = {&YGOProEnvImpl::handle_new_phase, false};
+      t[MSG_MOVE] = {&YGOProEnvImpl::handle_move, true};
+      t[MSG_SWAP] = {&YGOProEnvImpl::handle_swap, true};
+      t[MSG_SET] = {&YGOProEnvImpl::handle_set, true};
+      t[MSG_EQUIP] = {&YGOProEnvImpl::handle_equip, true};
+      t[MSG_HINT] = {&YGOProEnvImpl::handle_hint, false};
+      t[MSG_CARD_HINT] = {&YGOProEnvImpl::handle_card_hint, true};
+      t[MSG_POS_CHANGE] = {&YGOProEnvImpl::handle_pos_change, true};
+      t[MSG_BECOME_TARGET] = {&YGOProEnvImpl::handle_become_target, true};
+      t[MSG_CONFIRM_DECKTOP] = {&YGOProEnvImpl::handle_confirm_decktop, true};
+      t[MSG_RANDOM_SELECTED] = {&YGOProEnvImpl::handle_random_selected, true};
+      t[MSG_PLAYER_HINT] = {&YGOProEnvImpl::handle_player_hint, true};
+      t[MSG_CARD_TARGET] = {&YGOProEnvImpl::handle_card_target, true};
+      t[MSG_CONFIRM_CARDS] = {&YGOProEnvImpl::handle_confirm_cards, false};
+      t[MSG_MISSED_EFFECT] = {&YGOProEnvImpl::handle_missed_effect, true};
+      t[MSG_SORT_CARD] = {&YGOProEnvImpl::handle_sort_card, false};
+      t[MSG_ADD_COUNTER] = {&YGOProEnvImpl::handle_add_counter, true};
+      t[MSG_REMOVE_COUNTER] = {&YGOProEnvImpl::handle_remove_counter, true};
+      t[MSG_ATTACK_DISABLED] = {&YGOProEnvImpl::handle_attack_disabled, true};
+      t[MSG_SHUFFLE_SET_CARD] = {&YGOProEnvImpl::handle_shuffle_set_card, true};
+      t[MSG_SHUFFLE_DECK] = {&YGOProEnvImpl::handle_shuffle_deck, true};
+      t[MSG_SHUFFLE_EXTRA] = {&YGOProEnvImpl::handle_shuffle_extra, true};
+      t[MSG_SHUFFLE_HAND] = {&YGOProEnvImpl::handle_shuffle_hand, true};
+      t[MSG_SUMMONED] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_SUMMONING] = {&YGOProEnvImpl::handle_summoning, true};
+      t[MSG_SPSUMMONED] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_FLIPSUMMONED] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_FLIPSUMMONING] = {&YGOProEnvImpl::handle_flipsummoning, true};
+      t[MSG_SPSUMMONING] = {&YGOProEnvImpl::handle_spsummoning, true};
+      t[MSG_CHAIN_NEGATED] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_CHAIN_DISABLED] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_CHAIN_SOLVED] = {&YGOProEnvImpl::handle_chain_solved, false};
+      t[MSG_CHAIN_SOLVING] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_CHAINED] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_CHAIN_END] = {&YGOProEnvImpl::skip_message, true};
+      t[MSG_CHAINING] = {&YGOProEnvImpl::handle_chaining, true};
+      t[MSG_DAMAGE] = {&YGOProEnvImpl::handle_damage, false};
+      t[MSG_RECOVER] = {&YGOProEnvImpl::handle_recover, false};
+      t[MSG_LPUPDATE] = {&YGOProEnvImpl::handle_lpupdate, false};
+      t[MSG_PAY_LPCOST] = {&YGOProEnvImpl::handle_pay_lpcost, false};
+      t[MSG_ATTACK] = {&YGOProEnvImpl::handle_attack, true};
+      t[MSG_DAMAGE_STEP_START] = {&YGOProEnvImpl::handle_damage_step_start, false};
+      t[MSG_DAMAGE_STEP_END] = {&YGOProEnvImpl::handle_damage_step_end, false};
+      t[MSG_BATTLE] = {&YGOProEnvImpl::handle_battle, true};
+      t[MSG_WIN] = {&YGOProEnvImpl::handle_win, false};
+      t[MSG_RETRY] = {&YGOProEnvImpl::handle_retry, false};
+      t[MSG_SELECT_BATTLECMD] = {&YGOProEnvImpl::handle_select_battlecmd, false};
+      t[MSG_SELECT_UNSELECT_CARD] = {&YGOProEnvImpl::handle_select_unselect_card, false};
+      t[MSG_SELECT_CARD] = {&YGOProEnvImpl::handle_select_card, false};
+      t[MSG_SELECT_TRIBUTE] = {&YGOProEnvImpl::handle_select_tribute, false};
+      t[MSG_SELECT_SUM] = {&YGOProEnvImpl::handle_select_sum, false};
+      t[MSG_SELECT_CHAIN] = {&YGOProEnvImpl::handle_select_chain, false};
+      t[MSG_SELECT_YESNO] = {&YGOProEnvImpl::handle_select_yesno, false};
+      t[MSG_SELECT_EFFECTYN] = {&YGOProEnvImpl::handle_select_effectyn, false};
+      t[MSG_SELECT_OPTION] = {&YGOProEnvImpl::handle_select_option, false};
+      t[MSG_SELECT_IDLECMD] = {&YGOProEnvImpl::handle_select_idlecmd, false};
+      t[MSG_SELECT_PLACE] = {&YGOProEnvImpl::handle_select_place, false};
+      t[MSG_SELECT_DISFIELD] = {&YGOProEnvImpl::handle_select_place, false};
+      t[MSG_SELECT_COUNTER] = {&YGOProEnvImpl::handle_select_counter, false};
+      t[MSG_ANNOUNCE_NUMBER] = {&YGOProEnvImpl::handle_announce_number, false};
+      t[MSG_ANNOUNCE_ATTRIB] = {&YGOProEnvImpl::handle_announce_attrib, false};
+      t[MSG_ANNOUNCE_CARD] = {&YGOProEnvImpl::handle_announce_card, false};
+      t[MSG_SELECT_POSITION] = {&YGOProEnvImpl::handle_select_position, false};
+      return t;
+    }();
+    return table;
+  }
+
+  void skip_message() { dp_ = dl_; }
+
+  void handle_draw() {
+    auto player = read_u8();
+    auto drawed = read_u8();
+    std::vector<uint32> codes;
+    for (int i = 0; i < drawed; ++i) {
+      uint32 code = read_u32();
+      codes.push_back(code & 0x7fffffff);
+    }
+    const auto &pl = players_[player];
+    pl->notify(fmt::format("Drew {} cards:", drawed));
+    for (int i = 0; i < drawed; ++i) {
+      const auto &c = c_get_card(codes[i]);
+      pl->notify(fmt::format("{}: {}", i + 1, c.name()));
+    }
+    const auto &op = players_[1 - player];
+    op->notify(fmt::format("Opponent drew {} cards.", drawed));
+  }
+
+  void handle_new_turn() {
+    tp_ = int(read_u8());
+    turn_count_++;
+    if (!verbose_) {
+      return;
+    }
+    auto& player = players_[tp_];
+    player->notify("Your turn.");
+    players_[1 - tp_]->notify(fmt::format("{}'s turn.", player->nickname_));
+  }
+
+  void handle_new_phase() {
+    current_phase_ = int(read_u16());
+    if (!verbose_) {
+      return;
+    }
+    auto phase_str = phase_to_string(current_phase_);
+    for (int i = 0; i < 2; ++i) {
+      players_[i]->notify(fmt::format("Entering {} phase.", phase_str));
+    }
+  }
+
+  void handle_move() {
+    CardCode code = read_u32();
+    uint32_t location = read_u32();
+    uint32_t newloc = read_u32();
+    uint32_t reason = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(location);
+    Card cnew = c_get_card(code);
+    cnew.set_location(newloc);
+    auto& pl = players_[card.controler_];
+    auto& op = players_[1 - card.controler_];
+
+    auto plspec = card.get_spec(false);
+    auto opspec = card.get_spec(true);
+    auto plnewspec = cnew.get_spec(false);
+    auto opnewspec = cnew.get_spec(true);
+
+    auto getspec = [&](auto& p) { return p.get() == pl.get() ? plspec : opspec; };
+    auto getnewspec = [&](auto& p) {
+      return p.get() == pl.get() ? plnewspec : opnewspec;
+    };
+    bool card_visible = true;
+    if ((card.position_ & POS_FACEDOWN) && (cnew.position_ & POS_FACEDOWN)) {
+      card_visible = false;
+    }
+    auto getvisiblename = [&](auto& p) {
+      return card_visible ? card.name() : "Face-down card";
+    };
+
+    if ((reason & REASON_DESTROY) && (card.location_ != cnew.location_)) {
+      pl->notify(fmt::format("Card {} ({}) destroyed.", plspec, card.name()));
+      op->notify(fmt::format("Card {} ({}) destroyed.", opspec, card.name()));
+    } else if ((card.location_ == cnew.location_) &&
+               (card.location_ & LOCATION_ONFIELD)) {
+      if (card.controler_ != cnew.controler_) {
         pl->notify(
-            fmt::format("Your card {} ({}) was banished.", plspec, card.name_));
-        op->notify(fmt::format("{}'s card {} ({}) was banished.", pl->nickname_,
-                               opspec, getvisiblename(op)));
-      } else if ((card.location_ != cnew.location_) &&
-                 (cnew.location_ == LOCATION_DECK)) {
-        pl->notify(fmt::format("Your card {} ({}) returned to your deck.",
-                               plspec, card.name_));
-        op->notify(fmt::format("{}'s card {} ({}) returned to their deck.",
-                               pl->nickname_, opspec, getvisiblename(op)));
-      } else if ((card.location_ != cnew.location_) &&
-                 (cnew.location_ == LOCATION_EXTRA)) {
-        pl->notify(fmt::format("Your card {} ({}) returned to your extra deck.",
-                               plspec, card.name_));
+            fmt::format("Your card {} ({}) changed controller to {} and is "
+                        "now located at {}.",
+                        plspec, card.name(), op->nickname_, plnewspec));
         op->notify(
-            fmt::format("{}'s card {} ({}) returned to their extra deck.",
-                        pl->nickname_, opspec, getvisiblename(op)));
-      } else if ((card.location_ == LOCATION_DECK) &&
-                 (cnew.location_ == LOCATION_SZONE) &&
-                 (cnew.position_ != POS_FACEDOWN)) {
-        pl->notify(fmt::format("Activating {} ({})", plnewspec, card.name_));
-        op->notify(fmt::format("{} activating {} ({})", pl->nickname_, opspec,
-                               cnew.name_));
-      }
-    } else if (msg_ == MSG_SWAP) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
+            fmt::format("You now control {}'s card {} ({}) and it's located "
+                        "at {}.",
+                        pl->nickname_, opspec, card.name(), opnewspec));
+      } else {
+        pl->notify(fmt::format("Your card {} ({}) switched its zone to {}.",
+                               plspec, card.name(), plnewspec));
+        op->notify(fmt::format("{}'s card {} ({}) switched its zone to {}.",
+                               pl->nickname_, opspec, card.name(), opnewspec));
+      }
+    } else if ((reason & REASON_DISCARD) &&
+               (card.location_ != cnew.location_)) {
+      pl->notify(fmt::format("You discarded {} ({})", plspec, card.name()));
+      op->notify(fmt::format("{} discarded {} ({})", pl->nickname_, opspec,
+                             card.name()));
+    } else if ((card.location_ == LOCATION_REMOVED) &&
+               (cnew.location_ & LOCATION_ONFIELD)) {
+      pl->notify(
+          fmt::format("Your banished card {} ({}) returns to the field at "
+                      "{}.",
+                      plspec, card.name(), plnewspec));
+      op->notify(
+          fmt::format("{}'s banished card {} ({}) returns to the field at "
+                      "{}.",
+                      pl->nickname_, opspec, card.name(), opnewspec));
+    } else if ((card.location_ == LOCATION_GRAVE) &&
+               (cnew.location_ & LOCATION_ONFIELD)) {
+      pl->notify(
+          fmt::format("Your card {} ({}) returns from the graveyard to the "
+                      "field at {}.",
+                      plspec, card.name(), plnewspec));
+      op->notify(
+          fmt::format("{}'s card {} ({}) returns from the graveyard to the "
+                      "field at {}.",
+                      pl->nickname_, opspec, card.name(), opnewspec));
+    } else if ((cnew.location_ == LOCATION_HAND) &&
+               (card.location_ != cnew.location_)) {
+      pl->notify(
+          fmt::format("Card {} ({}) returned to hand.", plspec, card.name()));
+    } else if ((reason & (REASON_RELEASE | REASON_SUMMON)) &&
+               (card.location_ != cnew.location_)) {
+      pl->notify(fmt::format("You tribute {} ({}).", plspec, card.name()));
+      op->notify(fmt::format("{} tributes {} ({}).", pl->nickname_, opspec,
+                             getvisiblename(op)));
+    } else if ((card.location_ == (LOCATION_OVERLAY | LOCATION_MZONE)) &&
+               (cnew.location_ & LOCATION_GRAVE)) {
+      pl->notify(fmt::format("You detached {}.", card.name()));
+      op->notify(fmt::format("{} detached {}.", pl->nickname_, card.name()));
+    } else if ((card.location_ != cnew.location_) &&
+               (cnew.location_ == LOCATION_GRAVE)) {
+      pl->notify(fmt::format("Your card {} ({}) was sent to the graveyard.",
+                             plspec, card.name()));
+      op->notify(fmt::format("{}'s card {} ({}) was sent to the graveyard.",
+                             pl->nickname_, opspec, card.name()));
+    } else if ((card.location_ != cnew.location_) &&
+               (cnew.location_ == LOCATION_REMOVED)) {
+      pl->notify(
+          fmt::format("Your card {} ({}) was banished.", plspec, card.name()));
+      op->notify(fmt::format("{}'s card {} ({}) was banished.", pl->nickname_,
+                             opspec, getvisiblename(op)));
+    } else if ((card.location_ != cnew.location_) &&
+               (cnew.location_ == LOCATION_DECK)) {
+      pl->notify(fmt::format("Your card {} ({}) returned to your deck.",
+                             plspec, card.name()));
+      op->notify(fmt::format("{}'s card {} ({}) returned to their deck.",
+                             pl->nickname_, opspec, getvisiblename(op)));
+    } else if ((card.location_ != cnew.location_) &&
+               (cnew.location_ == LOCATION_EXTRA)) {
+      pl->notify(fmt::format("Your card {} ({}) returned to your extra deck.",
+                             plspec, card.name()));
+      op->notify(
+          fmt::format("{}'s card {} ({}) returned to their extra deck.",
+                      pl->nickname_, opspec, getvisiblename(op)));
+    } else if ((card.location_ == LOCATION_DECK) &&
+               (cnew.location_ == LOCATION_SZONE) &&
+               (cnew.position_ != POS_FACEDOWN)) {
+      pl->notify(fmt::format("Activating {} ({})", plnewspec, card.name()));
+      op->notify(fmt::format("{} activating {} ({})", pl->nickname_, opspec,
+                             cnew.name()));
+    }
+  }
+
+  void handle_swap() {
+    CardCode code1 = read_u32();
+    uint32_t loc1 = read_u32();
+    CardCode code2 = read_u32();
+    uint32_t loc2 = read_u32();
+    Card cards[2];
+    cards[0] = c_get_card(code1);
+    cards[1] = c_get_card(code2);
+    cards[0].set_location(loc1);
+    cards[1].set_location(loc2);
+
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      for (int i = 0; i < 2; i++) {
+        auto c = cards[i];
+        auto spec = c.get_spec(pl);
+        auto plname = players_[1 - c.controler_]->nickname_;
+        players_[pl]->notify("Card " + c.name() + " swapped control towards " +
+                             plname + " and is now located at " + spec + ".");
       }
-      CardCode code1 = read_u32();
-      uint32_t loc1 = read_u32();
-      CardCode code2 = read_u32();
-      uint32_t loc2 = read_u32();
-      Card cards[2];
-      cards[0] = c_get_card(code1);
-      cards[1] = c_get_card(code2);
-      cards[0].set_location(loc1);
-      cards[1].set_location(loc2);
+    }
+  }
 
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        for (int i = 0; i < 2; i++) {
-          auto c = cards[i];
-          auto spec = c.get_spec(pl);
-          auto plname = players_[1 - c.controler_]->nickname_;
-          players_[pl]->notify("Card " + c.name_ + " swapped control towards " +
-                               plname + " and is now located at " + spec + ".");
-        }
+  void handle_set() {
+    CardCode code = read_u32();
+    uint32_t location = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(location);
+    auto c = card.controler_;
+    auto& cpl = players_[c];
+    auto& opl = players_[1 - c];
+    cpl->notify(fmt::format("You set {} ({}) in {} position.", card.name(),
+                            card.get_spec(c), card.get_position()));
+    opl->notify(fmt::format("{} sets {} in {} position.", cpl->nickname_,
+                            card.get_spec(PlayerId(1 - c)),
+                            card.get_position()));
+  }
+
+  void handle_equip() {
+    auto c = read_u8();
+    auto loc = read_u8();
+    auto seq = read_u8();
+    auto pos = read_u8();
+    Card card = get_card(c, loc, seq);
+    c = read_u8();
+    loc = read_u8();
+    seq = read_u8();
+    pos = read_u8();
+    Card target = get_card(c, loc, seq);
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto c = cardlist_info_for_player(card, pl);
+      auto t = cardlist_info_for_player(target, pl);
+      players_[pl]->notify(fmt::format("{} equipped to {}.", c, t));
+    }
+  }
+
+  void handle_hint() {
+    auto hint_type = read_u8();
+    auto player = read_u8();
+    auto value = read_u32();
+
+    if (hint_type == HINT_SELECTMSG && value == 501) {
+      discard_hand_ = true;
+    }
+    // non-GUI don't need hint
+    return;
+    if (hint_type == HINT_SELECTMSG) {
+      if (value > 2000) {
+        CardCode code = value;
+        players_[player]->notify(fmt::format("{} select {}",
+                                             players_[player]->nickname_,
+                                             c_get_card(code).name()));
+      } else {
+        players_[player]->notify(get_system_string(value));
       }
-    } else if (msg_ == MSG_SET) {
-      if (!verbose_) {
-        dp_ = dl_;
+    } else if (hint_type == HINT_NUMBER) {
+      players_[1 - player]->notify(
+          fmt::format("Choice of player: {}", value));
+    } else {
+      fmt::println("Unknown hint type {} with value {}", hint_type, value);
+    }
+  }
+
+  void handle_card_hint() {
+    uint8_t player = read_u8();
+    uint8_t loc = read_u8();
+    uint8_t seq = read_u8();
+    uint8_t pos = read_u8();
+    uint8_t type = read_u8();
+    uint32_t value = read_u32();
+    if (type == CHINT_RACE) {
+      Card card = get_card(player, loc, seq);
+      if (card.code_ == 0) {
         return;
       }
-      CardCode code = read_u32();
-      uint32_t location = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(location);
-      auto c = card.controler_;
-      auto& cpl = players_[c];
-      auto& opl = players_[1 - c];
-      cpl->notify(fmt::format("You set {} ({}) in {} position.", card.name_,
-                              card.get_spec(c), card.get_position()));
-      opl->notify(fmt::format("{} sets {} in {} position.", cpl->nickname_,
-                              card.get_spec(PlayerId(1 - c)),
-                              card.get_position()));
-    } else if (msg_ == MSG_EQUIP) {
-      if (!verbose_) {
-        dp_ = dl_;
+      std::string races_str = "TODO";
+      for (PlayerId pl = 0; pl < 2; pl++) {
+        players_[pl]->notify(fmt::format("{} ({}) selected {}.",
+                                         card.get_spec(pl), card.name(),
+                                         races_str));
+      }
+    } else if (type == CHINT_ATTRIBUTE) {
+      Card card = get_card(player, loc, seq);
+      if (card.code_ == 0) {
         return;
       }
+      std::string attributes_str = "TODO";
+      for (PlayerId pl = 0; pl < 2; pl++) {
+        players_[pl]->notify(fmt::format("{} ({}) selected {}.",
+                                         card.get_spec(pl), card.name(),
+                                         attributes_str));
+      }
+    } else {
+      fmt::println("Unknown card hint type {} with value {}", type, value);
+    }
+  }
+
+  void handle_pos_change() {
+    CardCode code = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(read_u32());
+    uint8_t prevpos = card.position_;
+    card.position_ = read_u8();
+
+    auto& pl = players_[card.controler_];
+    auto& op = players_[1 - card.controler_];
+    auto plspec = card.get_spec(false);
+    auto opspec = card.get_spec(true);
+    auto prevpos_str = position_to_string(prevpos);
+    auto pos_str = position_to_string(card.position_);
+    pl->notify("The position of card " + plspec + " (" + card.name() +
+               ") changed from " + prevpos_str + " to " + pos_str + ".");
+    op->notify("The position of card " + opspec + " (" + card.name() +
+               ") changed from " + prevpos_str + " to " + pos_str + ".");
+  }
+
+  void handle_become_target() {
+    auto u = read_u8();
+    uint32_t target = read_u32();
+    uint8_t tc = target & 0xff;
+    uint8_t tl = (target >> 8) & 0xff;
+    uint8_t tseq = (target >> 16) & 0xff;
+    Card card = get_card(tc, tl, tseq);
+    auto name = players_[chaining_player_]->nickname_;
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto spec = card.get_spec(pl);
+      auto tcname = card.name();
+      if ((card.controler_ != pl) && (card.position_ & POS_FACEDOWN)) {
+        tcname = position_to_string(card.position_) + " card";
+      }
+      players_[pl]->notify(name + " targets " + spec + " (" + tcname + ")");
+    }
+  }
+
+  void handle_confirm_decktop() {
+    auto player = read_u8();
+    auto size = read_u8();
+    std::vector<Card> cards;
+    for (int i = 0; i < size; ++i) {
+      read_u32();
       auto c = read_u8();
       auto loc = read_u8();
       auto seq = read_u8();
-      auto pos = read_u8();
-      Card card = get_card(c, loc, seq);
-      c = read_u8();
-      loc = read_u8();
-      seq = read_u8();
-      pos = read_u8();
-      Card target = get_card(c, loc, seq);
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto c = cardlist_info_for_player(card, pl);
-        auto t = cardlist_info_for_player(target, pl);
-        players_[pl]->notify(fmt::format("{} equipped to {}.", c, t));
-      }
-    } else if (msg_ == MSG_HINT) {
-      auto hint_type = read_u8();
-      auto player = read_u8();
-      auto value = read_u32();
+      cards.push_back(get_card(c, loc, seq));
+    }
 
-      if (hint_type == HINT_SELECTMSG && value == 501) {
-        discard_hand_ = true;
-      }
-      // non-GUI don't need hint
-      return;
-      if (hint_type == HINT_SELECTMSG) {
-        if (value > 2000) {
-          CardCode code = value;
-          players_[player]->notify(fmt::format("{} select {}",
-                                               players_[player]->nickname_,
-                                               c_get_card(code).name_));
-        } else {
-          players_[player]->notify(get_system_string(value));
-        }
-      } else if (hint_type == HINT_NUMBER) {
-        players_[1 - player]->notify(
-            fmt::format("Choice of player: {}", value));
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto& p = players_[pl];
+      if (pl == player) {
+        p->notify(fmt::format("You reveal {} cards from your deck:", size));
       } else {
-        fmt::println("Unknown hint type {} with value {}", hint_type, value);
+        p->notify(fmt::format("{} reveals {} cards from their deck:",
+                              players_[player]->nickname_, size));
       }
-    } else if (msg_ == MSG_CARD_HINT) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      uint8_t player = read_u8();
-      uint8_t loc = read_u8();
-      uint8_t seq = read_u8();
-      uint8_t pos = read_u8();
-      uint8_t type = read_u8();
-      uint32_t value = read_u32();
-      if (type == CHINT_RACE) {
-        Card card = get_card(player, loc, seq);
-        if (card.code_ == 0) {
-          return;
-        }
-        std::string races_str = "TODO";
-        for (PlayerId pl = 0; pl < 2; pl++) {
-          players_[pl]->notify(fmt::format("{} ({}) selected {}.",
-                                           card.get_spec(pl), card.name_,
-                                           races_str));
-        }
-      } else if (type == CHINT_ATTRIBUTE) {
-        Card card = get_card(player, loc, seq);
-        if (card.code_ == 0) {
-          return;
-        }
-        std::string attributes_str = "TODO";
-        for (PlayerId pl = 0; pl < 2; pl++) {
-          players_[pl]->notify(fmt::format("{} ({}) selected {}.",
-                                           card.get_spec(pl), card.name_,
-                                           attributes_str));
-        }
-      } else {
-        fmt::println("Unknown card hint type {} with value {}", type, value);
-      }
-    } else if (msg_ == MSG_POS_CHANGE) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      CardCode code = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(read_u32());
-      uint8_t prevpos = card.position_;
-      card.position_ = read_u8();
-
-      auto& pl = players_[card.controler_];
-      auto& op = players_[1 - card.controler_];
-      auto plspec = card.get_spec(false);
-      auto opspec = card.get_spec(true);
-      auto prevpos_str = position_to_string(prevpos);
-      auto pos_str = position_to_string(card.position_);
-      pl->notify("The position of card " + plspec + " (" + card.name_ +
-                 ") changed from " + prevpos_str + " to " + pos_str + ".");
-      op->notify("The position of card " + opspec + " (" + card.name_ +
-                 ") changed from " + prevpos_str + " to " + pos_str + ".");
-    } else if (msg_ == MSG_BECOME_TARGET) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto u = read_u8();
-      uint32_t target = read_u32();
-      uint8_t tc = target & 0xff;
-      uint8_t tl = (target >> 8) & 0xff;
-      uint8_t tseq = (target >> 16) & 0xff;
-      Card card = get_card(tc, tl, tseq);
-      auto name = players_[chaining_player_]->nickname_;
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto spec = card.get_spec(pl);
-        auto tcname = card.name_;
-        if ((card.controler_ != pl) && (card.position_ & POS_FACEDOWN)) {
-          tcname = position_to_string(card.position_) + " card";
-        }
-        players_[pl]->notify(name + " targets " + spec + " (" + tcname + ")");
-      }
-    } else if (msg_ == MSG_CONFIRM_DECKTOP) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto player = read_u8();
-      auto size = read_u8();
-      std::vector<Card> cards;
-      for (int i = 0; i < size; ++i) {
-        read_u32();
-        auto c = read_u8();
-        auto loc = read_u8();
-        auto seq = read_u8();
-        cards.push_back(get_card(c, loc, seq));
+      for (int i = 0; i < size; ++i) {
+        p->notify(fmt::format("{}: {}", i + 1, cards[i].name()));
       }
+    }
+  }
 
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto& p = players_[pl];
-        if (pl == player) {
-          p->notify(fmt::format("You reveal {} cards from your deck:", size));
-        } else {
-          p->notify(fmt::format("{} reveals {} cards from their deck:",
-                                players_[player]->nickname_, size));
-        }
-        for (int i = 0; i < size; ++i) {
-          p->notify(fmt::format("{}: {}", i + 1, cards[i].name_));
-        }
-      }
-    } else if (msg_ == MSG_RANDOM_SELECTED) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto player = read_u8();
-      auto count = read_u8();
-      std::vector<Card> cards;
+  void handle_random_selected() {
+    auto player = read_u8();
+    auto count = read_u8();
+    std::vector<Card> cards;
 
-      for (int i = 0; i < count; ++i) {
-        auto c = read_u8();
-        auto loc = read_u8();
-        if (loc & LOCATION_OVERLAY) {
-          throw std::runtime_error("Overlay not supported for random selected");
-        }
-        auto seq = read_u8();
-        auto pos = read_u8();
-        cards.push_back(get_card(c, loc, seq));
+    for (int i = 0; i < count; ++i) {
+      auto c = read_u8();
+      auto loc = read_u8();
+      if (loc & LOCATION_OVERLAY) {
+        throw std::runtime_error("Overlay not supported for random selected");
       }
+      auto seq = read_u8();
+      auto pos = read_u8();
+      cards.push_back(get_card(c, loc, seq));
+    }
 
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto& p = players_[pl];
-        auto s = "card is";
-        if (count > 1) {
-          s = "cards are";
-        }
-        if (pl == player) {
-          p->notify(fmt::format("Your {} {} randomly selected:", s, count));
-        } else {
-          p->notify(fmt::format("{}'s {} {} randomly selected:",
-                                players_[player]->nickname_, s, count));
-        }
-        for (int i = 0; i < count; ++i) {
-          p->notify(fmt::format("{}: {}", cards[i].get_spec(pl), cards[i].name_));
-        }
-      }
-    } else if (msg_ == MSG_PLAYER_HINT) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      dp_ += 6;
-      // TODO(3): implement output
-    } else if (msg_ == MSG_CARD_TARGET) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto& p = players_[pl];
+      auto s = "card is";
+      if (count > 1) {
+        s = "cards are";
       }
-      auto c1 = read_u8();
-      auto l1 = read_u8();
-      auto s1 = read_u8();
-      read_u8();
-      auto c2 = read_u8();
-      auto l2 = read_u8();
-      auto s2 = read_u8();
-      read_u8();
-
-      Card card1 = get_card(c1, l1, s1);
-      Card card2 = get_card(c2, l2, s2);
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto& p = players_[pl];
-        auto spec1 = card1.get_spec(pl);
-        auto spec2 = card2.get_spec(pl);
-        auto c1name = card1.name_;
-        auto c2name = card2.name_;
-        if ((card1.controler_ != pl) && (card1.position_ & POS_FACEDOWN)) {
-          c1name = position_to_string(card1.position_) + " card";
-        }
-        if ((card2.controler_ != pl) && (card2.position_ & POS_FACEDOWN)) {
-          c2name = position_to_string(card2.position_) + " card";
-        }
-        p->notify(fmt::format(" {} ({}) targets {} ({})", spec1, c1name, spec2, c2name));
-      }
-    } else if (msg_ == MSG_CONFIRM_CARDS) {
-      auto player = read_u8();
-      auto size = read_u8();
-      std::vector<Card> cards;
-      for (int i = 0; i < size; ++i) {
-        read_u32();
-        auto c = read_u8();
-        auto loc = read_u8();
-        auto seq = read_u8();
-        if (verbose_) {
-          cards.push_back(get_card(c, loc, seq));
-        }
-        revealed_.insert(ls_to_spec(loc, seq, 0, c == player));
+      if (pl == player) {
+        p->notify(fmt::format("Your {} {} randomly selected:", s, count));
+      } else {
+        p->notify(fmt::format("{}'s {} {} randomly selected:",
+                              players_[player]->nickname_, s, count));
       }
-      if (!verbose_) {
-        return;
+      for (int i = 0; i < count; ++i) {
+        p->notify(fmt::format("{}: {}", cards[i].get_spec(pl), cards[i].name()));
       }
+    }
+  }
 
-      auto& pl = players_[player];
-      auto& op = players_[1 - player];
+  void handle_player_hint() {
+    dp_ += 6;
+    // TODO(3): implement output
+  }
+
+  void handle_card_target() {
+    auto c1 = read_u8();
+    auto l1 = read_u8();
+    auto s1 = read_u8();
+    read_u8();
+    auto c2 = read_u8();
+    auto l2 = read_u8();
+    auto s2 = read_u8();
+    read_u8();
+
+    Card card1 = get_card(c1, l1, s1);
+    Card card2 = get_card(c2, l2, s2);
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto& p = players_[pl];
+      auto spec1 = card1.get_spec(pl);
+      auto spec2 = card2.get_spec(pl);
+      auto c1name = card1.name();
+      auto c2name = card2.name();
+      if ((card1.controler_ != pl) && (card1.position_ & POS_FACEDOWN)) {
+        c1name = position_to_string(card1.position_) + " card";
+      }
+      if ((card2.controler_ != pl) && (card2.position_ & POS_FACEDOWN)) {
+        c2name = position_to_string(card2.position_) + " card";
+      }
+      p->notify(fmt::format(" {} ({}) targets {} ({})", spec1, c1name, spec2, c2name));
+    }
+  }
 
-      op->notify(fmt::format("{} shows you {} cards.", pl->nickname_, size));
-      for (int i = 0; i < size; ++i) {
-        pl->notify(fmt::format("{}: {}", i + 1, cards[i].name_));
-      }
-    } else if (msg_ == MSG_MISSED_EFFECT) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      dp_ += 4;
-      CardCode code = read_u32();
-      Card card = c_get_card(code);
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto spec = card.get_spec(pl);
-        auto str = get_system_string(1622);
-        std::string fmt_str = "[%ls]";
-        str = str.replace(str.find(fmt_str), fmt_str.length(), card.name_);
-        players_[pl]->notify(str);
-      }
-    } else if (msg_ == MSG_SORT_CARD) {
-      // TODO(3): implement action
-      if (!verbose_) {
-        dp_ = dl_;
-        resp_buf_[0] = 255;
-        YGO_SetResponseb(pduel_, resp_buf_);
-        return;
-      }
-      auto player = read_u8();
-      auto size = read_u8();
-      std::vector<Card> cards;
-      for (int i = 0; i < size; ++i) {
-        read_u32();
-        auto c = read_u8();
-        auto loc = read_u8();
-        auto seq = read_u8();
+  void handle_confirm_cards() {
+    auto player = read_u8();
+    auto size = read_u8();
+    std::vector<Card> cards;
+    for (int i = 0; i < size; ++i) {
+      read_u32();
+      auto c = read_u8();
+      auto loc = read_u8();
+      auto seq = read_u8();
+      if (verbose_) {
         cards.push_back(get_card(c, loc, seq));
       }
-      auto& pl = players_[player];
-      pl->notify(
-          "Sort " + std::to_string(size) +
-          " cards by entering numbers separated by spaces (c = cancel):");
-      for (int i = 0; i < size; ++i) {
-        pl->notify(fmt::format("{}: {}", i + 1, cards[i].name_));
-      }
+      revealed_.insert(ls_to_spec_key(loc, seq, 0, c == player));
+    }
+    if (!verbose_) {
+      return;
+    }
+
+    auto& pl = players_[player];
+    auto& op = players_[1 - player];
+
+    op->notify(fmt::format("{} shows you {} cards.", pl->nickname_, size));
+    for (int i = 0; i < size; ++i) {
+      pl->notify(fmt::format("{}: {}", i + 1, cards[i].name()));
+    }
+  }
+
+  void handle_missed_effect() {
+    dp_ += 4;
+    CardCode code = read_u32();
+    Card card = c_get_card(code);
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto spec = card.get_spec(pl);
+      auto str = get_system_string(1622);
+      std::string fmt_str = "[%ls]";
+      str = str.replace(str.find(fmt_str), fmt_str.length(), card.name());
+      players_[pl]->notify(str);
+    }
+  }
 
-      fmt::println("sort card action not implemented");
+  void handle_sort_card() {
+    // TODO(3): implement action
+    if (!verbose_) {
+      dp_ = dl_;
       resp_buf_[0] = 255;
       YGO_SetResponseb(pduel_, resp_buf_);
-
-      // // generate all permutations
-      // std::vector<int> perm(size);
-      // std::iota(perm.begin(), perm.end(), 0);
-      // std::vector<std::vector<int>> perms;
-      // do {
-      //   auto option = std::accumulate(perm.begin(), perm.end(),
-      //   std::string(),
-      //                                 [&](std::string &acc, int i) {
-      //                                   return acc + std::to_string(i + 1) +
-      //                                   " ";
-      //                                 });
-      //   options_.push_back(option);
-      // } while (std::next_permutation(perm.begin(), perm.end()));
-      // options_.push_back("c");
-      // callback_ = [this](int idx) {
-      //   const auto &option = options_[idx];
-      //   if (option == "c") {
-      //     resp_buf_[0] = 255;
-      //     YGO_SetResponseb(pduel_, resp_buf_);
-      //     return;
-      //   }
-      //   std::istringstream iss(option);
-      //   int x;
-      //   int i = 0;
-      //   while (iss >> x) {
-      //     resp_buf_[i] = uint8_t(x);
-      //     i++;
-      //   }
-      //   YGO_SetResponseb(pduel_, resp_buf_);
-      // };
-    } else if (msg_ == MSG_ADD_COUNTER) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto ctype = read_u16();
-      auto player = read_u8();
-      auto loc = read_u8();
-      auto seq = read_u8();
-      auto count = read_u16();
-      auto c = get_card(player, loc, seq);
-      auto& pl = players_[player];
-      PlayerId op_id = 1 - player;
-      auto& op = players_[op_id];
-      // TODO(3): counter type to string
-      pl->notify(fmt::format("{} counter(s) of type {} placed on {} ().", count, "UNK", c.name_, c.get_spec(player)));
-      op->notify(fmt::format("{} counter(s) of type {} placed on {} ().", count, "UNK", c.name_, c.get_spec(op_id)));
-    } else if (msg_ == MSG_REMOVE_COUNTER) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto ctype = read_u16();
-      auto player = read_u8();
+      return;
+    }
+    auto player = read_u8();
+    auto size = read_u8();
+    std::vector<Card> cards;
+    for (int i = 0; i < size; ++i) {
+      read_u32();
+      auto c = read_u8();
       auto loc = read_u8();
       auto seq = read_u8();
-      auto count = read_u16();
-      auto c = get_card(player, loc, seq);
-      auto& pl = players_[player];
-      PlayerId op_id = 1 - player;
-      auto& op = players_[op_id];
-      pl->notify(fmt::format("{} counter(s) of type {} removed from {} ().", count, "UNK", c.name_, c.get_spec(player)));
-      op->notify(fmt::format("{} counter(s) of type {} removed from {} ().", count, "UNK", c.name_, c.get_spec(op_id)));
-    } else if (msg_ == MSG_ATTACK_DISABLED) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        players_[pl]->notify(get_system_string(1621));
-      }
-    } else if (msg_ == MSG_SHUFFLE_SET_CARD) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      // TODO(3): implement output
-      dp_ = dl_;
-    } else if (msg_ == MSG_SHUFFLE_DECK) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto player = read_u8();
-      auto& pl = players_[player];
-      auto& op = players_[1 - player];
-      pl->notify("You shuffled your deck.");
-      op->notify(pl->nickname_ + " shuffled their deck.");
-    } else if (msg_ == MSG_SHUFFLE_EXTRA) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto player = read_u8();
-      auto count = read_u8();
-      for (int i = 0; i < count; ++i) {
-        read_u32();
-      }
-      auto& pl = players_[player];
-      auto& op = players_[1 - player];
-      pl->notify(fmt::format("You shuffled your extra deck ({}).", count));
-      op->notify(fmt::format("{} shuffled their extra deck ({}).", pl->nickname_, count));
-    } else if (msg_ == MSG_SHUFFLE_HAND) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
+      cards.push_back(get_card(c, loc, seq));
+    }
+    auto& pl = players_[player];
+    pl->notify(
+        "Sort " + std::to_string(size) +
+        " cards by entering numbers separated by spaces (c = cancel):");
+    for (int i = 0; i < size; ++i) {
+      pl->notify(fmt::format("{}: {}", i + 1, cards[i].name()));
+    }
 
-      auto player = read_u8();
-      dp_ = dl_;
+    fmt::println("sort card action not implemented");
+    resp_buf_[0] = 255;
+    YGO_SetResponseb(pduel_, resp_buf_);
 
-      auto& pl = players_[player];
-      auto& op = players_[1 - player];
-      pl->notify("You shuffled your hand.");
-      op->notify(pl->nickname_ + " shuffled their hand.");
-    } else if (msg_ == MSG_SUMMONED) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_SUMMONING) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      CardCode code = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(read_u32());
-      const auto &nickname = players_[card.controler_]->nickname_;
-      for (auto& pl : players_) {
-        pl->notify(nickname + " summoning " + card.name_ + " (" +
-                   std::to_string(card.attack_) + "/" +
-                   std::to_string(card.defense_) + ") in " +
-                   card.get_position() + " position.");
-      }
-    } else if (msg_ == MSG_SPSUMMONED) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_FLIPSUMMONED) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_FLIPSUMMONING) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
+    // // generate all permutations
+    // std::vector<int> perm(size);
+    // std::iota(perm.begin(), perm.end(), 0);
+    // std::vector<std::vector<int>> perms;
+    // do {
+    //   auto option = std::accumulate(perm.begin(), perm.end(),
+    //   std::string(),
+    //                                 [&](std::string &acc, int i) {
+    //                                   return acc + std::to_string(i + 1) +
+    //                                   " ";
+    //                                 });
+    //   options_.push_back(option);
+    // } while (std::next_permutation(perm.begin(), perm.end()));
+    // options_.push_back("c");
+    // callback_ = [this](int idx) {
+    //   const auto &option = options_[idx];
+    //   if (option == "c") {
+    //     resp_buf_[0] = 255;
+    //     YGO_SetResponseb(pduel_, resp_buf_);
+    //     return;
+    //   }
+    //   std::istringstream iss(option);
+    //   int x;
+    //   int i = 0;
+    //   while (iss >> x) {
+    //     resp_buf_[i] = uint8_t(x);
+    //     i++;
+    //   }
+    //   YGO_SetResponseb(pduel_, resp_buf_);
+    // };
+  }
+
+  void handle_add_counter() {
+    auto ctype = read_u16();
+    auto player = read_u8();
+    auto loc = read_u8();
+    auto seq = read_u8();
+    auto count = read_u16();
+    auto c = get_card(player, loc, seq);
+    auto& pl = players_[player];
+    PlayerId op_id = 1 - player;
+    auto& op = players_[op_id];
+    // TODO(3): counter type to string
+    pl->notify(fmt::format("{} counter(s) of type {} placed on {} ().", count, "UNK", c.name(), c.get_spec(player)));
+    op->notify(fmt::format("{} counter(s) of type {} placed on {} ().", count, "UNK", c.name(), c.get_spec(op_id)));
+  }
+
+  void handle_remove_counter() {
+    auto ctype = read_u16();
+    auto player = read_u8();
+    auto loc = read_u8();
+    auto seq = read_u8();
+    auto count = read_u16();
+    auto c = get_card(player, loc, seq);
+    auto& pl = players_[player];
+    PlayerId op_id = 1 - player;
+    auto& op = players_[op_id];
+    pl->notify(fmt::format("{} counter(s) of type {} removed from {} ().", count, "UNK", c.name(), c.get_spec(player)));
+    op->notify(fmt::format("{} counter(s) of type {} removed from {} ().", count, "UNK", c.name(), c.get_spec(op_id)));
+  }
+
+  void handle_attack_disabled() {
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      players_[pl]->notify(get_system_string(1621));
+    }
+  }
 
-      auto code = read_u32();
-      auto location = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(location);
+  void handle_shuffle_set_card() {
+    // TODO(3): implement output
+    dp_ = dl_;
+  }
 
-      auto& cpl = players_[card.controler_];
-      for (PlayerId pl = 0; pl < 2; pl++) {
-        auto spec = card.get_spec(pl);
-        players_[1 - pl]->notify(cpl->nickname_ + " flip summons " + spec +
-                                 " (" + card.name_ + ")");
-      }
-    } else if (msg_ == MSG_SPSUMMONING) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      CardCode code = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(read_u32());
-      const auto &nickname = players_[card.controler_]->nickname_;
-      for (PlayerId p = 0; p < 2; p++) {
-        auto& pl = players_[p];
-        auto pos = card.get_position();
-        auto atk = std::to_string(card.attack_);
-        auto def = std::to_string(card.defense_);
-        std::string name = p == card.controler_ ? "You" : nickname;
-        if (card.type_ & TYPE_LINK) {
-          pl->notify(name + " special summoning " + card.name_ + " (" +
-                     atk + ") in " + pos + " position.");
-        } else {
-          pl->notify(name + " special summoning " + card.name_ + " (" +
-                     atk + "/" + def + ") in " + pos + " position.");
-        }
-      }
-    } else if (msg_ == MSG_CHAIN_NEGATED) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_CHAIN_DISABLED) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_CHAIN_SOLVED) {
-      dp_ = dl_;
-      revealed_.clear();
-    } else if (msg_ == MSG_CHAIN_SOLVING) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_CHAINED) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_CHAIN_END) {
-      dp_ = dl_;
-    } else if (msg_ == MSG_CHAINING) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      CardCode code = read_u32();
-      Card card = c_get_card(code);
-      card.set_location(read_u32());
-      auto tc = read_u8();
-      auto tl = read_u8();
-      auto ts = read_u8();
-      uint32_t desc = read_u32();
-      auto cs = read_u8();
-      auto c = card.controler_;
-      PlayerId o = 1 - c;
-      chaining_player_ = c;
-      players_[c]->notify("Activating " + card.get_spec(c) + " (" + card.name_ +
-                          ")");
-      players_[o]->notify(players_[c]->nickname_ + " activating " +
-                          card.get_spec(o) + " (" + card.name_ + ")");
-    } else if (msg_ == MSG_DAMAGE) {
-      auto player = read_u8();
-      auto amount = read_u32();
-      _damage(player, amount);
-    } else if (msg_ == MSG_RECOVER) {
-      auto player = read_u8();
-      auto amount = read_u32();
-      _recover(player, amount);
-    } else if (msg_ == MSG_LPUPDATE) {
-      auto player = read_u8();
-      auto lp = read_u32();
-      if (lp >= lp_[player]) {
-        _recover(player, lp - lp_[player]);
+  void handle_shuffle_deck() {
+    auto player = read_u8();
+    auto& pl = players_[player];
+    auto& op = players_[1 - player];
+    pl->notify("You shuffled your deck.");
+    op->notify(pl->nickname_ + " shuffled their deck.");
+  }
+
+  void handle_shuffle_extra() {
+    auto player = read_u8();
+    auto count = read_u8();
+    for (int i = 0; i < count; ++i) {
+      read_u32();
+    }
+    auto& pl = players_[player];
+    auto& op = players_[1 - player];
+    pl->notify(fmt::format("You shuffled your extra deck ({}).", count));
+    op->notify(fmt::format("{} shuffled their extra deck ({}).", pl->nickname_, count));
+  }
+
+  void handle_shuffle_hand() {
+    auto player = read_u8();
+    dp_ = dl_;
+
+    auto& pl = players_[player];
+    auto& op = players_[1 - player];
+    pl->notify("You shuffled your hand.");
+    op->notify(pl->nickname_ + " shuffled their hand.");
+  }
+
+  void handle_summoning() {
+    CardCode code = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(read_u32());
+    const auto &nickname = players_[card.controler_]->nickname_;
+    for (auto& pl : players_) {
+      pl->notify(nickname + " summoning " + card.name() + " (" +
+                 std::to_string(card.attack_) + "/" +
+                 std::to_string(card.defense_) + ") in " +
+                 card.get_position() + " position.");
+    }
+  }
+
+  void handle_flipsummoning() {
+    auto code = read_u32();
+    auto location = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(location);
+
+    auto& cpl = players_[card.controler_];
+    for (PlayerId pl = 0; pl < 2; pl++) {
+      auto spec = card.get_spec(pl);
+      players_[1 - pl]->notify(cpl->nickname_ + " flip summons " + spec +
+                               " (" + card.name() + ")");
+    }
+  }
+
+  void handle_spsummoning() {
+    CardCode code = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(read_u32());
+    const auto &nickname = players_[card.controler_]->nickname_;
+    for (PlayerId p = 0; p < 2; p++) {
+      auto& pl = players_[p];
+      auto pos = card.get_position();
+      auto atk = std::to_string(card.attack_);
+      auto def = std::to_string(card.defense_);
+      std::string name = p == card.controler_ ? "You" : nickname;
+      if (card.type_ & TYPE_LINK) {
+        pl->notify(name + " special summoning " + card.name() + " (" +
+                   atk + ") in " + pos + " position.");
       } else {
-        _damage(player, lp_[player] - lp);
-      }
-    } else if (msg_ == MSG_PAY_LPCOST) {
-      auto player = read_u8();
-      auto cost = read_u32();
-      lp_[player] -= cost;
-      if (!verbose_) {
-        return;
-      }
-      auto& pl = players_[player];
-      pl->notify("You pay " + std::to_string(cost) + " LP. Your LP is now " +
-                 std::to_string(lp_[player]) + ".");
-      players_[1 - player]->notify(
-          pl->nickname_ + " pays " + std::to_string(cost) + " LP. " +
-          pl->nickname_ + "'s LP is now " + std::to_string(lp_[player]) + ".");
-    } else if (msg_ == MSG_ATTACK) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
-      }
-      auto attacker = read_u32();
-      PlayerId ac = attacker & 0xff;
-      auto aloc = (attacker >> 8) & 0xff;
-      auto aseq = (attacker >> 16) & 0xff;
-      auto apos = (attacker >> 24) & 0xff;
-      auto target = read_u32();
-      PlayerId tc = target & 0xff;
-      auto tloc = (target >> 8) & 0xff;
-      auto tseq = (target >> 16) & 0xff;
-      auto tpos = (target >> 24) & 0xff;
-
-      if ((ac == 0) && (aloc == 0) && (aseq == 0) && (apos == 0)) {
-        return;
+        pl->notify(name + " special summoning " + card.name() + " (" +
+                   atk + "/" + def + ") in " + pos + " position.");
       }
+    }
+  }
 
-      Card acard = get_card(ac, aloc, aseq);
-      auto name = players_[ac]->nickname_;
-      if ((tc == 0) && (tloc == 0) && (tseq == 0) && (tpos == 0)) {
-        for (PlayerId i = 0; i < 2; i++) {
-          players_[i]->notify(name + " prepares to attack with " +
-                              acard.get_spec(i) + " (" + acard.name_ + ")");
-        }
-        return;
-      }
+  void handle_chain_solved() {
+    dp_ = dl_;
+    revealed_.clear();
+  }
+
+  void handle_chaining() {
+    CardCode code = read_u32();
+    Card card = c_get_card(code);
+    card.set_location(read_u32());
+    auto tc = read_u8();
+    auto tl = read_u8();
+    auto ts = read_u8();
+    uint32_t desc = read_u32();
+    auto cs = read_u8();
+    auto c = card.controler_;
+    PlayerId o = 1 - c;
+    chaining_player_ = c;
+    players_[c]->notify("Activating " + card.get_spec(c) + " (" + card.name() +
+                        ")");
+    players_[o]->notify(players_[c]->nickname_ + " activating " +
+                        card.get_spec(o) + " (" + card.name() + ")");
+  }
+
+  void handle_damage() {
+    auto player = read_u8();
+    auto amount = read_u32();
+    _damage(player, amount);
+  }
+
+  void handle_recover() {
+    auto player = read_u8();
+    auto amount = read_u32();
+    _recover(player, amount);
+  }
+
+  void handle_lpupdate() {
+    auto player = read_u8();
+    auto lp = read_u32();
+    if (lp >= lp_[player]) {
+      _recover(player, lp - lp_[player]);
+    } else {
+      _damage(player, lp_[player] - lp);
+    }
+  }
+
+  void handle_pay_lpcost() {
+    auto player = read_u8();
+    auto cost = read_u32();
+    lp_[player] -= cost;
+    if (!verbose_) {
+      return;
+    }
+    auto& pl = players_[player];
+    pl->notify("You pay " + std::to_string(cost) + " LP. Your LP is now " +
+               std::to_string(lp_[player]) + ".");
+    players_[1 - player]->notify(
+        pl->nickname_ + " pays " + std::to_string(cost) + " LP. " +
+        pl->nickname_ + "'s LP is now " + std::to_string(lp_[player]) + ".");
+  }
+
+  void handle_attack() {
+    auto attacker = read_u32();
+    PlayerId ac = attacker & 0xff;
+    auto aloc = (attacker >> 8) & 0xff;
+    auto aseq = (attacker >> 16) & 0xff;
+    auto apos = (attacker >> 24) & 0xff;
+    auto target = read_u32();
+    PlayerId tc = target & 0xff;
+    auto tloc = (target >> 8) & 0xff;
+    auto tseq = (target >> 16) & 0xff;
+    auto tpos = (target >> 24) & 0xff;
+
+    if ((ac == 0) && (aloc == 0) && (aseq == 0) && (apos == 0)) {
+      return;
+    }
 
-      Card tcard = get_card(tc, tloc, tseq);
+    Card acard = get_card(ac, aloc, aseq);
+    auto name = players_[ac]->nickname_;
+    if ((tc == 0) && (tloc == 0) && (tseq == 0) && (tpos == 0)) {
       for (PlayerId i = 0; i < 2; i++) {
-        auto aspec = acard.get_spec(i);
-        auto tspec = tcard.get_spec(i);
-        auto tcname = tcard.name_;
-        if ((tcard.controler_ != i) && (tcard.position_ & POS_FACEDOWN)) {
-          tcname = tcard.get_position() + " card";
-        }
-        players_[i]->notify(name + " prepares to attack " + tspec + " (" +
-                            tcname + ") with " + aspec + " (" + acard.name_ +
-                            ")");
-      }
-    } else if (msg_ == MSG_DAMAGE_STEP_START) {
-      if (!verbose_) {
-        return;
-      }
-      for (int i = 0; i < 2; i++) {
-        players_[i]->notify("begin damage");
+        players_[i]->notify(name + " prepares to attack with " +
+                            acard.get_spec(i) + " (" + acard.name() + ")");
       }
-    } else if (msg_ == MSG_DAMAGE_STEP_END) {
-      if (!verbose_) {
-        return;
-      }
-      for (int i = 0; i < 2; i++) {
-        players_[i]->notify("end damage");
-      }
-    } else if (msg_ == MSG_BATTLE) {
-      if (!verbose_) {
-        dp_ = dl_;
-        return;
+      return;
+    }
+
+    Card tcard = get_card(tc, tloc, tseq);
+    for (PlayerId i = 0; i < 2; i++) {
+      auto aspec = acard.get_spec(i);
+      auto tspec = tcard.get_spec(i);
+      auto tcname = tcard.name();
+      if ((tcard.controler_ != i) && (tcard.position_ & POS_FACEDOWN)) {
+        tcname = tcard.get_position() + " card";
+      }
+      players_[i]->notify(name + " prepares to attack " + tspec + " (" +
+                          tcname + ") with " + aspec + " (" + acard.name() +
+                          ")");
+    }
+  }
+
+  void handle_damage_step_start() {
+    if (!verbose_) {
+      return;
+    }
+    for (int i = 0; i < 2; i++) {
+      players_[i]->notify("begin damage");
+    }
+  }
+
+  void handle_damage_step_end() {
+    if (!verbose_) {
+      return;
+    }
+    for (int i = 0; i < 2; i++) {
+      players_[i]->notify("end damage");
+    }
+  }
+
+  void handle_battle() {
+    auto attacker = read_u32();
+    auto aa = read_u32();
+    auto ad = read_u32();
+    auto bd0 = read_u8();
+    auto target = read_u32();
+    auto da = read_u32();
+    auto dd = read_u32();
+    auto bd1 = read_u8();
+
+    auto ac = attacker & 0xff;
+    auto aloc = (attacker >> 8) & 0xff;
+    auto aseq = (attacker >> 16) & 0xff;
+
+    auto tc = target & 0xff;
+    auto tloc = (target >> 8) & 0xff;
+    auto tseq = (target >> 16) & 0xff;
+    auto tpos = (target >> 24) & 0xff;
+
+    Card acard = get_card(ac, aloc, aseq);
+    Card tcard;
+    if (tloc != 0) {
+      tcard = get_card(tc, tloc, tseq);
+    }
+    for (int i = 0; i < 2; i++) {
+      auto& pl = players_[i];
+      std::string attacker_points;
+      if (acard.type_ & TYPE_LINK) {
+        attacker_points = std::to_string(aa);
+      } else {
+        attacker_points = std::to_string(aa) + "/" + std::to_string(ad);
       }
-      auto attacker = read_u32();
-      auto aa = read_u32();
-      auto ad = read_u32();
-      auto bd0 = read_u8();
-      auto target = read_u32();
-      auto da = read_u32();
-      auto dd = read_u32();
-      auto bd1 = read_u8();
-
-      auto ac = attacker & 0xff;
-      auto aloc = (attacker >> 8) & 0xff;
-      auto aseq = (attacker >> 16) & 0xff;
-
-      auto tc = target & 0xff;
-      auto tloc = (target >> 8) & 0xff;
-      auto tseq = (target >> 16) & 0xff;
-      auto tpos = (target >> 24) & 0xff;
-
-      Card acard = get_card(ac, aloc, aseq);
-      Card tcard;
       if (tloc != 0) {
-        tcard = get_card(tc, tloc, tseq);
-      }
-      for (int i = 0; i < 2; i++) {
-        auto& pl = players_[i];
-        std::string attacker_points;
-        if (acard.type_ & TYPE_LINK) {
-          attacker_points = std::to_string(aa);
+        std::string defender_points;
+        if (tcard.type_ & TYPE_LINK) {
+          defender_points = std::to_string(da);
         } else {
-          attacker_points = std::to_string(aa) + "/" + std::to_string(ad);
-        }
-        if (tloc != 0) {
-          std::string defender_points;
-          if (tcard.type_ & TYPE_LINK) {
-            defender_points = std::to_string(da);
-          } else {
-            defender_points = std::to_string(da) + "/" + std::to_string(dd);
-          }
-          pl->notify(acard.name_ + "(" + attacker_points + ")" + " attacks " +
-                     tcard.name_ + " (" + defender_points + ")");
-        } else {
-          pl->notify(acard.name_ + "(" + attacker_points + ")" + " attacks");
+          defender_points = std::to_string(da) + "/" + std::to_string(dd);
         }
+        pl->notify(acard.name() + "(" + attacker_points + ")" + " attacks " +
+                   tcard.name() + " (" + defender_points + ")");
+      } else {
+        pl->notify(acard.name() + "(" + attacker_points + ")" + " attacks");
       }
-    } else if (msg_ == MSG_WIN) {
-      auto player = read_u8();
-      auto reason = read_u8();
-      auto& winner = players_[player];
-      auto& loser = players_[1 - player];
+    }
+  }
 
-      _duel_end(player, reason);
+  void handle_win() {
+    auto player = read_u8();
+    auto reason = read_u8();
+    auto& winner = players_[player];
+    auto& loser = players_[1 - player];
 
-      auto l_reason = reason_to_string(reason);
-      if (verbose_) {
-        winner->notify("You won (" + l_reason + ").");
-        loser->notify("You lost (" + l_reason + ").");
-      }
-    } else if (msg_ == MSG_RETRY) {
-      throw std::runtime_error("Retry");
-    } else if (msg_ == MSG_SELECT_BATTLECMD) {
-      auto player = read_u8();
-      auto activatable = read_cardlist_spec(player, true);
-      auto attackable = read_cardlist_spec(player, true, true);
-      bool to_m2 = read_u8();
-      bool to_ep = read_u8();
+    _duel_end(player, reason);
 
-      auto& pl = players_[player];
-      if (verbose_) {
-        pl->notify("Battle menu:");
+    auto l_reason = reason_to_string(reason);
+    if (verbose_) {
+      winner->notify("You won (" + l_reason + ").");
+      loser->notify("You lost (" + l_reason + ").");
+    }
+  }
+
+  void handle_retry() {
+    throw std::runtime_error("Retry");
+  }
+
+  void handle_select_battlecmd() {
+    auto player = read_u8();
+    const auto &activatable = read_cardlist_spec(player, card_specs_[0], true);
+    const auto &attackable = read_cardlist_spec(player, card_specs_[1], true, true);
+    bool to_m2 = read_u8();
+    bool to_ep = read_u8();
+
+    auto& pl = players_[player];
+    if (verbose_) {
+      pl->notify("Battle menu:");
+    }
+    for (const auto [code_t, spec, desc] : activatable) {
+      CardCode code = code_t;
+      if(code & 0x80000000) {
+        code &= 0x7fffffff;
       }
-      for (const auto [code_t, spec, desc] : activatable) {
-        CardCode code = code_t;
-        if(code & 0x80000000) {
-          code &= 0x7fffffff;
-        }
-        auto [code_d, eff_idx] = unpack_desc(code, desc);
-        if (desc == 0) {
-          code_d = code;
-        }
-        auto la = LegalAction::activate_spec(eff_idx, spec);
-        if (code_d != 0) {
-          la.cid_ = c_get_card_id(code_d);
-        }
-        legal_actions_.push_back(la);
-        if (verbose_) {
-          auto c = c_get_card(code);
-          int cmd_idx = legal_actions_.size();
-          std::string s = fmt::format(
-            "{}: activate {}({}) [{}/{}] ({})",
-            cmd_idx, c.name_, spec, c.attack_, c.defense_, c.get_effect_description(code_d, eff_idx));
-        }
+      auto [code_d, eff_idx] = unpack_desc(code, desc);
+      if (desc == 0) {
+        code_d = code;
+      }
+      auto la = LegalAction::activate_spec(eff_idx, spec);
+      if (code_d != 0) {
+        la.cid_ = c_get_card_id(code_d);
       }
-      for (const auto [code, spec, data] : attackable) {
-        bool direct_attackable = data & 0x1;
-        auto act = direct_attackable ? ActionAct::DirectAttack : ActionAct::Attack;
+      la.response_ = uint32_t(legal_actions_.size()) << 16;
+      legal_actions_.push_back(la);
+      if (verbose_) {
+        auto c = c_get_card(code);
+        int cmd_idx = legal_actions_.size();
+        std::string s = fmt::format(
+          "{}: activate {}({}) [{}/{}] ({})",
+          cmd_idx, c.name(), spec_key_to_string(spec), c.attack_, c.defense_, c.get_effect_description(code_d, eff_idx));
+      }
+    }
+    for (const auto [code, spec, data] : attackable) {
+      bool direct_attackable = data & 0x1;
+      auto act = direct_attackable ? ActionAct::DirectAttack : ActionAct::Attack;
 
-        legal_actions_.push_back(
-          LegalAction::act_spec(act, spec));
-        if (verbose_) {
-          auto [controller, loc, seq, pos] = spec_to_ls(player, spec);
-          auto c = get_card(controller, loc, seq);
-          int cmd_idx = legal_actions_.size();
-          auto attack_str = direct_attackable ? "direct attack" : "attack";
-          std::string s = fmt::format(
-            "{}: {} {}({}) ", cmd_idx, attack_str, c.name_, spec);
-          if (c.type_ & TYPE_LINK) {
-            s += fmt::format("[{}]", c.attack_);
-          } else {
-            s += fmt::format("[{}/{}]", c.attack_, c.defense_);
-          }
-          pl->notify(s);
+      auto la = LegalAction::act_spec(act, spec);
+      la.response_ = (uint32_t(legal_actions_.size() - activatable.size()) << 16) + 1;
+      legal_actions_.push_back(la);
+      if (verbose_) {
+        auto [controller, loc, seq, pos] = spec_key_to_ls(player, spec);
+        auto c = get_card(controller, loc, seq);
+        int cmd_idx = legal_actions_.size();
+        auto attack_str = direct_attackable ? "direct attack" : "attack";
+        std::string s = fmt::format(
+          "{}: {} {}({}) ", cmd_idx, attack_str, c.name(), spec_key_to_string(spec));
+        if (c.type_ & TYPE_LINK) {
+          s += fmt::format("[{}]", c.attack_);
+        } else {
+          s += fmt::format("[{}/{}]", c.attack_, c.defense_);
         }
+        pl->notify(s);
       }
-      if (to_m2) {
-        legal_actions_.push_back(
-          LegalAction::phase(ActionPhase::Main2));
+    }
+    if (to_m2) {
+      auto la = LegalAction::phase(ActionPhase::Main2);
+      la.response_ = 2;
+      legal_actions_.push_back(la);
+      int cmd_idx = legal_actions_.size();
+      if (verbose_) {
+        pl->notify(fmt::format("{}: Main phase 2.", cmd_idx));
+      }
+    }
+    if (to_ep) {
+      if (!to_m2) {
+        auto la = LegalAction::phase(ActionPhase::End);
+        la.response_ = 3;
+        legal_actions_.push_back(la);
         int cmd_idx = legal_actions_.size();
         if (verbose_) {
-          pl->notify(fmt::format("{}: Main phase 2.", cmd_idx));
+          pl->notify(fmt::format("{}: End phase.", cmd_idx));
         }
       }
-      if (to_ep) {
-        if (!to_m2) {
-          legal_actions_.push_back(
-            LegalAction::phase(ActionPhase::End));
-          int cmd_idx = legal_actions_.size();
-          if (verbose_) {
-            pl->notify(fmt::format("{}: End phase.", cmd_idx));
-          }
-        }
+    }
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env.YGO_SetResponsei(env.pduel_, env.legal_actions_[idx].response_);
+    };
+  }
+
+  void handle_select_unselect_card() {
+    // TODO: add feature of selected cards (also for multi select)
+    auto player = read_u8();
+    bool finishable = read_u8();
+    bool cancelable = read_u8();
+    auto min = read_u8();
+    auto max = read_u8();
+    auto select_size = read_u8();
+
+    auto &select_specs = select_specs_;
+    select_specs.clear();
+    if (verbose_) {
+      auto& pl = players_[player];
+      pl->notify("Select " + std::to_string(min) + " to " +
+                 std::to_string(max) + " cards:");
+      for (int i = 0; i < select_size; ++i) {
+        auto code = read_u32();
+        auto loc = read_u32();
+        Card card = c_get_card(code);
+        card.set_location(loc);
+        auto spec = card.get_spec(player);
+        select_specs.push_back(card.get_spec_key(player));
+        auto s = fmt::format("{}: {}({})", i + 1, card.name(), spec);
+        pl->notify(s);
       }
-      int n_activatables = activatable.size();
-      int n_attackables = attackable.size();
-      to_play_ = player;
-      callback_ = [this, n_activatables, n_attackables, to_ep, to_m2](int idx) {
-        const auto &la = legal_actions_[idx];
-        if (idx < n_activatables) {
-          YGO_SetResponsei(pduel_, idx << 16);
-        } else if (idx < (n_activatables + n_attackables)) {
-          idx = idx - n_activatables;
-          YGO_SetResponsei(pduel_, (idx << 16) + 1);
-        } else if ((la.phase_ == ActionPhase::End) && to_ep) {
-          YGO_SetResponsei(pduel_, 3);
-        } else if ((la.phase_ == ActionPhase::Main2) && to_m2) {
-          YGO_SetResponsei(pduel_, 2);
-        } else {
-          throw std::runtime_error("Invalid option");
-        }
-      };
-    } else if (msg_ == MSG_SELECT_UNSELECT_CARD) {
-      // TODO: add feature of selected cards (also for multi select)
-      auto player = read_u8();
-      bool finishable = read_u8();
-      bool cancelable = read_u8();
-      auto min = read_u8();
-      auto max = read_u8();
-      auto select_size = read_u8();
-
-      std::vector<std::string> select_specs;
-      select_specs.reserve(select_size);
-      if (verbose_) {
-        auto& pl = players_[player];
-        pl->notify("Select " + std::to_string(min) + " to " +
-                   std::to_string(max) + " cards:");
-        for (int i = 0; i < select_size; ++i) {
-          auto code = read_u32();
-          auto loc = read_u32();
-          Card card = c_get_card(code);
-          card.set_location(loc);
-          auto spec = card.get_spec(player);
-          select_specs.push_back(spec);
-          auto s = fmt::format("{}: {}({})", i + 1, card.name_, spec);
-          pl->notify(s);
-        }
-      } else {
-        for (int i = 0; i < select_size; ++i) {
-          dp_ += 4;
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto pos = read_u8();
-          auto spec = ls_to_spec(loc, seq, pos, controller != player);
-          select_specs.push_back(spec);
-        }
+    } else {
+      for (int i = 0; i < select_size; ++i) {
+        dp_ += 4;
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto pos = read_u8();
+        auto spec = ls_to_spec_key(loc, seq, pos, controller != player);
+        select_specs.push_back(spec);
       }
+    }
 
-      auto unselect_size = read_u8();
+    auto unselect_size = read_u8();
 
-      // unselect not allowed (no regrets)
-      dp_ += 8 * unselect_size;
+    // unselect not allowed (no regrets)
+    dp_ += 8 * unselect_size;
 
-      for (int j = 0; j < select_specs.size(); ++j) {
-        legal_actions_.push_back(LegalAction::from_spec(select_specs[j]));
-      }
+    for (int j = 0; j < select_specs.size(); ++j) {
+      legal_actions_.push_back(LegalAction::from_spec(select_specs[j]));
+    }
 
-      if (finishable) {
-        legal_actions_.push_back(LegalAction::finish());
+    if (finishable) {
+      legal_actions_.push_back(LegalAction::finish());
+    }
+
+    // cancelable and finishable not needed
+
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      if (env.legal_actions_[idx].finish_) {
+        env.YGO_SetResponsei(env.pduel_, -1);
+      } else {
+        env.resp_buf_[0] = 1;
+        env.resp_buf_[1] = idx;
+        env.YGO_SetResponseb(env.pduel_, env.resp_buf_);
       }
+    };
 
-      // cancelable and finishable not needed
+  }
 
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        if (legal_actions_[idx].finish_) {
-          YGO_SetResponsei(pduel_, -1);
-        } else {
-          resp_buf_[0] = 1;
-          resp_buf_[1] = idx;
-          YGO_SetResponseb(pduel_, resp_buf_);
-        }
-      };
+  void handle_select_card() {
+    auto player = read_u8();
+    bool cancelable = read_u8();
+    auto min = read_u8();
+    auto max = read_u8();
+    auto size = read_u8();
 
-    } else if (msg_ == MSG_SELECT_CARD) {
-      auto player = read_u8();
-      bool cancelable = read_u8();
-      auto min = read_u8();
-      auto max = read_u8();
-      auto size = read_u8();
+    if (min == 0) {
+      throw std::runtime_error("Min == 0 not implemented for select card");
+    }
 
-      if (min == 0) {
-        throw std::runtime_error("Min == 0 not implemented for select card");
+    auto &specs = select_specs_;
+    specs.clear();
+    if (verbose_) {
+      std::vector<Card> cards;
+      for (int i = 0; i < size; ++i) {
+        auto code = read_u32();
+        auto loc = read_u32();
+        Card card = c_get_card(code);
+        card.set_location(loc);
+        cards.push_back(card);
       }
-
-      std::vector<std::string> specs;
-      specs.reserve(size);
-      if (verbose_) {
-        std::vector<Card> cards;
-        for (int i = 0; i < size; ++i) {
-          auto code = read_u32();
-          auto loc = read_u32();
-          Card card = c_get_card(code);
-          card.set_location(loc);
-          cards.push_back(card);
-        }
-        auto& pl = players_[player];
-        pl->notify("Select " + std::to_string(min) + " to " +
-                   std::to_string(max) + " cards separated by spaces:");
-        for (const auto &card : cards) {
-          auto spec = card.get_spec(player);
-          specs.push_back(spec);
-          int i = specs.size();
-          if (card.controler_ != player && card.position_ & POS_FACEDOWN) {
-            pl->notify(
-              fmt::format("{}: {} card ({})", i, card.get_position(), spec));
-          } else {
-            pl->notify(
-              fmt::format("{}: {} ({})", i, card.name_, spec));
-          }
-        }
-      } else {
-        for (int i = 0; i < size; ++i) {
-          dp_ += 4;
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto pos = read_u8();
-          auto spec = ls_to_spec(loc, seq, pos, controller != player);
-          specs.push_back(spec);
+      auto& pl = players_[player];
+      pl->notify("Select " + std::to_string(min) + " to " +
+                 std::to_string(max) + " cards separated by spaces:");
+      for (const auto &card : cards) {
+        auto spec = card.get_spec(player);
+        specs.push_back(card.get_spec_key(player));
+        int i = specs.size();
+        if (card.controler_ != player && card.position_ & POS_FACEDOWN) {
+          pl->notify(
+            fmt::format("{}: {} card ({})", i, card.get_position(), spec));
+        } else {
+          pl->notify(
+            fmt::format("{}: {} ({})", i, card.name(), spec));
         }
       }
+    } else {
+      for (int i = 0; i < size; ++i) {
+        dp_ += 4;
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto pos = read_u8();
+        auto spec = ls_to_spec_key(loc, seq, pos, controller != player);
+        specs.push_back(spec);
+      }
+    }
 
-      if (discard_hand_) {
-        discard_hand_ = false;
-        if (current_phase_ == PHASE_END) {
-          // random discard
-          std::vector<int> comb(size);
-          std::iota(comb.begin(), comb.end(), 0);
-          std::shuffle(comb.begin(), comb.end(), gen_);
-          resp_buf_[0] = min;
-          for (int i = 0; i < min; ++i) {
-            resp_buf_[i + 1] = comb[i];
-          }
-          YGO_SetResponseb(pduel_, resp_buf_);
-          return;
+    if (discard_hand_) {
+      discard_hand_ = false;
+      if (current_phase_ == PHASE_END) {
+        // random discard
+        std::vector<int> comb(size);
+        std::iota(comb.begin(), comb.end(), 0);
+        std::shuffle(comb.begin(), comb.end(), gen_);
+        resp_buf_[0] = min;
+        for (int i = 0; i < min; ++i) {
+          resp_buf_[i + 1] = comb[i];
         }
+        YGO_SetResponseb(pduel_, resp_buf_);
+        return;
       }
+    }
 
-      // TODO(1): use this when added to history actions
-      // if ((min == max) && (max == specs.size())) {
-      //   resp_buf_[0] = specs.size();
-      //   for (int i = 0; i < specs.size(); ++i) {
-      //     resp_buf_[i + 1] = i;
-      //   }
-      //   YGO_SetResponseb(pduel_, resp_buf_);
-      //   return;
-      // }
+    // TODO(1): use this when added to history actions
+    // if ((min == max) && (max == specs.size())) {
+    //   resp_buf_[0] = specs.size();
+    //   for (int i = 0; i < specs.size(); ++i) {
+    //     resp_buf_[i + 1] = i;
+    //   }
+    //   YGO_SetResponseb(pduel_, resp_buf_);
+    //   return;
+    // }
 
-      init_multi_select(min, max, 0, specs);
+    init_multi_select(min, max, 0, specs);
 
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        _callback_multi_select(idx, ms_max_ == 1);
-      };
-    } else if (msg_ == MSG_SELECT_TRIBUTE) {
-      auto player = read_u8();
-      bool cancelable = read_u8();
-      auto min = read_u8();
-      auto max = read_u8();
-      auto size = read_u8();
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env._callback_multi_select(idx, env.ms_max_ == 1);
+    };
+  }
+
+  void handle_select_tribute() {
+    auto player = read_u8();
+    bool cancelable = read_u8();
+    auto min = read_u8();
+    auto max = read_u8();
+    auto size = read_u8();
+
+    if (min == 0) {
+      throw std::runtime_error("Min == 0 not implemented for select tribute");
+    }
+
+    auto &release_params = select_params_;
+    release_params.clear();
+    auto &specs = select_specs_;
+    specs.clear();
+    if (verbose_) {
+      std::vector<Card> cards;
+      for (int i = 0; i < size; ++i) {
+        auto code = read_u32();
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto release_param = read_u8();
+        Card card = get_card(controller, loc, seq);
+        cards.push_back(card);
+        release_params.push_back(release_param);
+      }
+      auto& pl = players_[player];
+      pl->notify("Select " + std::to_string(min) + " to " +
+                 std::to_string(max) +
+                 " cards to tribute separated by spaces:");
+      for (const auto &card : cards) {
+        auto spec = card.get_spec(player);
+        specs.push_back(card.get_spec_key(player));
+        pl->notify(
+          fmt::format("{}: {} ({})", specs.size(), card.name(), spec));
+      }
+    } else {
+      for (int i = 0; i < size; ++i) {
+        dp_ += 4;
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto release_param = read_u8();
 
-      if (min == 0) {
-        throw std::runtime_error("Min == 0 not implemented for select tribute");
+        auto spec = ls_to_spec_key(loc, seq, 0, controller != player);
+        specs.push_back(spec);
+
+        release_params.push_back(release_param);
       }
+    }
 
-      std::vector<int> release_params;
-      release_params.reserve(size);
-      std::vector<std::string> specs;
-      specs.reserve(size);
-      if (verbose_) {
-        std::vector<Card> cards;
-        for (int i = 0; i < size; ++i) {
-          auto code = read_u32();
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto release_param = read_u8();
-          Card card = get_card(controller, loc, seq);
-          cards.push_back(card);
-          release_params.push_back(release_param);
-        }
-        auto& pl = players_[player];
-        pl->notify("Select " + std::to_string(min) + " to " +
-                   std::to_string(max) +
-                   " cards to tribute separated by spaces:");
-        for (const auto &card : cards) {
-          auto spec = card.get_spec(player);
-          specs.push_back(spec);
-          pl->notify(
-            fmt::format("{}: {} ({})", specs.size(), card.name_, spec));
+    bool has_weight =
+        std::any_of(release_params.begin(), release_params.end(),
+                    [](int i) { return i != 1; });
+
+    if (min != max) {
+      throw std::runtime_error(
+        fmt::format("min({}) != max({}), not implemented for select tribute", min, max));
+    }
+
+    if (has_weight) {
+      // a card counts as one tribute or as its release param
+      auto &weights = select_weights_;
+      auto &offsets = select_offsets_;
+      weights.clear();
+      offsets.clear();
+      for (int w : release_params) {
+        offsets.push_back(weights.size());
+        weights.push_back(1);
+        if (w != 1) {
+          weights.push_back(w);
         }
-      } else {
-        for (int i = 0; i < size; ++i) {
-          dp_ += 4;
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto release_param = read_u8();
+      }
+      offsets.push_back(weights.size());
+      ms_sum_.init(weights, offsets, min);
+      init_multi_select(min, max, 0, specs, 1);
+
+      to_play_ = player;
+      callback_ = [](YGOProEnvImpl &env, int idx) {
+        env._callback_multi_select_2(idx);
+      };
+      return;
+    }
 
-          auto spec = ls_to_spec(loc, seq, 0, controller != player);
-          specs.push_back(spec);
+    // TODO(1): use this when added to history actions
+    // if (max == specs.size()) {
+    //   // tribute all
+    //   resp_buf_[0] = specs.size();
+    //   for (int i = 0; i < specs.size(); ++i) {
+    //     resp_buf_[i + 1] = i;
+    //   }
+    //   YGO_SetResponseb(pduel_, resp_buf_);
+    //   return;
+    // }
 
-          release_params.push_back(release_param);
-        }
-      }
+    init_multi_select(min, max, 0, specs);
 
-      bool has_weight =
-          std::any_of(release_params.begin(), release_params.end(),
-                      [](int i) { return i != 1; });
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env._callback_multi_select(idx, env.ms_max_ == 1);
+    };
+  }
 
-      if (min != max) {
-        throw std::runtime_error(
-          fmt::format("min({}) != max({}), not implemented for select tribute", min, max));
-      }
+  void handle_select_sum() {
+    // ritual summoning mode 1 (max)
+    auto mode = read_u8();
+    auto player = read_u8();
+    auto val = read_u32();
+    int _min = read_u8();
+    int _max = read_u8();
+    auto must_select_size = read_u8();
 
-      if (has_weight) {
-        throw std::runtime_error("weight not implemented for select tribute");
-        // combs = combinations_with_weight(release_params, min);
+    if (mode == 0) {
+      if (must_select_size > 2) {
+        throw std::runtime_error(
+            " must select size: " + std::to_string(must_select_size) +
+            " not implemented for MSG_SELECT_SUM");
       }
+    } else {
+      throw std::runtime_error("mode: " + std::to_string(mode) +
+                               " not implemented for MSG_SELECT_SUM");
+    }
 
-      // TODO(1): use this when added to history actions
-      // if (max == specs.size()) {
-      //   // tribute all
-      //   resp_buf_[0] = specs.size();
-      //   for (int i = 0; i < specs.size(); ++i) {
-      //     resp_buf_[i + 1] = i;
-      //   }
-      //   YGO_SetResponseb(pduel_, resp_buf_);
-      //   return;
-      // }
+    auto &select_params = select_params_;
+    select_params.clear();
+    auto &select_specs = select_specs_;
+    select_specs.clear();
 
-      init_multi_select(min, max, 0, specs);
+    int expected = val;
+    if (verbose_) {
+      std::vector<Card> must_select;
+      must_select.reserve(must_select_size);
+      for (int i = 0; i < must_select_size; ++i) {
+        auto code = read_u32();
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto param = read_u32();
+        Card card = get_card(controller, loc, seq);
+        must_select.push_back(card);
+        expected -= (param & 0xff);
+      }
+      auto& pl = players_[player];
+      pl->notify("Select cards with a total value of " +
+                 std::to_string(expected) + ", seperated by spaces.");
+      for (const auto &card : must_select) {
+        auto spec = card.get_spec(player);
+        pl->notify(card.name() + " (" + spec +
+                   ") must be selected, automatically selected.");
+      }
+    } else {
+      for (int i = 0; i < must_select_size; ++i) {
+        dp_ += 4;
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto param = read_u32();
 
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        _callback_multi_select(idx, ms_max_ == 1);
-      };
-    } else if (msg_ == MSG_SELECT_SUM) {
-      // ritual summoning mode 1 (max)
-      auto mode = read_u8();
-      auto player = read_u8();
-      auto val = read_u32();
-      int _min = read_u8();
-      int _max = read_u8();
-      auto must_select_size = read_u8();
-
-      if (mode == 0) {
-        if (must_select_size > 2) {
-          throw std::runtime_error(
-              " must select size: " + std::to_string(must_select_size) +
-              " not implemented for MSG_SELECT_SUM");
-        }
-      } else {
-        throw std::runtime_error("mode: " + std::to_string(mode) +
-                                 " not implemented for MSG_SELECT_SUM");
+        expected -= (param & 0xff);
       }
+    }
 
-      std::vector<int> select_params;
-      std::vector<std::string> select_specs;
+    uint8_t select_size = read_u8();
 
-      int expected = val;
-      if (verbose_) {
-        std::vector<Card> must_select;
-        must_select.reserve(must_select_size);
-        for (int i = 0; i < must_select_size; ++i) {
-          auto code = read_u32();
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto param = read_u32();
-          Card card = get_card(controller, loc, seq);
-          must_select.push_back(card);
-          expected -= (param & 0xff);
-        }
-        auto& pl = players_[player];
-        pl->notify("Select cards with a total value of " +
-                   std::to_string(expected) + ", seperated by spaces.");
-        for (const auto &card : must_select) {
-          auto spec = card.get_spec(player);
-          pl->notify(card.name_ + " (" + spec +
-                     ") must be selected, automatically selected.");
-        }
-      } else {
-        for (int i = 0; i < must_select_size; ++i) {
-          dp_ += 4;
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto param = read_u32();
-
-          auto spec = ls_to_spec(loc, seq, 0, controller != player);
-          expected -= (param & 0xff);
-        }
+    if (verbose_) {
+      std::vector<Card> select;
+      select.reserve(select_size);
+      for (int i = 0; i < select_size; ++i) {
+        auto code = read_u32();
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto param = read_u32();
+        Card card = get_card(controller, loc, seq);
+        select.push_back(card);
+        select_params.push_back(param);
       }
+      auto& pl = players_[player];
+      for (const auto &card : select) {
+        auto spec = card.get_spec(player);
+        select_specs.push_back(card.get_spec_key(player));
+        pl->notify(
+          fmt::format("{}: {} ({})", select_specs.size(), card.name(), spec));
+      }
+    } else {
+      for (int i = 0; i < select_size; ++i) {
+        dp_ += 4;
+        auto controller = read_u8();
+        auto loc = read_u8();
+        auto seq = read_u8();
+        auto param = read_u32();
 
-      uint8_t select_size = read_u8();
-      select_params.reserve(select_size);
-      select_specs.reserve(select_size);
-
-      if (verbose_) {
-        std::vector<Card> select;
-        select.reserve(select_size);
-        for (int i = 0; i < select_size; ++i) {
-          auto code = read_u32();
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto param = read_u32();
-          Card card = get_card(controller, loc, seq);
-          select.push_back(card);
-          select_params.push_back(param);
-        }
-        auto& pl = players_[player];
-        for (const auto &card : select) {
-          auto spec = card.get_spec(player);
-          select_specs.push_back(spec);
-          pl->notify(
-            fmt::format("{}: {} ({})", select_specs.size(), card.name_, spec));
-        }
-      } else {
-        for (int i = 0; i < select_size; ++i) {
-          dp_ += 4;
-          auto controller = read_u8();
-          auto loc = read_u8();
-          auto seq = read_u8();
-          auto param = read_u32();
-
-          auto spec = ls_to_spec(loc, seq, 0, controller != player);
-          select_specs.push_back(spec);
-          select_params.push_back(param);
-        }
+        auto spec = ls_to_spec_key(loc, seq, 0, controller != player);
+        select_specs.push_back(spec);
+        select_params.push_back(param);
       }
+    }
 
-      std::vector<std::vector<int>> card_levels;
-      for (int i = 0; i < select_size; ++i) {
-        std::vector<int> levels;
-        int level1 = select_params[i] & 0xff;
-        int level2 = (select_params[i] >> 16);
-        if (level1 > 0) {
-          levels.push_back(level1);
-        }
-        if (level2 > 0) {
-          levels.push_back(level2);
-        }
-        card_levels.push_back(levels);
+    auto &levels = select_weights_;
+    auto &offsets = select_offsets_;
+    levels.clear();
+    offsets.clear();
+    for (int i = 0; i < select_size; ++i) {
+      offsets.push_back(levels.size());
+      int level1 = select_params[i] & 0xff;
+      int level2 = (select_params[i] >> 16);
+      if (level1 > 0) {
+        levels.push_back(level1);
+      }
+      if (level2 > 0) {
+        levels.push_back(level2);
       }
+    }
+    offsets.push_back(levels.size());
+
+    // We assume any card_level can be the first
+
+    ms_sum_.init(levels, offsets, expected);
+    init_multi_select(
+      _min, _max, must_select_size, select_specs, 1);
+
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env._callback_multi_select_2(idx);
+    };
+
+  }
+
+  void handle_select_chain() {
+    auto player = read_u8();
+    auto size = read_u8();
+    auto spe_count = read_u8();
+    bool forced = read_u8();
+    dp_ += 8;
+    // auto hint_timing = read_u32();
+    // auto other_timing = read_u32();
+
+    auto &codes = select_codes_;
+    auto &descs = select_descs_;
+    auto &specs = select_specs_;
+    codes.clear();
+    descs.clear();
+    specs.clear();
+    for (int i = 0; i < size; ++i) {
+      auto flag = read_u8();
+      CardCode code = read_u32();
+      codes.push_back(code);
+      PlayerId c = read_u8();
+      uint8_t loc = read_u8();
+      uint8_t seq = read_u8();
+      uint8_t pos = read_u8();
+      specs.push_back(ls_to_spec_key(loc, seq, pos, c != player));
+      uint32_t desc = read_u32();
+      descs.push_back(desc);
+    }
 
-      // We assume any card_level can be the first
+    if ((size == 0) && (spe_count == 0)) {
+      // non-GUI don't need this
+      // if (verbose_) {
+      //   fmt::println("keep processing");
+      // }
+      YGO_SetResponsei(pduel_, -1);
+      return;
+    }
 
-      std::vector<std::vector<int>> combs =
-          combinations_with_weight2(card_levels, expected);
-      
-      for (auto &comb : combs) {
-        std::sort(comb.begin(), comb.end());
+    auto& pl = players_[player];
+    auto& op = players_[1 - player];
+    chaining_player_ = player;
+    if (!op->seen_waiting_) {
+      if (verbose_) {
+        op->notify("Waiting for opponent.");
       }
+      op->seen_waiting_ = true;
+    }
 
-      init_multi_select(
-        _min, _max, must_select_size, select_specs, 1, combs);
-
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        _callback_multi_select_2(idx);
-      };
+    if (verbose_) {
+      pl->notify("Select chain:");
+    }
 
-    } else if (msg_ == MSG_SELECT_CHAIN) {
-      auto player = read_u8();
-      auto size = read_u8();
-      auto spe_count = read_u8();
-      bool forced = read_u8();
-      dp_ += 8;
-      // auto hint_timing = read_u32();
-      // auto other_timing = read_u32();
-
-      std::vector<CardCode> codes;
-      std::vector<uint32_t> descs;
-      std::vector<std::string> specs;
-      for (int i = 0; i < size; ++i) {
-        auto flag = read_u8();
-        CardCode code = read_u32();
-        codes.push_back(code);
-        PlayerId c = read_u8();
-        uint8_t loc = read_u8();
-        uint8_t seq = read_u8();
-        uint8_t pos = read_u8();
-        specs.push_back(ls_to_spec(loc, seq, pos, c != player));
-        uint32_t desc = read_u32();
-        descs.push_back(desc);
-      }
-
-      if ((size == 0) && (spe_count == 0)) {
-        // non-GUI don't need this
-        // if (verbose_) {
-        //   fmt::println("keep processing");
-        // }
-        YGO_SetResponsei(pduel_, -1);
-        return;
+    for (int i = 0; i < size; i++) {
+      CardCode code = codes[i];
+      uint32_t desc = descs[i];
+      auto spec = specs[i];
+      auto [code_d, eff_idx] = unpack_desc(code, desc);
+      if (desc == 0) {
+        code_d = code;
       }
-
-      auto& pl = players_[player];
-      auto& op = players_[1 - player];
-      chaining_player_ = player;
-      if (!op->seen_waiting_) {
-        if (verbose_) {
-          op->notify("Waiting for opponent.");
-        }
-        op->seen_waiting_ = true;
+      auto la = LegalAction::activate_spec(eff_idx, spec);
+      if (code_d != 0) {
+        la.cid_ = c_get_card_id(code_d);
       }
-
+      legal_actions_.push_back(la);
       if (verbose_) {
-        pl->notify("Select chain:");
+        auto c = c_get_card(code);
+        std::string s = fmt::format(
+          "{}: {}({}) ({})",
+          i + 1, c.name(), spec_key_to_string(spec), c.get_effect_description(code_d, eff_idx));
+        pl->notify(s);
       }
+    }
 
-      for (int i = 0; i < size; i++) {
-        CardCode code = codes[i];
-        uint32_t desc = descs[i];
-        auto spec = specs[i];
-        auto [code_d, eff_idx] = unpack_desc(code, desc);
-        if (desc == 0) {
-          code_d = code;
+    if (!forced) {
+      legal_actions_.push_back(LegalAction::cancel());
+      if (verbose_) {
+        pl->notify(fmt::format("{}: cancel", size + 1));
+      }
+    }
+    to_play_ = player;
+    callback_ = [forced](YGOProEnvImpl &env, int idx) {
+      const auto &action = env.legal_actions_[idx];
+      if (action.act_ == ActionAct::Cancel) {
+        if (forced) {
+          fmt::print("cancel not allowed in forced chain\n");
+          env.YGO_SetResponsei(env.pduel_, 0);
+          return;
         }
-        auto la = LegalAction::activate_spec(eff_idx, spec);
-        if (code_d != 0) {
-          la.cid_ = c_get_card_id(code_d);
+        env.YGO_SetResponsei(env.pduel_, -1);
+        return;
+      }
+      env.YGO_SetResponsei(env.pduel_, idx);
+    };
+  }
+
+  void handle_select_yesno() {
+    auto player = read_u8();
+    auto desc = read_u32();
+    auto [code, eff_idx] = unpack_desc(0, desc);
+    if (desc == 0) {
+      show_buffer();
+      auto s = fmt::format("Unknown desc {} in select_yesno", desc);
+      throw std::runtime_error(s);
+    }
+    auto la = LegalAction::activate_spec(eff_idx, 0);
+    if (code != 0) {
+      la.cid_ = c_get_card_id(code);
+    }
+    legal_actions_.push_back(la);
+    if (verbose_) {
+      auto& pl = players_[player];
+      std::string s;
+      if (code == 0) {
+        s = get_system_string(eff_idx);
+      } else {
+        Card c = c_get_card(code);
+        int cmd_idx = legal_actions_.size();
+        eff_idx -= CARD_EFFECT_OFFSET;
+        if (eff_idx >= c.strings().size()) {
+          throw std::runtime_error(
+            fmt::format("Unknown effect {} of {}", eff_idx, c.name()));
         }
-        legal_actions_.push_back(la);
-        if (verbose_) {
-          auto c = c_get_card(code);
-          std::string s = fmt::format(
-            "{}: {}({}) ({})",
-            i + 1, c.name_, spec, c.get_effect_description(code_d, eff_idx));
-          pl->notify(s);
+        auto str = c.strings()[eff_idx];
+        if (str.empty()) {
+          str = "effect " + std::to_string(eff_idx);
         }
+        s = fmt::format("{} ({})", c.name(), str);
       }
+      pl->notify("1: " + s);
+      pl->notify("2: No");
+    }
+    // TODO: maybe add card id to cancel
+    legal_actions_.push_back(LegalAction::cancel());
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      if (idx == 0) {
+        env.YGO_SetResponsei(env.pduel_, 1);
+      } else if (idx == 1) {
+        env.YGO_SetResponsei(env.pduel_, 0);
+      }
+    };
+  }
+
+  void handle_select_effectyn() {
+    auto player = read_u8();
+
+    CardCode code = read_u32();
+    auto ct = read_u8();
+    auto loc = read_u8();
+    auto seq = read_u8();
+    auto pos = read_u8();
+    auto desc = read_u32();
+    auto spec = ls_to_spec_key(loc, seq, pos, ct != player);
+    auto [code_d, eff_idx] = unpack_desc(code, desc);
+    if (desc == 0) {
+      code_d = code;
+    }
+    auto la = LegalAction::activate_spec(eff_idx, spec);
+    if (code_d != 0) {
+      la.cid_ = c_get_card_id(code_d);
+    }
+    legal_actions_.push_back(la);
 
-      if (!forced) {
-        legal_actions_.push_back(LegalAction::cancel());
-        if (verbose_) {
-          pl->notify(fmt::format("{}: cancel", size + 1));
+    if (verbose_) {
+      Card c = c_get_card(code);
+      auto& pl = players_[player];
+      auto name = c.name();
+      std::string s;
+      if (code_d == 0) {
+        s = get_system_string(desc);
+        std::string fmt_str = "[%ls]";
+        auto pos = find_substrs(s, fmt_str);
+        if (pos.size() == 0) {
+          // nothing to replace
+        } else if (pos.size() == 1) {
+          auto p = pos[0];
+          s = s.substr(0, p) + name + s.substr(p + fmt_str.size());
+        } else if (pos.size() == 2) {
+          auto p1 = pos[0];
+          auto p2 = pos[1];
+          s = s.substr(0, p1) + spec_key_to_string(spec) +
+              s.substr(p1 + fmt_str.size(), p2 - p1 - fmt_str.size()) + name +
+              s.substr(p2 + fmt_str.size());
+        } else {
+          throw std::runtime_error("Unknown effectyn desc " +
+                                   std::to_string(desc) + " of " + name);
         }
+      } else {
+        s = fmt::format(
+          "{}({}) ({})", c.name(), spec_key_to_string(spec), c.get_effect_description(code_d, eff_idx));
       }
-      to_play_ = player;
-      callback_ = [this, forced](int idx) {
-        const auto &action = legal_actions_[idx];
-        if (action.act_ == ActionAct::Cancel) {
-          if (forced) {
-            fmt::print("cancel not allowed in forced chain\n");
-            YGO_SetResponsei(pduel_, 0);
-            return;
-          }
-          YGO_SetResponsei(pduel_, -1);
-          return;
-        }
-        YGO_SetResponsei(pduel_, idx);
-      };
-    } else if (msg_ == MSG_SELECT_YESNO) {
-      auto player = read_u8();
+      pl->notify("1: " + s);
+      pl->notify("2: No");
+    }
+
+    // TODO: maybe add card info to cancel
+    legal_actions_.push_back(LegalAction::cancel());
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      if (idx == 0) {
+        env.YGO_SetResponsei(env.pduel_, 1);
+      } else if (idx == 1) {
+        env.YGO_SetResponsei(env.pduel_, 0);
+      }
+    };
+  }
+
+  void handle_select_option() {
+    auto player = read_u8();
+    auto size = read_u8();
+    if (verbose_) {
+      players_[player]->notify("Select an option:");
+    }
+    for (int i = 0; i < size; ++i) {
       auto desc = read_u32();
       auto [code, eff_idx] = unpack_desc(0, desc);
       if (desc == 0) {
         show_buffer();
-        auto s = fmt::format("Unknown desc {} in select_yesno", desc);
+        auto s = fmt::format("Unknown desc {} in select_option", desc);
         throw std::runtime_error(s);
       }
-      auto la = LegalAction::activate_spec(eff_idx, "");
+      auto la = LegalAction::activate_spec(eff_idx, 0);
       if (code != 0) {
         la.cid_ = c_get_card_id(code);
       }
       legal_actions_.push_back(la);
       if (verbose_) {
-        auto& pl = players_[player];
         std::string s;
         if (code == 0) {
           s = get_system_string(eff_idx);
@@ -4717,522 +5795,399 @@ private:
           Card c = c_get_card(code);
           int cmd_idx = legal_actions_.size();
           eff_idx -= CARD_EFFECT_OFFSET;
-          if (eff_idx >= c.strings_.size()) {
+          if (eff_idx >= c.strings().size()) {
             throw std::runtime_error(
-              fmt::format("Unknown effect {} of {}", eff_idx, c.name_));
+              fmt::format("Unknown effect {} of {}", eff_idx, c.name()));
           }
-          auto str = c.strings_[eff_idx];
+          auto str = c.strings()[eff_idx];
           if (str.empty()) {
             str = "effect " + std::to_string(eff_idx);
           }
-          s = fmt::format("{} ({})", c.name_, str);
+          s = fmt::format("{} ({})", c.name(), str);
         }
-        pl->notify("1: " + s);
-        pl->notify("2: No");
+        players_[player]->notify(std::to_string(i + 1) + ": " + s);
       }
-      // TODO: maybe add card id to cancel
-      legal_actions_.push_back(LegalAction::cancel());
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        if (idx == 0) {
-          YGO_SetResponsei(pduel_, 1);
-        } else if (idx == 1) {
-          YGO_SetResponsei(pduel_, 0);
-        }
-      };
-    } else if (msg_ == MSG_SELECT_EFFECTYN) {
-      auto player = read_u8();
+    }
 
-      CardCode code = read_u32();
-      auto ct = read_u8();
-      auto loc = read_u8();
-      auto seq = read_u8();
-      auto pos = read_u8();
-      auto desc = read_u32();
-      std::string spec = ls_to_spec(loc, seq, pos, ct != player);
-      auto [code_d, eff_idx] = unpack_desc(code, desc);
-      if (desc == 0) {
-        code_d = code;
-      }
-      auto la = LegalAction::activate_spec(eff_idx, spec);
-      if (code_d != 0) {
-        la.cid_ = c_get_card_id(code_d);
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env.YGO_SetResponsei(env.pduel_, idx);
+    };
+  }
+
+  void handle_select_idlecmd() {
+    int32_t player = read_u8();
+    const auto &summonable_ = read_cardlist_spec(player, card_specs_[0]);
+    const auto &spsummon_ = read_cardlist_spec(player, card_specs_[1]);
+    const auto &repos_ = read_cardlist_spec(player, card_specs_[2]);
+    const auto &idle_mset_ = read_cardlist_spec(player, card_specs_[3]);
+    const auto &idle_set_ = read_cardlist_spec(player, card_specs_[4]);
+    const auto &idle_activate_ = read_cardlist_spec(player, card_specs_[5], true);
+    bool to_bp_ = read_u8();
+    bool to_ep_ = read_u8();
+    read_u8(); // can_shuffle
+
+    int offset = 0;
+
+    auto& pl = players_[player];
+    if (verbose_) {
+      pl->notify("Select a card and action to perform.");
+    }
+    for (const auto &[code, spec, data] : summonable_) {
+      auto la = LegalAction::act_spec(ActionAct::Summon, spec);
+      la.response_ = (uint32_t(legal_actions_.size() - offset) << 16) + 0;
+      legal_actions_.push_back(la);
+      if (verbose_) {
+        const auto &name = c_get_card(code).name();
+        int cmd_idx = legal_actions_.size();
+        pl->notify(fmt::format(
+          "{}: Summon {} in face-up attack position", cmd_idx, name));
       }
+    }
+    offset += summonable_.size();
+    for (const auto &[code, spec, data] : spsummon_) {
+      auto la = LegalAction::act_spec(ActionAct::SpSummon, spec);
+      la.response_ = (uint32_t(legal_actions_.size() - offset) << 16) + 1;
       legal_actions_.push_back(la);
-
       if (verbose_) {
-        Card c = c_get_card(code);
-        auto& pl = players_[player];
-        auto name = c.name_;
-        std::string s;
-        if (code_d == 0) {
-          s = get_system_string(desc);
-          std::string fmt_str = "[%ls]";
-          auto pos = find_substrs(s, fmt_str);
-          if (pos.size() == 0) {
-            // nothing to replace
-          } else if (pos.size() == 1) {
-            auto p = pos[0];
-            s = s.substr(0, p) + name + s.substr(p + fmt_str.size());
-          } else if (pos.size() == 2) {
-            auto p1 = pos[0];
-            auto p2 = pos[1];
-            s = s.substr(0, p1) + spec +
-                s.substr(p1 + fmt_str.size(), p2 - p1 - fmt_str.size()) + name +
-                s.substr(p2 + fmt_str.size());
-          } else {
-            throw std::runtime_error("Unknown effectyn desc " +
-                                     std::to_string(desc) + " of " + name);
-          }
-        } else {
-          s = fmt::format(
-            "{}({}) ({})", c.name_, spec, c.get_effect_description(code_d, eff_idx));
-        }
-        pl->notify("1: " + s);
-        pl->notify("2: No");
+        const auto &name = c_get_card(code).name();
+        int cmd_idx = legal_actions_.size();
+        pl->notify(fmt::format(
+          "{}: Special summon {}", cmd_idx, name));
       }
-
-      // TODO: maybe add card info to cancel
-      legal_actions_.push_back(LegalAction::cancel());
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        if (idx == 0) {
-          YGO_SetResponsei(pduel_, 1);
-        } else if (idx == 1) {
-          YGO_SetResponsei(pduel_, 0);
-        }
-      };
-    } else if (msg_ == MSG_SELECT_OPTION) {
-      auto player = read_u8();
-      auto size = read_u8();
+    }
+    offset += spsummon_.size();
+    for (const auto &[code, spec, data] : repos_) {
+      auto la = LegalAction::act_spec(ActionAct::Repo, spec);
+      la.response_ = (uint32_t(legal_actions_.size() - offset) << 16) + 2;
+      legal_actions_.push_back(la);
       if (verbose_) {
-        players_[player]->notify("Select an option:");
+        const auto &name = c_get_card(code).name();
+        int cmd_idx = legal_actions_.size();
+        pl->notify(fmt::format(
+          "{}: Change position of {}", cmd_idx, name));
       }
-      for (int i = 0; i < size; ++i) {
-        auto desc = read_u32();
-        auto [code, eff_idx] = unpack_desc(0, desc);
-        if (desc == 0) {
-          show_buffer();
-          auto s = fmt::format("Unknown desc {} in select_option", desc);
-          throw std::runtime_error(s);
-        }
-        auto la = LegalAction::activate_spec(eff_idx, "");
-        if (code != 0) {
-          la.cid_ = c_get_card_id(code);
-        }
-        legal_actions_.push_back(la);
-        if (verbose_) {
-          std::string s;
-          if (code == 0) {
-            s = get_system_string(eff_idx);
-          } else {
-            Card c = c_get_card(code);
-            int cmd_idx = legal_actions_.size();
-            eff_idx -= CARD_EFFECT_OFFSET;
-            if (eff_idx >= c.strings_.size()) {
-              throw std::runtime_error(
-                fmt::format("Unknown effect {} of {}", eff_idx, c.name_));
-            }
-            auto str = c.strings_[eff_idx];
-            if (str.empty()) {
-              str = "effect " + std::to_string(eff_idx);
-            }
-            s = fmt::format("{} ({})", c.name_, str);
-          }
-          players_[player]->notify(std::to_string(i + 1) + ": " + s);
-        }
+    }
+    offset += repos_.size();
+    for (const auto &[code, spec, data] : idle_mset_) {
+      auto la = LegalAction::act_spec(ActionAct::MSet, spec);
+      la.response_ = (uint32_t(legal_actions_.size() - offset) << 16) + 3;
+      legal_actions_.push_back(la);
+      if (verbose_) {
+        const auto &name = c_get_card(code).name();
+        int cmd_idx = legal_actions_.size();
+        pl->notify(fmt::format(
+          "{}: Summon {} in face-down defense position", cmd_idx, name));
       }
-
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        YGO_SetResponsei(pduel_, idx);
-      };
-    } else if (msg_ == MSG_SELECT_IDLECMD) {
-      int32_t player = read_u8();
-      auto summonable_ = read_cardlist_spec(player);
-      auto spsummon_ = read_cardlist_spec(player);
-      auto repos_ = read_cardlist_spec(player);
-      auto idle_mset_ = read_cardlist_spec(player);
-      auto idle_set_ = read_cardlist_spec(player);
-      auto idle_activate_ = read_cardlist_spec(player, true);
-      bool to_bp_ = read_u8();
-      bool to_ep_ = read_u8();
-      read_u8(); // can_shuffle
-
-      int offset = 0;
-
-      auto& pl = players_[player];
+    }
+    offset += idle_mset_.size();
+    for (const auto &[code, spec, data] : idle_set_) {
+      auto la = LegalAction::act_spec(ActionAct::Set, spec);
+      la.response_ = (uint32_t(legal_actions_.size() - offset) << 16) + 4;
+      legal_actions_.push_back(la);
       if (verbose_) {
-        pl->notify("Select a card and action to perform.");
+        const auto &name = c_get_card(code).name();
+        int cmd_idx = legal_actions_.size();
+        pl->notify(fmt::format(
+          "{}: Set {}", cmd_idx, name));
       }
-      for (const auto &[code, spec, data] : summonable_) {
-        legal_actions_.push_back(LegalAction::act_spec(ActionAct::Summon, spec));
-        if (verbose_) {
-          const auto &name = c_get_card(code).name_;
-          int cmd_idx = legal_actions_.size();
-          pl->notify(fmt::format(
-            "{}: Summon {} in face-up attack position", cmd_idx, name));
-        }
+    }
+    offset += idle_set_.size();
+    for (const auto &[code_t, spec, desc] : idle_activate_) {
+      CardCode code = code_t;
+      if(code & 0x80000000) {
+        code &= 0x7fffffff;
       }
-      offset += summonable_.size();
-      int spsummon_offset = offset;
-      for (const auto &[code, spec, data] : spsummon_) {
-        legal_actions_.push_back(LegalAction::act_spec(ActionAct::SpSummon, spec));
-        if (verbose_) {
-          const auto &name = c_get_card(code).name_;
-          int cmd_idx = legal_actions_.size();
-          pl->notify(fmt::format(
-            "{}: Special summon {}", cmd_idx, name));
-        }
+      auto [code_d, eff_idx] = unpack_desc(code, desc);
+      if (desc == 0) {
+        code_d = code;
       }
-      offset += spsummon_.size();
-      int repos_offset = offset;
-      for (const auto &[code, spec, data] : repos_) {
-        legal_actions_.push_back(LegalAction::act_spec(ActionAct::Repo, spec));
-        if (verbose_) {
-          const auto &name = c_get_card(code).name_;
-          int cmd_idx = legal_actions_.size();
-          pl->notify(fmt::format(
-            "{}: Change position of {}", cmd_idx, name));
-        }
+      auto la = LegalAction::activate_spec(eff_idx, spec);
+      if (code_d != 0) {
+        la.cid_ = c_get_card_id(code_d);
       }
-      offset += repos_.size();
-      int mset_offset = offset;
-      for (const auto &[code, spec, data] : idle_mset_) {
-        legal_actions_.push_back(LegalAction::act_spec(ActionAct::MSet, spec));
-        if (verbose_) {
-          const auto &name = c_get_card(code).name_;
-          int cmd_idx = legal_actions_.size();
-          pl->notify(fmt::format(
-            "{}: Summon {} in face-down defense position", cmd_idx, name));
-        }
+      la.response_ = (uint32_t(legal_actions_.size() - offset) << 16) + 5;
+      legal_actions_.push_back(la);
+      if (verbose_) {
+        auto c = c_get_card(code);
+        int cmd_idx = legal_actions_.size();
+        std::string s = fmt::format(
+          "{}: Activate {}({}) ({})",
+          cmd_idx, c.name(), spec_key_to_string(spec), c.get_effect_description(code_d, eff_idx));
+        pl->notify(s);
       }
-      offset += idle_mset_.size();
-      int set_offset = offset;
-      for (const auto &[code, spec, data] : idle_set_) {
-        legal_actions_.push_back(LegalAction::act_spec(ActionAct::Set, spec));
-        if (verbose_) {
-          const auto &name = c_get_card(code).name_;
-          int cmd_idx = legal_actions_.size();
-          pl->notify(fmt::format(
-            "{}: Set {}", cmd_idx, name));
-        }
+    }
+
+    if (to_bp_) {
+      auto la = LegalAction::phase(ActionPhase::Battle);
+      la.response_ = 6;
+      legal_actions_.push_back(la);
+      if (verbose_) {
+        int cmd_idx = legal_actions_.size();
+        pl->notify(fmt::format("{}: Enter the battle phase.", cmd_idx));
       }
-      offset += idle_set_.size();
-      int activate_offset = offset;
-      for (const auto &[code_t, spec, desc] : idle_activate_) {
-        CardCode code = code_t;
-        if(code & 0x80000000) {
-          code &= 0x7fffffff;
-        }
-        auto [code_d, eff_idx] = unpack_desc(code, desc);
-        if (desc == 0) {
-          code_d = code;
-        }
-        auto la = LegalAction::activate_spec(eff_idx, spec);
-        if (code_d != 0) {
-          la.cid_ = c_get_card_id(code_d);
-        }
+    }
+    if (to_ep_) {
+      if (!to_bp_) {
+        auto la = LegalAction::phase(ActionPhase::End);
+        la.response_ = 7;
         legal_actions_.push_back(la);
         if (verbose_) {
-          auto c = c_get_card(code);
           int cmd_idx = legal_actions_.size();
-          std::string s = fmt::format(
-            "{}: Activate {}({}) ({})",
-            cmd_idx, c.name_, spec, c.get_effect_description(code_d, eff_idx));
-          pl->notify(s);
+          pl->notify(fmt::format("{}: End phase.", cmd_idx));
         }
       }
+    }
 
-      if (to_bp_) {
-        legal_actions_.push_back(LegalAction::phase(ActionPhase::Battle));
-        if (verbose_) {
-          int cmd_idx = legal_actions_.size();
-          pl->notify(fmt::format("{}: Enter the battle phase.", cmd_idx));
-        }
-      }
-      if (to_ep_) {
-        if (!to_bp_) {
-          legal_actions_.push_back(LegalAction::phase(ActionPhase::End));
-          if (verbose_) {
-            int cmd_idx = legal_actions_.size();
-            pl->notify(fmt::format("{}: End phase.", cmd_idx));
-          }
-        }
-      }
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env.YGO_SetResponsei(env.pduel_, env.legal_actions_[idx].response_);
+    };
+  }
 
-      to_play_ = player;
-      callback_ = [this, spsummon_offset, repos_offset, mset_offset, set_offset,
-                   activate_offset](int idx) {
-        const auto &action = legal_actions_[idx];
-        if (action.phase_ == ActionPhase::Battle) {
-          YGO_SetResponsei(pduel_, 6);
-        } else if (action.phase_ == ActionPhase::End) {
-          YGO_SetResponsei(pduel_, 7);
-        } else {
-          auto act = action.act_;
-          if (act == ActionAct::Summon) {
-            uint32_t idx_ = idx;
-            YGO_SetResponsei(pduel_, idx_ << 16);
-          } else if (act == ActionAct::SpSummon) {
-            uint32_t idx_ = idx - spsummon_offset;
-            YGO_SetResponsei(pduel_, (idx_ << 16) + 1);
-          } else if (act == ActionAct::Repo) {
-            uint32_t idx_ = idx - repos_offset;
-            YGO_SetResponsei(pduel_, (idx_ << 16) + 2);
-          } else if (act == ActionAct::MSet) {
-            uint32_t idx_ = idx - mset_offset;
-            YGO_SetResponsei(pduel_, (idx_ << 16) + 3);
-          } else if (act == ActionAct::Set) {
-            uint32_t idx_ = idx - set_offset;
-            YGO_SetResponsei(pduel_, (idx_ << 16) + 4);
-          } else if (act == ActionAct::Activate) {
-            uint32_t idx_ = idx - activate_offset;
-            YGO_SetResponsei(pduel_, (idx_ << 16) + 5);
-          }
-        }
-      };
-    } else if (msg_ == MSG_SELECT_PLACE || msg_ == MSG_SELECT_DISFIELD) {
-      // TODO(1): add card informaton to select place
-      auto player = read_u8();
-      auto count = read_u8();
-      if (count == 0) {
-        count = 1;
-      }
-      if (count != 1) {
-        auto s = fmt::format("Select place count {} not implemented for {}",
-                              count, msg_ == MSG_SELECT_PLACE ? "place" : "disfield");
-        throw std::runtime_error(s);
-      }
-      auto flag = read_u32();
-      auto places = flag_to_usable_places(flag);
+  void handle_select_place() {
+    // TODO(1): add card informaton to select place
+    auto player = read_u8();
+    auto count = read_u8();
+    if (count == 0) {
+      count = 1;
+    }
+    if (count != 1) {
+      auto s = fmt::format("Select place count {} not implemented for {}",
+                            count, msg_ == MSG_SELECT_PLACE ? "place" : "disfield");
+      throw std::runtime_error(s);
+    }
+    auto flag = read_u32();
+    auto places = flag_to_usable_places(flag);
+    if (verbose_) {
+      auto place_s = msg_ == MSG_SELECT_PLACE ? "place" : "disfield";
+      auto s = fmt::format("Select {} for card, one of:", place_s);
+      players_[player]->notify(s);
+    }
+    for (int i = 0; i < places.size(); ++i) {
+      legal_actions_.push_back(LegalAction::place(places[i]));
       if (verbose_) {
-        auto place_s = msg_ == MSG_SELECT_PLACE ? "place" : "disfield";
-        auto s = fmt::format("Select {} for card, one of:", place_s);
+        auto s = fmt::format("{}: {}", i + 1, action_place_to_string(places[i]));
         players_[player]->notify(s);
       }
-      for (int i = 0; i < places.size(); ++i) {
-        legal_actions_.push_back(LegalAction::place(places[i]));
-        if (verbose_) {
-          auto s = fmt::format("{}: {}", i + 1, action_place_to_string(places[i]));
-          players_[player]->notify(s);
-        }
-      }
-      to_play_ = player;
-      callback_ = [this, player](int idx) {
-        auto place = legal_actions_[idx].place_;
-        int i = static_cast<int>(place);
-        uint8_t plr = player;
-        uint8_t loc;
-        uint8_t seq;
-        if (
-          i >= static_cast<int>(ActionPlace::MZone1) &&
-          i <= static_cast<int>(ActionPlace::MZone7)) {
-          loc = LOCATION_MZONE;
-          seq = i - static_cast<int>(ActionPlace::MZone1);
-        } else if (
-          i >= static_cast<int>(ActionPlace::SZone1) &&
-          i <= static_cast<int>(ActionPlace::SZone8)) {
-          loc = LOCATION_SZONE;
-          seq = i - static_cast<int>(ActionPlace::SZone1);
-        } else if (
-          i >= static_cast<int>(ActionPlace::OpMZone1) &&
-          i <= static_cast<int>(ActionPlace::OpMZone7)) {
-          plr = 1 - player;
-          loc = LOCATION_MZONE;
-          seq = i - static_cast<int>(ActionPlace::OpMZone1);
-        } else if (
-          i >= static_cast<int>(ActionPlace::OpSZone1) &&
-          i <= static_cast<int>(ActionPlace::OpSZone8)) {
-          plr = 1 - player;
-          loc = LOCATION_SZONE;
-          seq = i - static_cast<int>(ActionPlace::OpSZone1);
-        }
-        resp_buf_[0] = plr;
-        resp_buf_[1] = loc;
-        resp_buf_[2] = seq;
-        YGO_SetResponseb(pduel_, resp_buf_);
-      };
-    } else if (msg_ == MSG_SELECT_COUNTER) {
-      auto player = read_u8();
-      auto counter_type = read_u16();
-      int counter_count = read_u16();
-      int count = read_u8();
-      if (count > 2) {
-        throw std::runtime_error("Select counter count " +
-                                 std::to_string(count) + " not implemented");
-      }
-      auto& pl = players_[player];
+    }
+    to_play_ = player;
+    callback_ = [player](YGOProEnvImpl &env, int idx) {
+      auto place = env.legal_actions_[idx].place_;
+      int i = static_cast<int>(place);
+      uint8_t plr = player;
+      uint8_t loc;
+      uint8_t seq;
+      if (
+        i >= static_cast<int>(ActionPlace::MZone1) &&
+        i <= static_cast<int>(ActionPlace::MZone7)) {
+        loc = LOCATION_MZONE;
+        seq = i - static_cast<int>(ActionPlace::MZone1);
+      } else if (
+        i >= static_cast<int>(ActionPlace::SZone1) &&
+        i <= static_cast<int>(ActionPlace::SZone8)) {
+        loc = LOCATION_SZONE;
+        seq = i - static_cast<int>(ActionPlace::SZone1);
+      } else if (
+        i >= static_cast<int>(ActionPlace::OpMZone1) &&
+        i <= static_cast<int>(ActionPlace::OpMZone7)) {
+        plr = 1 - player;
+        loc = LOCATION_MZONE;
+        seq = i - static_cast<int>(ActionPlace::OpMZone1);
+      } else if (
+        i >= static_cast<int>(ActionPlace::OpSZone1) &&
+        i <= static_cast<int>(ActionPlace::OpSZone8)) {
+        plr = 1 - player;
+        loc = LOCATION_SZONE;
+        seq = i - static_cast<int>(ActionPlace::OpSZone1);
+      }
+      env.resp_buf_[0] = plr;
+      env.resp_buf_[1] = loc;
+      env.resp_buf_[2] = seq;
+      env.YGO_SetResponseb(env.pduel_, env.resp_buf_);
+    };
+  }
+
+  void handle_select_counter() {
+    auto player = read_u8();
+    auto counter_type = read_u16();
+    int counter_count = read_u16();
+    int count = read_u8();
+    if (count > 2) {
+      throw std::runtime_error("Select counter count " +
+                               std::to_string(count) + " not implemented");
+    }
+    auto& pl = players_[player];
+    if (verbose_) {
+      pl->notify(fmt::format("Type new {} for {} card(s), separated by spaces.", "UNKNOWN_COUNTER", count));
+    }
+    std::vector<int> counters;
+    counters.reserve(count);
+    for (int i = 0; i < count; ++i) {
+      auto code = read_u32();
+      auto controller = read_u8();
+      auto loc = read_u8();
+      auto seq = read_u8();
+      auto counter = read_u16();
+      counters.push_back(counter & 0xffff);
+
       if (verbose_) {
-        pl->notify(fmt::format("Type new {} for {} card(s), separated by spaces.", "UNKNOWN_COUNTER", count));
+        pl->notify(c_get_card(code).name() + ": " + std::to_string(counter));
       }
-      std::vector<int> counters;
-      counters.reserve(count);
-      for (int i = 0; i < count; ++i) {
-        auto code = read_u32();
-        auto controller = read_u8();
-        auto loc = read_u8();
-        auto seq = read_u8();
-        auto counter = read_u16();
-        counters.push_back(counter & 0xffff);
+      // auto spec = ls_to_spec(loc, seq, 0, controller != player);
+      // options_.push_back(spec);
+    }
+    // TODO(2): implement action
+    n_counters_ = count;
+    uint16_t resp1 = static_cast<uint16_t>(std::min(counter_count, counters[0]));
+    memcpy(resp_buf_, &resp1, 2);
+    counter_count -= counters[0];
+    if (count == 2) {
+      uint16_t resp2 = 0;
+      if (counter_count > 0) {
+        resp2 = static_cast<uint16_t>(counter_count);
+      }
+      memcpy(resp_buf_ + 2, &resp2, 2);
+    }
+    YGO_SetResponseb(pduel_, resp_buf_);
+  }
 
-        if (verbose_) {
-          pl->notify(c_get_card(code).name_ + ": " + std::to_string(counter));
-        }
-        // auto spec = ls_to_spec(loc, seq, 0, controller != player);
-        // options_.push_back(spec);
-      }
-      // TODO(2): implement action
-      n_counters_ = count;
-      uint16_t resp1 = static_cast<uint16_t>(std::min(counter_count, counters[0]));
-      memcpy(resp_buf_, &resp1, 2);
-      counter_count -= counters[0];
-      if (count == 2) {
-        uint16_t resp2 = 0;
-        if (counter_count > 0) {
-          resp2 = static_cast<uint16_t>(counter_count);
-        }
-        memcpy(resp_buf_ + 2, &resp2, 2);
+  void handle_announce_number() {
+    auto player = read_u8();
+    int count = read_u8();
+    std::vector<int> numbers;
+    for (int i = 0; i < count; ++i) {
+      int number = read_u32();
+      if (number <= 0 || number > 12) {
+        throw std::runtime_error("Number " + std::to_string(number) +
+                                 " not implemented for announce number");
       }
-      YGO_SetResponseb(pduel_, resp_buf_);
-    } else if (msg_ == MSG_ANNOUNCE_NUMBER) {
-      auto player = read_u8();
-      int count = read_u8();
-      std::vector<int> numbers;
+      numbers.push_back(number);
+      legal_actions_.push_back(LegalAction::number(number));
+    }
+    if (verbose_) {
+      auto& pl = players_[player];
+      std::string str = "Select a number, one of:";
+      pl->notify(str);
       for (int i = 0; i < count; ++i) {
-        int number = read_u32();
-        if (number <= 0 || number > 12) {
-          throw std::runtime_error("Number " + std::to_string(number) +
-                                   " not implemented for announce number");
-        }
-        numbers.push_back(number);
-        legal_actions_.push_back(LegalAction::number(number));
-      }
-      if (verbose_) {
-        auto& pl = players_[player];
-        std::string str = "Select a number, one of:";
-        pl->notify(str);
-        for (int i = 0; i < count; ++i) {
-          pl->notify(fmt::format("{}: {}", i + 1, numbers[i]));
-        }
+        pl->notify(fmt::format("{}: {}", i + 1, numbers[i]));
       }
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        YGO_SetResponsei(pduel_, idx);
-      };
-    } else if (msg_ == MSG_ANNOUNCE_ATTRIB) {
-      auto player = read_u8();
-      int count = read_u8();
-      auto flag = read_u32();
+    }
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      env.YGO_SetResponsei(env.pduel_, idx);
+    };
+  }
 
-      int n_attrs = 7;
+  void handle_announce_attrib() {
+    auto player = read_u8();
+    int count = read_u8();
+    auto flag = read_u32();
 
-      std::vector<uint8_t> attrs;
-      for (int i = 0; i < n_attrs; i++) {
-        if (flag & (1 << i)) {
-          attrs.push_back(i + 1);
-        }
-      }
-      // TODO(2): implement action
-      if (count != 1) {
-        throw std::runtime_error("Announce attrib count " +
-                                 std::to_string(count) + " not implemented");
-      }
+    int n_attrs = 7;
 
-      if (verbose_) {
-        auto& pl = players_[player];
-        pl->notify("Select " + std::to_string(count) +
-                   " attributes separated by spaces:");
-        for (int i = 0; i < attrs.size(); i++) {
-          pl->notify(fmt::format("{}: {}", i + 1, attribute_to_string(1 << (attrs[i] - 1))));
-        }
+    std::vector<uint8_t> attrs;
+    for (int i = 0; i < n_attrs; i++) {
+      if (flag & (1 << i)) {
+        attrs.push_back(i + 1);
       }
+    }
+    // TODO(2): implement action
+    if (count != 1) {
+      throw std::runtime_error("Announce attrib count " +
+                               std::to_string(count) + " not implemented");
+    }
 
-      // auto combs = combinations(attrs.size(), count);
+    if (verbose_) {
+      auto& pl = players_[player];
+      pl->notify("Select " + std::to_string(count) +
+                 " attributes separated by spaces:");
       for (int i = 0; i < attrs.size(); i++) {
-        legal_actions_.push_back(LegalAction::attribute(1 << (attrs[i] - 1)));
+        pl->notify(fmt::format("{}: {}", i + 1, attribute_to_string(1 << (attrs[i] - 1))));
       }
+    }
 
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        const auto &action = legal_actions_[idx];
-        uint32_t resp = 0;
-        resp |= action.attribute_;
-        YGO_SetResponsei(pduel_, resp);
-      };
-    } else if (msg_ == MSG_ANNOUNCE_CARD) {
-      auto player = read_u8();
-      int count = read_u8();
+    // auto combs = combinations(attrs.size(), count);
+    for (int i = 0; i < attrs.size(); i++) {
+      legal_actions_.push_back(LegalAction::attribute(1 << (attrs[i] - 1)));
+    }
 
-      std::vector<uint32_t> opcodes;
-      opcodes.reserve(count);
-      for (int i = 0; i < count; i++) {
-        opcodes.push_back(read_u32());
-      }
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      const auto &action = env.legal_actions_[idx];
+      uint32_t resp = 0;
+      resp |= action.attribute_;
+      env.YGO_SetResponsei(env.pduel_, resp);
+    };
+  }
 
-      auto codes = parse_codes_from_opcodes(opcodes);
+  void handle_announce_card() {
+    auto player = read_u8();
+    int count = read_u8();
 
-      if (verbose_) {
-        auto& pl = players_[player];
-        pl->notify("Select 1 card from the following cards:");
-        for (int i = 0; i < codes.size(); i++) {
-          pl->notify(fmt::format("{}: {}", i + 1, c_get_card(codes[i]).name_));
-        }
-      }
+    std::vector<uint32_t> opcodes;
+    opcodes.reserve(count);
+    for (int i = 0; i < count; i++) {
+      opcodes.push_back(read_u32());
+    }
 
-      for (auto code : codes) {
-        LegalAction la;
-        la.cid_ = c_get_card_id(code);
-        la.response_ = code;
-        legal_actions_.push_back(la);
+    auto codes = parse_codes_from_opcodes(opcodes);
+
+    if (verbose_) {
+      auto& pl = players_[player];
+      pl->notify("Select 1 card from the following cards:");
+      for (int i = 0; i < codes.size(); i++) {
+        pl->notify(fmt::format("{}: {}", i + 1, c_get_card(codes[i]).name()));
       }
+    }
 
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        const auto &action = legal_actions_[idx];
-        uint32_t resp = action.response_;
-        YGO_SetResponsei(pduel_, resp);
-      };
-    } else if (msg_ == MSG_SELECT_POSITION) {
-      auto player = read_u8();
-      auto code = read_u32();
-      auto valid_pos = read_u8();
-      CardId cid = c_get_card_id(code);
+    for (auto code : codes) {
+      LegalAction la;
+      la.cid_ = c_get_card_id(code);
+      la.response_ = code;
+      legal_actions_.push_back(la);
+    }
 
-      if (verbose_) {
-        auto& pl = players_[player];
-        auto card = c_get_card(code);
-        pl->notify("Select position for " + card.name_ + ":");
-      }
-
-      for (auto pos : {POS_FACEUP_ATTACK, POS_FACEDOWN_ATTACK,
-                       POS_FACEUP_DEFENSE, POS_FACEDOWN_DEFENSE}) {
-        if (valid_pos & pos) {
-          LegalAction la;
-          la.cid_ = cid;
-          la.position_ = pos;
-          legal_actions_.push_back(la);
-          int cmd_idx = legal_actions_.size();
-          if (verbose_) {
-            auto& pl = players_[player];
-            pl->notify(fmt::format("{}: {}", cmd_idx, position_to_string(pos)));
-          }
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      const auto &action = env.legal_actions_[idx];
+      uint32_t resp = action.response_;
+      env.YGO_SetResponsei(env.pduel_, resp);
+    };
+  }
+
+  void handle_select_position() {
+    auto player = read_u8();
+    auto code = read_u32();
+    auto valid_pos = read_u8();
+    CardId cid = c_get_card_id(code);
+
+    if (verbose_) {
+      auto& pl = players_[player];
+      auto card = c_get_card(code);
+      pl->notify("Select position for " + card.name() + ":");
+    }
+
+    for (auto pos : {POS_FACEUP_ATTACK, POS_FACEDOWN_ATTACK,
+                     POS_FACEUP_DEFENSE, POS_FACEDOWN_DEFENSE}) {
+      if (valid_pos & pos) {
+        LegalAction la;
+        la.cid_ = cid;
+        la.position_ = pos;
+        legal_actions_.push_back(la);
+        int cmd_idx = legal_actions_.size();
+        if (verbose_) {
+          auto& pl = players_[player];
+          pl->notify(fmt::format("{}: {}", cmd_idx, position_to_string(pos)));
         }
       }
-
-      to_play_ = player;
-      callback_ = [this](int idx) {
-        uint8_t pos = legal_actions_[idx].position_;
-        YGO_SetResponsei(pduel_, pos);
-      };
-    } else {
-      show_deck(0);
-      show_deck(1);
-      show_buffer();
-      throw std::runtime_error(
-        fmt::format("Unknown message {}, length {}, dp {}",
-        msg_to_string(msg_), dl_, dp_));
     }
+
+    to_play_ = player;
+    callback_ = [](YGOProEnvImpl &env, int idx) {
+      uint8_t pos = env.legal_actions_[idx].position_;
+      env.YGO_SetResponsei(env.pduel_, pos);
+    };
   }
 
   void _damage(uint8_t player, uint32_t amount) {
@@ -5264,6 +6219,288 @@ private:
   }
 };
 
+// Reconstructs the engine state of duels from their start and responses. No
+// message is handled or encoded, the engine is only run to its next request
+// of a response, so a duel at response n is usually much cheaper to reach
+// than by replaying the env.
+//
+// ygopro-core can't copy a duel, so checkpoints are live duels parked in a
+// cache, keyed by the start and the hash of the response prefix. A run takes
+// the deepest checkpoint on its way, at its own position or at a multiple of
+// interval responses. Since that checkpoint is used up, it is built again in
+// the background, as are the position of the run and the last multiple of
+// interval it passes, so that later runs of the same or a sibling position
+// only replay from there. The
+// builds run on num_threads threads of the resimulator, at most two per
+// thread are queued or running, further ones are skipped until a later run.
+// At most capacity checkpoints are kept, the least recently used ones are
+// ended first.
+class DuelResimulator {
+public:
+  DuelResimulator(std::size_t interval, std::size_t capacity,
+                  std::size_t num_threads)
+      : interval_(std::max<std::size_t>(interval, 1)),
+        max_building_(2 * std::max<std::size_t>(num_threads, 1)),
+        cache_(std::make_shared<Cache>()),
+        builders_(std::max<std::size_t>(num_threads, 1)) {
+    cache_->capacity = capacity;
+  }
+
+  ~DuelResimulator() {
+    {
+      std::lock_guard<std::mutex> lock(cache_->mutex);
+      cache_->closed = true;
+    }
+    // builds that have not started yet are skipped, builders_ is joined
+    // before cache_ is released
+  }
+
+  DuelResimulator(const DuelResimulator &) = delete;
+  DuelResimulator &operator=(const DuelResimulator &) = delete;
+
+  // A live duel waiting for the n-th response of the log, owned by the
+  // caller. It is ended with YGOProEnvImpl::destroy_duel or handed back with
+  // park.
+  intptr_t run(const MDuel &start, const ResponseLog &log, std::size_t n) {
+    if (n > log.size()) {
+      throw std::invalid_argument("Only " + std::to_string(log.size()) +
+                                  " responses to run");
+    }
+    uint64_t start_hash = hash_start(start);
+    intptr_t pduel = 0;
+    std::size_t from = 0;
+    {
+      std::lock_guard<std::mutex> lock(cache_->mutex);
+      pduel = cache_->take(key(start_hash, log, n));
+      from = n;
+      for (std::size_t b = n / interval_ * interval_; pduel == 0; b -= interval_) {
+        pduel = cache_->take(key(start_hash, log, b));
+        from = b;
+        if (b == 0) {
+          break;
+        }
+      }
+    }
+    if (pduel == 0) {
+      pduel = YGOProEnvImpl::rebuild_duel(start);
+      from = 0;
+      if (!run_to_request(pduel)) {
+        YGOProEnvImpl::destroy_duel(pduel);
+        throw std::runtime_error("Duel ended before its first response");
+      }
+    }
+    if (from % interval_ == 0) {
+      build_checkpoint(start, start_hash, log, from);
+    }
+    std::size_t last = n / interval_ * interval_;
+    if (last > from) {
+      build_checkpoint(start, start_hash, log, last);
+    }
+    if (n > last) {
+      build_checkpoint(start, start_hash, log, n);
+    }
+    if (!advance(pduel, log, from, n)) {
+      YGOProEnvImpl::destroy_duel(pduel);
+      throw std::runtime_error("Duel ended before response " +
+                               std::to_string(n));
+    }
+    return pduel;
+  }
+
+  // Keep a duel from run at response n of the log as a checkpoint.
+  void park(const MDuel &start, const ResponseLog &log, std::size_t n,
+            intptr_t pduel) {
+    cache_->put(key(hash_start(start), log, n), pduel);
+  }
+
+private:
+  struct Checkpoint {
+    intptr_t pduel;
+    uint64_t last_use;
+  };
+
+  // shared with the builder tasks
+  struct Cache {
+    std::mutex mutex;
+    ankerl::unordered_dense::map<uint64_t, Checkpoint> checkpoints;
+    ankerl::unordered_dense::set<uint64_t> building;
+    uint64_t clock = 0;
+    std::size_t capacity = 0;
+    bool closed = false;
+
+    ~Cache() {
+      for (auto &[k, c] : checkpoints) {
+        YGOProEnvImpl::destroy_duel(c.pduel);
+      }
+    }
+
+    // requires the lock, 0 if there is no such checkpoint
+    intptr_t take(uint64_t k) {
+      auto it = checkpoints.find(k);
+      if (it == checkpoints.end()) {
+        return 0;
+      }
+      intptr_t pduel = it->second.pduel;
+      checkpoints.erase(it);
+      return pduel;
+    }
+
+    void put(uint64_t k, intptr_t pduel) {
+      std::vector<intptr_t> ended;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        building.erase(k);
+        if (closed || (capacity == 0)) {
+          ended.push_back(pduel);
+        } else {
+          auto [it, inserted] = checkpoints.try_emplace(k, Checkpoint{pduel, 0});
+          if (!inserted) {
+            ended.push_back(it->second.pduel);
+            it->second.pduel = pduel;
+          }
+          it->second.last_use = ++clock;
+          while (checkpoints.size() > capacity) {
+            auto lru = std::min_element(
+                checkpoints.begin(), checkpoints.end(),
+                [](const auto &a, const auto &b) {
+                  return a.second.last_use < b.second.last_use;
+                });
+            ended.push_back(lru->second.pduel);
+            checkpoints.erase(lru);
+          }
+        }
+      }
+      for (intptr_t p : ended) {
+        YGOProEnvImpl::destroy_duel(p);
+      }
+    }
+  };
+
+  const std::size_t interval_;
+  const std::size_t max_building_;
+  std::shared_ptr<Cache> cache_;
+  // declared last, so that it is joined first
+  ThreadPool builders_;
+
+  static uint64_t mix(uint64_t h, uint64_t v) {
+    return (h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2))) *
+           0x100000001b3ULL;
+  }
+
+  static uint64_t hash_start(const MDuel &start) {
+    uint64_t h = mix(ResponseLog::kHashBasis, start.seed);
+    for (const auto *deck : {&start.main_deck0, &start.extra_deck0,
+                             &start.main_deck1, &start.extra_deck1}) {
+      h = mix(h, deck->size());
+      for (CardCode code : *deck) {
+        h = mix(h, code);
+      }
+    }
+    return h;
+  }
+
+  static uint64_t key(uint64_t start_hash, const ResponseLog &log,
+                      std::size_t n) {
+    return mix(mix(start_hash, log.prefix_hash(n)), n);
+  }
+
+  // Process until the engine waits for a response, false if the duel ended
+  static bool run_to_request(intptr_t pduel) {
+    // messages are skipped, but still read to keep the buffer of the engine
+    // from growing
+    byte buf[4096];
+    while (true) {
+      uint32 res = process(pduel);
+      if ((res & PROCESSOR_BUFFER_LEN) != 0) {
+        get_message(pduel, buf);
+      }
+      uint32 flag = res & PROCESSOR_FLAG;
+      if (flag == PROCESSOR_END) {
+        return false;
+      }
+      if (flag == PROCESSOR_WAITING) {
+        return true;
+      }
+    }
+  }
+
+  // From waiting for the response from of the log to waiting for n
+  static bool advance(intptr_t pduel, const ResponseLog &log, std::size_t from,
+                      std::size_t n) {
+    // any size of the log, and more than the engine reads of a response
+    byte resp[ResponseLog::kMaxSize + 1] = {};
+    for (std::size_t i = from; i < n; ++i) {
+      std::memcpy(resp, log.data(i), log.size(i));
+      set_responseb(pduel, resp);
+      if (!run_to_request(pduel)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void build_checkpoint(const MDuel &start, uint64_t start_hash,
+                        const ResponseLog &log, std::size_t n) {
+    uint64_t k = key(start_hash, log, n);
+    {
+      std::lock_guard<std::mutex> lock(cache_->mutex);
+      if ((cache_->capacity == 0) ||
+          (cache_->building.size() >= max_building_) ||
+          cache_->checkpoints.count(k) || !cache_->building.insert(k).second) {
+        return;
+      }
+    }
+    MDuel mduel = start;
+    mduel.pduel = 0;
+    builders_.enqueue([cache = cache_, mduel = std::move(mduel),
+                       log = log.prefix(n), n, k]() {
+      {
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        if (cache->closed) {
+          cache->building.erase(k);
+          return;
+        }
+      }
+      intptr_t pduel = YGOProEnvImpl::rebuild_duel(mduel);
+      if (!run_to_request(pduel) || !advance(pduel, log, 0, n)) {
+        YGOProEnvImpl::destroy_duel(pduel);
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        cache->building.erase(k);
+        return;
+      }
+      cache->put(k, pduel);
+    });
+  }
+};
+
+inline void YGOProEnvImpl::restore(const DuelSnapshot &snapshot,
+                                   DuelResimulator &resim) {
+  if (record_) {
+    throw std::runtime_error("Restore is not supported in record mode");
+  }
+  const auto &actions = snapshot.actions;
+  if (resume_steps(snapshot) < 0) {
+    const YGOProEnvImpl &state = *snapshot.state;
+    if (duel_started_) {
+      YGO_EndDuel(pduel_);
+      duel_started_ = false;
+    }
+    done_ = true;
+    const ResponseLog &responses = state.response_log_;
+    intptr_t pduel =
+        resim.run(snapshot.start->duel, responses, responses.size());
+    copy_episode(state);
+    pduel_ = pduel;
+    duel_started_ = true;
+  }
+  for (std::size_t i = step_log_.size(); i < actions.size(); ++i) {
+    if (done_) {
+      throw std::runtime_error("Duel ended before the snapshot is reached");
+    }
+    step(actions[i]);
+  }
+}
+
 class YGOProEnv : public Env<YGOProEnvSpec> {
 protected:
   const int max_episode_steps_;
@@ -5273,23 +6510,35 @@ protected:
 
   std::uniform_int_distribution<uint64_t> dist_int_;
 
-  // The pool can't be in vector, so we create multiple pools manually
-  BS::thread_pool pool0_;
-  BS::thread_pool pool1_;
-  BS::thread_pool pool2_;
-  BS::thread_pool pool3_;
-  BS::thread_pool pool4_;
-
   const int max_timeout_{5};
- 
-  // YGOProEnvImpl env_impl0_;
-  // YGOProEnvImpl env_impl1_;
-  // YGOProEnvImpl env_impl2_;
-  // YGOProEnvImpl env_impl3_;
-  // YGOProEnvImpl env_impl4_;
+
+  // A hung impl is left in place for the thread still running it, so the
+  // vector must never grow past the reserved capacity. Only the watchdog
+  // thread appends to it, the impl in use is published through current_impl_.
   std::vector<YGOProEnvImpl> env_impls_;
+  std::atomic<int> current_impl_{0};
 
-  bool done_{true};
+  // written by the watchdog thread on a timeout
+  std::atomic<bool> done_{true};
+
+  // set by the watchdog thread when a hung impl cannot be replaced anymore,
+  // the next Reset or Step of the env then fails on its worker
+  std::atomic<bool> failed_{false};
+
+  // Reset and step run inline on the pool worker, the shared watchdog
+  // calls handle_timeout if one of them takes longer than timeout_
+  Watchdog::Watch watch_;
+
+  // replayed instead of a new duel by the next Reset, see YGOProEnvPool
+  std::optional<DuelSnapshot> pending_restore_;
+  // keep the rngs of the snapshot instead of reseeding them
+  bool exact_restore_{false};
+  // rebuilds the duels of snapshots, shared by the envs of a pool
+  std::shared_ptr<DuelResimulator> resim_;
+
+  YGOProEnvImpl &current_impl() {
+    return env_impls_[current_impl_.load(std::memory_order_acquire)];
+  }
 
 public:
   YGOProEnv(const Spec &spec, int env_id)
@@ -5297,51 +6546,84 @@ public:
         max_episode_steps_(spec.config["max_episode_steps"_]),
         elapsed_step_(max_episode_steps_ + 1),
         timeout_(spec.config["timeout"_]),
-        pool0_(1), pool1_(1), pool2_(1), pool3_(1), pool4_(1),
-        dist_int_(0, 0xffffffff) {
+        dist_int_(0, 0xffffffff),
+        watch_([this]() { handle_timeout(); }) {
     env_impls_.reserve(max_timeout_);
     env_impls_.emplace_back(spec, dist_int_(gen_));
   }
 
   bool IsDone() override { return done_; }
 
-  BS::thread_pool& get_pool(int idx) {
-    switch (idx) {
-      case 0: return pool0_;
-      case 1: return pool1_;
-      case 2: return pool2_;
-      case 3: return pool3_;
-      case 4: return pool4_;
-      default: throw std::runtime_error("Invalid pool index");
-    }
+  DuelSnapshot Snapshot() { return current_impl().snapshot(); }
+
+  void SetResimulator(std::shared_ptr<DuelResimulator> resim) {
+    resim_ = std::move(resim);
+  }
+
+  // Unless exact, the restored duel gets rngs of its own, mixed from the
+  // ones of the snapshot and this env's, so that clones don't play on alike
+  void SetRestore(DuelSnapshot snapshot, bool exact) {
+    pending_restore_ = std::move(snapshot);
+    exact_restore_ = exact;
   }
 
+  // Runs on the watchdog thread while the worker is still stuck in the old
+  // impl, which is quarantined and replaced by a new one. The watchdog has
+  // claimed the ticket of the stuck call, so if it ever returns the worker
+  // throws EnvStepAbandoned instead of writing a second state for the slot.
+  // Nothing may be thrown here, the monitor thread has no handler.
   void handle_timeout() {
-    env_impls_.emplace_back(spec_, dist_int_(gen_));
-    if (env_impls_.capacity() > max_timeout_) {
-      throw std::runtime_error("Too many timeouts");
+    int current = current_impl_.load(std::memory_order_relaxed);
+    if (current + 1 >= max_timeout_) {
+      failed_ = true;
+      fmt::println("Env {} timeout, too many timeouts", env_id_);
+    } else {
+      // within the reserved capacity, so the stuck impl is not moved
+      env_impls_.emplace_back(spec_, dist_int_(gen_));
+      current_impl_.store(current + 1, std::memory_order_release);
+      fmt::println("Env {} timeout, new env created", env_id_);
     }
     done_ = true;
-    State state = Allocate();
-    state["reward"_] = 1.0;
-    state["info:to_play"_] = 1;
-    state["info:is_selfplay"_] = 1;
-    state["info:win_reason"_] = 1;
-    state["info:num_options"_] = 1;
-    state["obs:global_"_][22] = uint8_t(1);
+    {
+      State state = Allocate();
+      state["reward"_] = 1.0;
+      state["info:to_play"_] = 1;
+      state["info:is_selfplay"_] = 1;
+      state["info:win_reason"_] = 1;
+      state["info:num_options"_] = 1;
+      state["obs:global_"_][22] = uint8_t(1);
+    }
+    PostProcess();
   }
 
   void Reset() override {
-    int idx = env_impls_.size() - 1;
-    auto& pool = get_pool(idx);
-    auto fut = pool.submit_task([this, idx]() {
-      env_impls_[idx].reset();
-    });
-    if (fut.wait_for(std::chrono::seconds(timeout_)) != std::future_status::ready) {
-      throw std::runtime_error("Reset timeout");
+    if (failed_) {
+      throw std::runtime_error("Too many timeouts");
+    }
+    auto &env_impl = current_impl();
+    bool restored = false;
+    auto ticket = watch_.Arm(std::chrono::seconds(timeout_));
+    {
+      LatencyTimer timer(reset_key_);
+      if (pending_restore_) {
+        timer.SetKey(restore_key_);
+        DuelSnapshot snapshot = std::move(*pending_restore_);
+        pending_restore_.reset();
+        env_impl.restore(snapshot, *resim_);
+        restored = true;
+      } else {
+        env_impl.reset();
+      }
+    }
+    if (!watch_.Disarm(ticket)) {
+      throw EnvStepAbandoned();
+    }
+    if (restored && !exact_restore_) {
+      // gen_ of the env is seeded with the env id
+      env_impl.reseed((static_cast<uint64_t>(env_id_) << 32) |
+                      dist_int_(gen_));
     }
 
-    auto &env_impl = env_impls_[idx];
     elapsed_step_ = 0;
     done_ = false;
     State state = Allocate();
@@ -5349,36 +6631,144 @@ public:
   }
 
   void Step(const Action &action) override {
-    int idx = env_impls_.size() - 1;
-    auto& pool = get_pool(idx);
+    if (failed_) {
+      throw std::runtime_error("Too many timeouts");
+    }
+    auto &env_impl = current_impl();
     int action_idx = action["action"_];
-    pool.detach_task([this, action_idx, idx]() {
-      // Test timeout: random sleep with probability 0.01
-      // if (dist_int_(gen_) % 10000 == 0) {
-      //   fmt::println("Env {} sleep {}", env_id_, env_impls_.capacity());
-      //   std::this_thread::sleep_for(std::chrono::seconds(5));
-      //   fmt::println("Env {} after {}", env_id_, env_impls_.capacity());
-      //   auto& env_impl = env_impls_[idx];
-      //   env_impl.step(action_idx);
-      //   std::this_thread::sleep_for(std::chrono::seconds(1));
-      //   return;
-      // }
-      env_impls_[idx].step(action_idx);
-    });
-    if (!pool.wait_for(std::chrono::seconds(timeout_))) {
-      handle_timeout();
-      fmt::println("Env {} timeout, new env created", env_id_);
-    } else {
-      auto& env_impl = env_impls_[idx];
-      done_ = env_impl.ret_reward_ != 0;
-      State state = Allocate();
-      env_impl.WriteState(state);
+    auto ticket = watch_.Arm(std::chrono::seconds(timeout_));
+    env_impl.step(action_idx);
+    if (!watch_.Disarm(ticket)) {
+      throw EnvStepAbandoned();
     }
+
+    done_ = env_impl.ret_reward_ != 0;
+    State state = Allocate();
+    env_impl.WriteState(state);
   }
 
 };
 
-using YGOProEnvPool = AsyncEnvPool<YGOProEnv>;
+/**
+ * AsyncEnvPool with snapshots of the duels, for search and rollback.
+ *
+ * Snapshots are kept in a pool and referred to by handles; a released slot
+ * and its action log are reused by the next snapshot. The duels of the
+ * snapshots are rebuilt by a DuelResimulator shared by the envs, configured
+ * by resim_interval, resim_capacity and resim_threads. Restore and CloneEnvs
+ * replay the duels on the workers as a reset of the target envs, whose
+ * states are then received as usual. Unless exact is set, each target env
+ * then draws its rngs afresh, see YGOProEnv::SetRestore. The source envs must not be stepping,
+ * i.e. their states are received and no action is sent to them yet.
+ */
+class YGOProEnvPool : public AsyncEnvPool<YGOProEnv> {
+ protected:
+  std::vector<DuelSnapshot> snapshots_;
+  std::vector<int> free_snapshots_;
+  std::mutex snapshot_mutex_;
+
+  YGOProEnv &CheckedEnv(int env_id) {
+    if ((env_id < 0) || (env_id >= static_cast<int>(num_envs_))) {
+      throw std::invalid_argument("Invalid env id: " + std::to_string(env_id));
+    }
+    return *envs_[env_id];
+  }
+
+  DuelSnapshot &CheckedSnapshot(int handle) {
+    if ((handle < 0) || (handle >= static_cast<int>(snapshots_.size())) ||
+        (snapshots_[handle].start == nullptr)) {
+      throw std::invalid_argument("Invalid snapshot: " +
+                                  std::to_string(handle));
+    }
+    return snapshots_[handle];
+  }
+
+  void ResetEnvs(const std::vector<int> &env_ids) {
+    Array arr(::Spec<int>({static_cast<int>(env_ids.size())}));
+    std::memcpy(arr.Data(), env_ids.data(), env_ids.size() * sizeof(int));
+    Reset(arr);
+  }
+
+ public:
+  explicit YGOProEnvPool(const Spec &spec) : AsyncEnvPool<YGOProEnv>(spec) {
+    auto resim = std::make_shared<DuelResimulator>(
+        spec.config["resim_interval"_], spec.config["resim_capacity"_],
+        spec.config["resim_threads"_]);
+    for (auto &env : envs_) {
+      env->SetResimulator(resim);
+    }
+  }
+
+  std::vector<DuelSnapshot> Snapshots(const std::vector<int> &env_ids) {
+    std::vector<DuelSnapshot> snapshots;
+    snapshots.reserve(env_ids.size());
+    for (int env_id : env_ids) {
+      snapshots.push_back(CheckedEnv(env_id).Snapshot());
+    }
+    return snapshots;
+  }
+
+  std::vector<int> Snapshot(const std::vector<int> &env_ids) {
+    std::vector<int> handles;
+    handles.reserve(env_ids.size());
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    for (int env_id : env_ids) {
+      DuelSnapshot snapshot = CheckedEnv(env_id).Snapshot();
+      int handle;
+      if (free_snapshots_.empty()) {
+        handle = snapshots_.size();
+        snapshots_.push_back(std::move(snapshot));
+      } else {
+        handle = free_snapshots_.back();
+        free_snapshots_.pop_back();
+        snapshots_[handle].start = std::move(snapshot.start);
+        // keeps the capacity of the slot
+        snapshots_[handle].actions = snapshot.actions;
+        snapshots_[handle].state = std::move(snapshot.state);
+      }
+      handles.push_back(handle);
+    }
+    return handles;
+  }
+
+  void Release(const std::vector<int> &handles) {
+    std::lock_guard<std::mutex> lock(snapshot_mutex_);
+    for (int handle : handles) {
+      CheckedSnapshot(handle).start.reset();
+      snapshots_[handle].state.reset();
+      free_snapshots_.push_back(handle);
+    }
+  }
+
+  void Restore(const std::vector<int> &handles,
+               const std::vector<int> &env_ids, bool exact) {
+    if (handles.size() != env_ids.size()) {
+      throw std::invalid_argument("Expected one snapshot per env");
+    }
+    {
+      std::lock_guard<std::mutex> lock(snapshot_mutex_);
+      for (std::size_t i = 0; i < env_ids.size(); ++i) {
+        CheckedEnv(env_ids[i]).SetRestore(CheckedSnapshot(handles[i]), exact);
+      }
+    }
+    ResetEnvs(env_ids);
+  }
+
+  /**
+   * Clone the duels of src_ids into dst_ids, without going through handles.
+   */
+  void CloneEnvs(const std::vector<int> &src_ids,
+                 const std::vector<int> &dst_ids, bool exact) {
+    if (src_ids.size() != dst_ids.size()) {
+      throw std::invalid_argument("Expected one source env per target env");
+    }
+    std::vector<DuelSnapshot> snapshots = Snapshots(src_ids);
+    for (std::size_t i = 0; i < dst_ids.size(); ++i) {
+      CheckedEnv(dst_ids[i]).SetRestore(std::move(snapshots[i]), exact);
+    }
+    ResetEnvs(dst_ids);
+  }
+};
 
 } // namespace ygopro
 
@@ -5390,8 +6780,8 @@ struct fmt::formatter<ygopro::LegalAction>: formatter<string_view> {
     auto format(const ygopro::LegalAction& action, FormatContext& ctx) const {
         std::stringstream ss;
         ss << "{";
-        if (!action.spec_.empty()) {
-          ss << "spec='" << action.spec_ << "', ";
+        if (action.spec_ != 0) {
+          ss << "spec='" << ygopro::spec_key_to_string(action.spec_) << "', ";
         }
         if (action.cid_ != 0) {
           ss << "cid=" << action.cid_ << ", ";